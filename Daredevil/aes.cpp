@@ -20,6 +20,7 @@
 /* ===================================================================== */
 #include "utils.h"
 #include "aes.h"
+#include "guess.h"
 
 /* Compute the number of bits set (Hamming weight or poulation count) in a
  * 16 bit integer. See the Bit Twiddling Hacks page:
@@ -33,12 +34,13 @@ uint8_t HW(uint16_t v)
 }
 
 /* Given the messages (m), use the bytenum-th byte to construct
- * the guesses for round R with the specified sbox.
+ * the guesses for round R with the specified sbox, kept as a model when
+ * model is not NULL.
  */
   template <class TypeGuess>
-int construct_guess_AES (TypeGuess ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint16_t * sbox, uint32_t n_keys, int8_t bit) {
+int construct_guess_AES (TypeGuess ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint16_t * sbox, uint32_t n_keys, int8_t bit, GuessModel<TypeGuess> * model) {
   TypeGuess **mem = NULL;
-  uint32_t i, j, nrows = 0;
+  uint32_t i, nrows = 0;
 
   if (R != 0) {
     fprintf (stderr, "[ERROR]: construct_guess_AES: Currently only round 0 is supported.\n");
@@ -53,32 +55,30 @@ int construct_guess_AES (TypeGuess ***guess, Matrix *m, uint32_t n_m, uint32_t b
     nrows += m[i].n_rows;
   }
 
-  if (import_matrices(&mem, m, n_m, 0) < 0) {
+  if (import_messages(&mem, &nrows, m, n_m) < 0) {
     fprintf (stderr, "[ERROR]: Importing matrix.\n");
     return -1;
   }
-  if (*guess == NULL) {
-    if (allocate_matrix<TypeGuess> (guess, n_keys, nrows) < 0) {
-      fprintf (stderr, "[ERROR]: Allocating memory for guesses.\n");
-      free_matrix (&mem, nrows);
-      return -1;
+  /* The guess only depends on the message byte xored with the key, so it is
+   * read from a table of the sbox outputs.
+   */
+  TypeGuess lut[256] = {0};
+  for (i=0; i < 256; i++) {
+    if (bit == -1) { /* No individual bits. */
+      lut[i] = HW ((TypeGuess) sbox[i]);
+    } else if (bit >= 0 && bit < 8) {
+      lut[i] = (TypeGuess) ((sbox[i] >> bit)&1);
     }
   }
 
-  for (i=0; i < nrows; i++) {
-    for (j=0; j < n_keys; j++) {
-        if (bit == -1) { /* No individual bits. */
-          (*guess)[j][i] = HW ((TypeGuess) sbox[ (uint8_t) mem[i][bytenum] ^ j ]);
-        } else if (bit >= 0 && bit < 8) {
-          (*guess)[j][i] = (TypeGuess) ((sbox[ (uint8_t) mem[i][bytenum] ^ j ] >> bit)&1);
-        }
-    }
-  }
-  free_matrix (&mem, nrows);
-  return 0;
+  vector<uint16_t> x(nrows);
+  for (i=0; i < nrows; i++)
+    x[i] = (uint8_t) mem[i][bytenum];
+  if (model != NULL)
+    return fill_guess_model(model, &x[0], lut, 256, n_keys, nrows);
+  return fill_guess(guess, &x[0], lut, n_keys, nrows);
 }
 
-
-template int construct_guess_AES (uint8_t ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint16_t * sbox, uint32_t n_keys, int8_t bit);
-template int construct_guess_AES ( int8_t ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint16_t * sbox, uint32_t n_keys, int8_t bit);
+template int construct_guess_AES (uint8_t ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint16_t * sbox, uint32_t n_keys, int8_t bit, GuessModel<uint8_t> * model);
+template int construct_guess_AES ( int8_t ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint16_t * sbox, uint32_t n_keys, int8_t bit, GuessModel<int8_t> * model);
 
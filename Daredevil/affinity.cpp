@@ -0,0 +1,199 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include <fstream>
+#include <algorithm>
+#include "affinity.h"
+
+/* Memory policies of mbind, called through syscall so that libnuma is not
+ * needed.
+ */
+#define MPOL_PREFERRED_    1
+#define MPOL_INTERLEAVE_   3
+#define MPOL_MF_MOVE_      (1 << 1)
+#define MAX_NODES          1024
+
+static int thread_policy = AFFINITY_NONE;
+static int memory_policy = NUMA_NONE;
+
+/* Identifiers of the nodes having CPUs the process may run on, and these
+ * CPUs.
+ */
+static vector<int> node_ids;
+static vector<vector<int> > node_cpus;
+
+/* Parses a sysfs list such as 0-3,8-11.
+ */
+static vector<int> parse_list(const string & str)
+{
+  vector<int> res;
+  size_t pos = 0;
+
+  while (pos < str.size()) {
+    size_t end = str.find(',', pos);
+    if (end == string::npos)
+      end = str.size();
+    string item = str.substr(pos, end - pos);
+    size_t dash = item.find('-');
+    if (item.find_first_of("0123456789") != string::npos) {
+      int lo = atoi(item.c_str());
+      int hi = (dash == string::npos) ? lo : atoi(item.c_str() + dash + 1);
+      for (int i = lo; i <= hi; i++)
+        res.push_back(i);
+    }
+    pos = end + 1;
+  }
+  return res;
+}
+
+static string read_line(const string & path)
+{
+  string line;
+  ifstream fin(path.c_str());
+  if (fin)
+    getline(fin, line);
+  return line;
+}
+
+void affinity_init(const Config & conf)
+{
+  vector<int> allowed, nodes;
+  cpu_set_t set;
+
+  thread_policy = conf.affinity;
+  memory_policy = conf.numa_policy;
+  node_ids.clear();
+  node_cpus.clear();
+
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int c = 0; c < CPU_SETSIZE; c++)
+      if (CPU_ISSET(c, &set))
+        allowed.push_back(c);
+  }
+  if (allowed.empty())
+    for (int c = 0; c < conf.n_threads; c++)
+      allowed.push_back(c);
+
+  nodes = parse_list(read_line("/sys/devices/system/node/online"));
+  for (size_t n = 0; n < nodes.size(); n++) {
+    vector<int> cpus = parse_list(read_line("/sys/devices/system/node/node" + to_string(nodes[n]) + "/cpulist"));
+    vector<int> mine;
+    for (size_t c = 0; c < cpus.size(); c++)
+      if (find(allowed.begin(), allowed.end(), cpus[c]) != allowed.end())
+        mine.push_back(cpus[c]);
+    if (!mine.empty() && nodes[n] < MAX_NODES) {
+      node_ids.push_back(nodes[n]);
+      node_cpus.push_back(mine);
+    }
+  }
+  if (node_ids.empty()) {
+    node_ids.push_back(0);
+    node_cpus.push_back(allowed);
+  }
+
+  if (thread_policy != AFFINITY_NONE || memory_policy != NUMA_NONE)
+    printf("[INFO] %i NUMA node(s) with %i CPU(s) available.\n", (int) node_ids.size(), (int) allowed.size());
+}
+
+int affinity_n_nodes()
+{
+  return (thread_policy == AFFINITY_NONE) ? 1 : node_ids.size();
+}
+
+int affinity_pin(int index)
+{
+  int node = 0, cpu;
+  cpu_set_t set;
+
+  if (thread_policy == AFFINITY_NONE || node_ids.empty())
+    return 0;
+
+  if (thread_policy == AFFINITY_SCATTER) {
+    node = index % node_ids.size();
+    cpu = node_cpus[node][(index / node_ids.size()) % node_cpus[node].size()];
+  } else {
+    size_t total = 0, i;
+    for (i = 0; i < node_cpus.size(); i++)
+      total += node_cpus[i].size();
+    i = index % total;
+    while (i >= node_cpus[node].size())
+      i -= node_cpus[node++].size();
+    cpu = node_cpus[node][i];
+  }
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    fprintf(stderr, "[WARNING] Pinning thread %i on CPU %i failed.\n", index, cpu);
+  return node;
+}
+
+/* Binds the whole pages of [addr, addr + len) with the given policy, the
+ * pages already touched being moved.
+ */
+static void bind_pages(void * addr, size_t len, int mode, const vector<int> & nodes)
+{
+#ifdef __linux__
+  unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+  size_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t start = ((uintptr_t) addr + page - 1) & ~(page - 1);
+  uintptr_t end = ((uintptr_t) addr + len) & ~(page - 1);
+
+  if (end <= start)
+    return;
+  for (size_t n = 0; n < nodes.size(); n++)
+    mask[nodes[n] / (8 * sizeof(unsigned long))] |= 1UL << (nodes[n] % (8 * sizeof(unsigned long)));
+  syscall(SYS_mbind, (void *) start, end - start, mode, mask, MAX_NODES, MPOL_MF_MOVE_);
+#else
+  (void) addr; (void) len; (void) mode; (void) nodes;
+#endif
+}
+
+  template <class Type>
+void affinity_place(Type ** matrix, int n_rows, size_t row_size, bool shared)
+{
+  int n_nodes = node_ids.size();
+
+  if (memory_policy == NUMA_NONE || n_nodes <= 1 || matrix == NULL)
+    return;
+
+  for (int r = 0; r < n_rows; r++) {
+    if (memory_policy == NUMA_INTERLEAVE || shared)
+      bind_pages(matrix[r], row_size, MPOL_INTERLEAVE_, node_ids);
+    else
+      bind_pages(matrix[r], row_size, MPOL_PREFERRED_, vector<int>(1, node_ids[(long int) r * n_nodes / n_rows]));
+  }
+}
+
+template void affinity_place(float ** matrix, int n_rows, size_t row_size, bool shared);
+template void affinity_place(double ** matrix, int n_rows, size_t row_size, bool shared);
+template void affinity_place(int8_t ** matrix, int n_rows, size_t row_size, bool shared);
+template void affinity_place(int16_t ** matrix, int n_rows, size_t row_size, bool shared);
+template void affinity_place(uint8_t ** matrix, int n_rows, size_t row_size, bool shared);
+template void affinity_place(BitWord ** matrix, int n_rows, size_t row_size, bool shared);
@@ -0,0 +1,67 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <stddef.h>
+#include "utils.h"
+
+/* Placement of the threads on the cores: left to the scheduler, filling the
+ * cores of a NUMA node before the next one, or spreading the threads over
+ * the nodes.
+ */
+#define AFFINITY_NONE     0
+#define AFFINITY_COMPACT  1
+#define AFFINITY_SCATTER  2
+
+/* Placement of the large buffers on the NUMA nodes: on the node touching
+ * them first, interleaved page by page over all the nodes, or the rows of the
+ * traces split in as many contiguous ranges as nodes, each range on one node.
+ */
+#define NUMA_NONE         0
+#define NUMA_INTERLEAVE   1
+#define NUMA_LOCAL        2
+
+/* Reads the NUMA nodes and their CPUs from sysfs, restricted to the CPUs the
+ * process may run on, and sets the policies of conf. A machine without NUMA
+ * is seen as a single node.
+ */
+void affinity_init(const Config & conf);
+
+/* Number of NUMA nodes the threads are spread over, 1 unless the threads are
+ * pinned.
+ */
+int affinity_n_nodes();
+
+/* Pins the calling thread, the index-th one of the pool, according to the
+ * policy. Returns the node it runs on, 0 when not pinned.
+ */
+int affinity_pin(int index);
+
+/* Applies the memory policy to the n_rows rows of row_size bytes of matrix,
+ * which must not have been written yet. Matrices read by all the threads are
+ * interleaved with the local policy too, the others have their rows split
+ * over the nodes as the tasks of workers_run are.
+ */
+  template <class Type>
+void affinity_place(Type ** matrix, int n_rows, size_t row_size, bool shared);
+
+#endif
@@ -0,0 +1,307 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#include <math.h>
+#include <complex>
+#include "align.h"
+#include "loader.h"
+#include "workers.h"
+
+/* Number of traces read from a file at a time.
+ */
+#define ALIGN_BATCH 1024
+
+typedef complex<double> cplx;
+
+/* In place iterative radix-2 FFT, n must be a power of two. The inverse is
+ * not scaled.
+ */
+static void fft(cplx * a, int n, bool inverse)
+{
+  int i, j, k, len;
+
+  for (i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j)
+      swap(a[i], a[j]);
+  }
+  for (len = 2; len <= n; len <<= 1) {
+    double ang = 2 * M_PI / len * (inverse ? 1 : -1);
+    cplx wl(cos(ang), sin(ang));
+    for (i = 0; i < n; i += len) {
+      cplx w(1);
+      for (k = 0; k < len / 2; k++) {
+        cplx u = a[i + k], v = a[i + k + len / 2] * w;
+        a[i + k] = u + v;
+        a[i + k + len / 2] = u - v;
+        w *= wl;
+      }
+    }
+  }
+}
+
+/* Structure used by the threads aligning a slice of the traces of a batch.
+ */
+template <class TypeTrace>
+struct AlignTraces {
+
+  TypeTrace ** seg;
+  const cplx * pattern;
+  int n_fft;
+  int length;
+  int n_lags;
+  int start;
+  int end;
+  int * lag;
+  double * quality;
+
+  AlignTraces(TypeTrace ** s, const cplx * p, int nf, int len, int nl, int st, int e, int * l, double * q):
+    seg(s), pattern(p), n_fft(nf), length(len), n_lags(nl), start(st), end(e), lag(l), quality(q) {
+  }
+};
+
+/* Best lag of the pattern in a segment, from the raw cross-correlation c:
+ * the pattern being centered and normalized, the correlation only needs to
+ * be normalized by the deviation of each window of the segment.
+ */
+  template <class TypeTrace>
+static void best_lag(const TypeTrace * x, const double * c, int length, int n_lags, int * lag, double * quality)
+{
+  double s = 0, sq = 0, dev, r;
+  int i;
+
+  for (i = 0; i < length; i++) {
+    s += x[i];
+    sq += (double) x[i] * x[i];
+  }
+  *lag = 0;
+  *quality = -2;
+  for (i = 0; i < n_lags; i++) {
+    if (i > 0) {
+      s += (double) x[i + length - 1] - x[i - 1];
+      sq += (double) x[i + length - 1] * x[i + length - 1] - (double) x[i - 1] * x[i - 1];
+    }
+    dev = sq - s * s / length;
+    r = dev > 0 ? c[i] / sqrt(dev) : 0;
+    if (r > *quality) {
+      *quality = r;
+      *lag = i;
+    }
+  }
+}
+
+/* Two real segments are correlated at once, as the real and imaginary parts
+ * of one complex signal: the pattern being real, the real and imaginary
+ * parts of the result are their two correlations.
+ */
+  template <class TypeTrace>
+static void * align_slice(void * args_in)
+{
+  AlignTraces<TypeTrace> * A = (AlignTraces<TypeTrace> *) args_in;
+  int seg_length = A->length + A->n_lags - 1;
+  vector<cplx> buf(A->n_fft);
+  vector<double> c0(A->n_lags), c1(A->n_lags);
+
+  for (int j = A->start; j < A->end; j += 2) {
+    bool pair = j + 1 < A->end;
+    for (int i = 0; i < A->n_fft; i++)
+      buf[i] = i < seg_length ? cplx(A->seg[j][i], pair ? A->seg[j + 1][i] : 0) : 0;
+    fft(&buf[0], A->n_fft, false);
+    for (int i = 0; i < A->n_fft; i++)
+      buf[i] *= conj(A->pattern[i]);
+    fft(&buf[0], A->n_fft, true);
+    for (int i = 0; i < A->n_lags; i++) {
+      c0[i] = buf[i].real() / A->n_fft;
+      c1[i] = buf[i].imag() / A->n_fft;
+    }
+    best_lag(A->seg[j], &c0[0], A->length, A->n_lags, A->lag + j, A->quality + j);
+    if (pair)
+      best_lag(A->seg[j + 1], &c1[0], A->length, A->n_lags, A->lag + j + 1, A->quality + j + 1);
+  }
+  return NULL;
+}
+
+/* Writes the selected traces, aligned, over the samples attacked.
+ */
+  template <class TypeTrace>
+static int write_aligned(Config & conf, int first, int n_cols)
+{
+  int res, f, r, shift = conf.align_shift, n_written = 0;
+  TypeTrace ** row = NULL;
+  FILE * out;
+
+  out = fopen(conf.align_output.c_str(), "wb");
+  if (out == NULL) {
+    fprintf(stderr, "[ERROR] Opening %s.\n", conf.align_output.c_str());
+    return -1;
+  }
+  res = allocate_matrix(&row, 1, n_cols + 2 * shift);
+  if (res != 0) {
+    fprintf(stderr, "[ERROR] Allocating memory for the alignment.\n");
+    fclose(out);
+    return -1;
+  }
+  for (int j = 0; j < conf.n_traces; j++) {
+    int t = conf.trace_index.empty() ? j : conf.trace_index[j];
+    locate_trace(conf, t, &f, &r);
+    if (fload(conf.traces[f].filename, &row, 1, r, n_cols + 2 * shift, first - shift, conf.traces[f].n_columns) != (size_t) (n_cols + 2 * shift)
+        || fwrite(row[0] + shift + conf.trace_shift[t], sizeof(TypeTrace), n_cols, out) != (size_t) n_cols) {
+      fprintf(stderr, "[ERROR] Writing the aligned traces.\n");
+      res = -1;
+      break;
+    }
+    n_written++;
+  }
+  fclose(out);
+  free_matrix(&row, 1);
+  if (res == 0)
+    printf("[ALIGN] Aligned traces written to %s [%ix%i].\n", conf.align_output.c_str(), n_written, n_cols);
+  return res;
+}
+
+  template <class TypeTrace>
+int align_traces(Config & conf)
+{
+  int res, f, r, n, n_fft = 1,
+      shift = conf.align_shift,
+      length = conf.align_length,
+      n_lags = 2 * shift + 1,
+      seg_length = length + 2 * shift,
+      first = conf.align_first - shift,
+      span_first = sample_index(conf, 0),
+      span_cols = sample_index(conf, conf.n_samples - 1) + conf.pool_window - span_first,
+      row_offset = 0,
+      n_threads, workload;
+  TypeTrace ** seg = NULL;
+  double mean = 0, norm = 0;
+  vector<int> lag(ALIGN_BATCH), kept;
+  vector<double> quality(ALIGN_BATCH), pat(length);
+  vector<cplx> pattern;
+  int min_shift = 0, max_shift = 0;
+
+  if (length <= 0 || first < 0 || first + seg_length > (int) conf.total_n_samples) {
+    fprintf(stderr, "[ERROR] The alignment window and shifts exceed the traces.\n");
+    return -1;
+  }
+  if (span_first - shift < 0 || span_first + span_cols + shift > (int) conf.total_n_samples) {
+    fprintf(stderr, "[ERROR] The attacked samples must be at least %i samples inside the traces to be aligned.\n", shift);
+    return -1;
+  }
+  while (n_fft < seg_length)
+    n_fft <<= 1;
+
+  res = allocate_matrix(&seg, ALIGN_BATCH, seg_length);
+  if (res != 0) {
+    fprintf(stderr, "[ERROR] Allocating memory for the alignment.\n");
+    return -1;
+  }
+
+  /* The reference pattern, centered and normalized, and its spectrum.
+   */
+  locate_trace(conf, conf.trace_index.empty() ? 0 : conf.trace_index[0], &f, &r);
+  if (fload(conf.traces[f].filename, &seg, 1, r, length, conf.align_first, conf.traces[f].n_columns) != (size_t) length) {
+    fprintf(stderr, "[ERROR] Loading the reference pattern.\n");
+    free_matrix(&seg, ALIGN_BATCH);
+    return -1;
+  }
+  for (int i = 0; i < length; i++)
+    mean += seg[0][i];
+  mean /= length;
+  for (int i = 0; i < length; i++) {
+    pat[i] = seg[0][i] - mean;
+    norm += pat[i] * pat[i];
+  }
+  norm = sqrt(norm);
+  pattern.assign(n_fft, 0);
+  for (int i = 0; i < length; i++)
+    pattern[i] = norm > 0 ? pat[i] / norm : 0;
+  fft(&pattern[0], n_fft, false);
+
+  /* Every file is processed by batches of traces, split over the threads.
+   */
+  conf.trace_shift.assign(conf.total_n_traces, 0);
+  vector<bool> selected(conf.total_n_traces, conf.trace_index.empty());
+  if (conf.trace_index.empty())
+    fill(selected.begin() + conf.n_traces, selected.end(), false);
+  for (size_t j = 0; j < conf.trace_index.size(); j++)
+    selected[conf.trace_index[j]] = true;
+
+  for (f = 0; f < conf.n_file_trace; f++) {
+    for (int b = 0; b < (int) conf.traces[f].n_rows; b += ALIGN_BATCH) {
+      int n_rows = min(ALIGN_BATCH, (int) conf.traces[f].n_rows - b);
+      if (fload(conf.traces[f].filename, &seg, n_rows, b, seg_length, first, conf.traces[f].n_columns) != (size_t) n_rows * seg_length) {
+        fprintf(stderr, "[ERROR] Loading the traces to align.\n");
+        free_matrix(&seg, ALIGN_BATCH);
+        return -1;
+      }
+
+      n_threads = max(1, min(conf.n_threads, n_rows / 2));
+      workload = (n_rows / n_threads) & ~1;
+      vector<AlignTraces<TypeTrace> > ta;
+      ta.reserve(n_threads);
+      for (n = 0; n < n_threads; n++) {
+        ta.push_back(AlignTraces<TypeTrace>(seg, &pattern[0], n_fft, length, n_lags, n*workload, n == n_threads - 1 ? n_rows : (n + 1)*workload, &lag[0], &quality[0]));
+      }
+      res = workers_run(align_slice<TypeTrace>, ta);
+      if (res != 0) {
+        free_matrix(&seg, ALIGN_BATCH);
+        return -1;
+      }
+
+      for (int j = 0; j < n_rows; j++) {
+        int t = row_offset + b + j;
+        conf.trace_shift[t] = lag[j] - shift;
+        if (!selected[t])
+          continue;
+        if (quality[j] < conf.align_threshold)
+          continue;
+        kept.push_back(t);
+        min_shift = min(min_shift, conf.trace_shift[t]);
+        max_shift = max(max_shift, conf.trace_shift[t]);
+      }
+    }
+    row_offset += conf.traces[f].n_rows;
+  }
+  free_matrix(&seg, ALIGN_BATCH);
+
+  printf("[ALIGN] %lu traces aligned with shifts in [%i, %i], %lu dropped.\n", kept.size(), min_shift, max_shift, conf.n_traces - kept.size());
+  if (kept.size() < 2) {
+    fprintf(stderr, "[ERROR] Not enough traces left after the alignment.\n");
+    return -1;
+  }
+  if ((int) kept.size() < conf.n_traces || !conf.trace_index.empty())
+    conf.trace_index = kept;
+  conf.n_traces = kept.size();
+
+  if (conf.align_output != "") {
+    res = write_aligned<TypeTrace>(conf, span_first, span_cols);
+    if (res != 0)
+      return -1;
+  }
+  printf("\n");
+  return 0;
+}
+
+template int align_traces<float>(Config & conf);
+template int align_traces<double>(Config & conf);
+template int align_traces<int8_t>(Config & conf);
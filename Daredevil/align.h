@@ -0,0 +1,37 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#ifndef ALIGN_H
+#define ALIGN_H
+
+#include "utils.h"
+
+/* Static alignment of the traces. The reference pattern is the window of
+ * align_length samples starting at align_first in the first selected trace.
+ * Every trace is cross-correlated with it (using an FFT) over shifts up to
+ * +-align_shift samples, and the shift with the highest normalized
+ * correlation is kept in conf.trace_shift, used by TraceLoader. The traces
+ * whose best correlation is below align_threshold are dropped from the
+ * selection. The aligned traces are written to align_output if specified.
+ */
+template <class TypeTrace>
+int align_traces(Config & conf);
+
+#endif
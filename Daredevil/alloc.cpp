@@ -0,0 +1,136 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unordered_map>
+#include "alloc.h"
+
+using namespace std;
+
+#define MB 1e6
+
+static const char * tag_names[MEM_N_TAGS] = {
+  "traces", "tmp", "guesses", "queues", "scratch"
+};
+
+struct MemBlock {
+
+  size_t size;
+  MemTag tag;
+};
+
+/* The blocks in use, and the counters of every subsystem, the last entry
+ * being the total, protected by lock. The map is never destroyed, so that the
+ * scratch memory of the threads can still be freed at exit.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static unordered_map<void *, MemBlock> * blocks = NULL;
+static size_t live[MEM_N_TAGS + 1];
+static size_t peak[MEM_N_TAGS + 1];
+static size_t stage_peak[MEM_N_TAGS + 1];
+static size_t cap = 0;
+static bool report = false;
+
+void mem_init(long int c, bool r)
+{
+  cap = (c > 0) ? c : 0;
+  report = r;
+}
+
+/* Prints the memory in use and the peaks, lock being held.
+ */
+static void print_usage(FILE * out, const char * prefix, const char * stage)
+{
+  fprintf(out, "%s %s: %.2fMB in use, %.2fMB at peak (%.2fMB overall).\n",
+      prefix, stage, live[MEM_N_TAGS] / MB, stage_peak[MEM_N_TAGS] / MB, peak[MEM_N_TAGS] / MB);
+  for (int t = 0; t < MEM_N_TAGS; t++) {
+    if (peak[t] == 0)
+      continue;
+    fprintf(out, "\t%-8s %10.2fMB in use %10.2fMB at peak\n",
+        tag_names[t], live[t] / MB, stage_peak[t] / MB);
+  }
+}
+
+static inline void count(int t, size_t size)
+{
+  live[t] += size;
+  if (live[t] > stage_peak[t])
+    stage_peak[t] = live[t];
+  if (live[t] > peak[t])
+    peak[t] = live[t];
+}
+
+void * mem_alloc(size_t size, MemTag tag, size_t align)
+{
+  void * res = NULL;
+
+  pthread_mutex_lock(&lock);
+  if (cap > 0 && live[MEM_N_TAGS] + size > cap) {
+    fprintf(stderr, "[ERROR] Allocating %.2fMB for the %s would exceed the memory cap of %.2fMB.\n",
+        size / MB, tag_names[tag], cap / MB);
+    print_usage(stderr, "[ERROR] Memory", "at the failure");
+    exit(EXIT_FAILURE);
+  }
+  if (posix_memalign(&res, align, size > 0 ? size : align) != 0) {
+    fprintf(stderr, "[ERROR] Allocating %.2fMB for the %s, with %.2fMB in use.\n",
+        size / MB, tag_names[tag], live[MEM_N_TAGS] / MB);
+    pthread_mutex_unlock(&lock);
+    return NULL;
+  }
+  if (blocks == NULL)
+    blocks = new unordered_map<void *, MemBlock>;
+  MemBlock b = {size, tag};
+  (*blocks)[res] = b;
+  count(tag, size);
+  count(MEM_N_TAGS, size);
+  pthread_mutex_unlock(&lock);
+  return res;
+}
+
+void mem_free(void * ptr)
+{
+  if (ptr == NULL)
+    return;
+
+  pthread_mutex_lock(&lock);
+  unordered_map<void *, MemBlock>::iterator it;
+  if (blocks != NULL && (it = blocks->find(ptr)) != blocks->end()) {
+    live[it->second.tag] -= it->second.size;
+    live[MEM_N_TAGS] -= it->second.size;
+    blocks->erase(it);
+  }
+  pthread_mutex_unlock(&lock);
+  free(ptr);
+}
+
+void mem_report(const char * stage)
+{
+  if (!report)
+    return;
+
+  pthread_mutex_lock(&lock);
+  print_usage(stdout, "[MEMORY]", stage);
+  for (int t = 0; t <= MEM_N_TAGS; t++)
+    stage_peak[t] = live[t];
+  pthread_mutex_unlock(&lock);
+  fflush(stdout);
+}
@@ -0,0 +1,60 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+
+/* Tracked allocations: the large buffers are accounted to the subsystem they
+ * belong to, so that the memory in use and the peaks of every subsystem can
+ * be reported after each stage, and so that a cap can stop the attack with a
+ * description of the memory in use before the system runs out of it.
+ */
+enum MemTag {
+  MEM_TRACES,
+  MEM_TMP,
+  MEM_GUESSES,
+  MEM_QUEUES,
+  MEM_SCRATCH,
+  MEM_N_TAGS
+};
+
+/* Sets the cap on the tracked memory in bytes (0 for none), and whether
+ * mem_report prints anything.
+ */
+void mem_init(long int cap, bool report);
+
+/* Returns size bytes aligned on align, a power of two multiple of the size of
+ * a pointer, accounted to tag, or NULL on failure. An allocation which would
+ * exceed the cap prints the memory in use and exits.
+ */
+void * mem_alloc(size_t size, MemTag tag, size_t align = 2 * sizeof(void *));
+
+/* Frees a block of mem_alloc. NULL is ignored.
+ */
+void mem_free(void * ptr);
+
+/* Prints the memory in use by every subsystem after stage, with the peaks
+ * reached since the previous report.
+ */
+void mem_report(const char * stage);
+
+#endif
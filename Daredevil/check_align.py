@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+
+# Behavior check of the alignments. Synthetic AES traces leaking the Hamming
+# weight of the first SBox outputs are rolled by up to +-8 samples and
+# attacked with the static (align_window) and the elastic (dtw_band)
+# alignments. On traces which are only shifted, at two levels of noise, the
+# elastic alignment must find the key at least as well as the static one. On
+# traces which also have local insertions and deletions of samples, it must
+# find the key clearly better.
+# Usage: check_align.py [daredevil]
+
+import os
+import random
+import re
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+N_TRACES = 2000
+N_SAMPLES = 400
+MAX_SHIFT = 8
+KEY = bytes.fromhex('2b7e151628aed2a6abf7158809cf4f3c')
+TOLERANCE = 1e-3
+ELASTIC_GAIN = 1.5
+
+here = os.path.dirname(os.path.abspath(__file__))
+daredevil = os.path.abspath(sys.argv[1]) if len(sys.argv) > 1 else os.path.join(here, 'daredevil')
+sbox_lut = os.path.join(here, 'LUT', 'AES_AFTER_SBOX')
+
+with open(sbox_lut) as f:
+    sbox = [int(x, 0) for x in re.split(r'[\s,{}]+', f.read()) if x]
+
+config = '''[Traces]
+files=1
+trace_type=f
+transpose=true
+index=100
+nsamples=200
+trace=%(dir)s/traces %(n)i %(m)i
+
+[Guesses]
+files=1
+guess_type=u
+transpose=true
+guess=%(dir)s/plain %(n)i 16
+
+[General]
+threads=4
+order=1
+return_type=double
+algorithm=AES
+position=%(lut)s
+round=0
+bytenum=0
+bitnum=none
+memory=1G
+top=5
+%(align)s
+'''
+
+# Generates the traces and their messages, with events local insertions or
+# deletions of 1 to 3 samples before the roll.
+def generate(directory, noise, events, rng):
+    wave = [rng.gauss(0, 1) for i in range(N_SAMPLES + 4)]
+    wave = [4 * sum(wave[i:i + 5]) / 5 for i in range(N_SAMPLES)]
+    with open(os.path.join(directory, 'plain'), 'wb') as fp, open(os.path.join(directory, 'traces'), 'wb') as ft:
+        for j in range(N_TRACES):
+            pt = bytes(rng.randrange(256) for b in range(16))
+            trace = [wave[i] + rng.gauss(0, noise) for i in range(N_SAMPLES)]
+            for b in range(4):
+                trace[150 + b * 20] += 0.7 * bin(sbox[pt[b] ^ KEY[b]]).count('1')
+            for e in range(events):
+                p = rng.randrange(60, 300)
+                k = rng.randint(1, 3)
+                if rng.random() < 0.5:
+                    trace = trace[:p] + [trace[p]] * k + trace[p:N_SAMPLES - k]
+                else:
+                    trace = trace[:p] + trace[p + k:] + [trace[-1]] * k
+            shift = rng.randint(-MAX_SHIFT, MAX_SHIFT)
+            trace = trace[-shift:] + trace[:-shift]
+            fp.write(pt)
+            ft.write(struct.pack('%if' % N_SAMPLES, *trace))
+
+def best_score(directory, align):
+    cfg = os.path.join(directory, 'check.cfg')
+    with open(cfg, 'w') as f:
+        f.write(config % {'dir': directory, 'n': N_TRACES, 'm': N_SAMPLES, 'lut': sbox_lut, 'align': align})
+    out = subprocess.check_output([daredevil, '-c', cfg], universal_newlines=True)
+    m = re.search(r' 1: 0x([0-9a-f]+)\s+sum: ([-0-9.e]+)', out)
+    assert m, "No result for %s" % align.replace('\n', ' ')
+    return int(m.group(1), 16), float(m.group(2))
+
+directory = tempfile.mkdtemp()
+failed = False
+try:
+    rng = random.Random(7)
+    for noise, events in ((1.0, 0), (2.0, 0), (1.0, 4)):
+        generate(directory, noise, events, rng)
+        key_s, static = best_score(directory, 'align_window=100 200\nalign_shift=20')
+        key_d, dtw = best_score(directory, 'dtw_band=20\ndtw_output=%s/warped.bin' % directory)
+        if events == 0:
+            ok = key_d == KEY[0] and dtw >= static - TOLERANCE
+        else:
+            ok = key_d == KEY[0] and dtw >= ELASTIC_GAIN * static
+        print('noise %.1f, %i insertions/deletions: static 0x%02x %f, dtw 0x%02x %f %s' % (noise, events, key_s, static, key_d, dtw, 'ok' if ok else 'FAILED'))
+        failed |= not ok
+finally:
+    shutil.rmtree(directory)
+sys.exit(1 if failed else 0)
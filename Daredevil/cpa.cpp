@@ -22,36 +22,56 @@
 #include "cpa.h"
 #include "omp.h"
 #include "sm4.h"
+#include "loader.h"
 
 
-/* Given the messages stored in m, use the bytenum-th byte to construct
- * the guesses for round R for algorithm alg and store the guesses in guess.
- * des_switch is only used by DES
+/* Builds the guesses of algorithm alg into guess, or into model when not
+ * NULL.
  */
 template <class TypeGuess>
-int construct_guess (TypeGuess ***guess, uint32_t alg, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint32_t des_switch, uint16_t * sbox, uint32_t n_keys, int8_t bit) {
-  int ret;
-
+static int construct_guess_alg (TypeGuess ***guess, GuessModel<TypeGuess> * model, uint32_t alg, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint32_t des_switch, uint16_t * sbox, uint32_t n_keys, int8_t bit) {
   switch (alg) {
     case ALG_AES:
-      ret = construct_guess_AES (guess, m, n_m, bytenum, R, sbox, n_keys, bit);
-      if (ret < 0) return -1;
-      break;
+      return construct_guess_AES (guess, m, n_m, bytenum, R, sbox, n_keys, bit, model);
     case ALG_DES:
-      ret = construct_guess_DES (guess, m, n_m, bytenum, R, des_switch, sbox, n_keys, bit);
-      if (ret < 0) return -1;
-      break;
+      return construct_guess_DES (guess, m, n_m, bytenum, R, des_switch, sbox, n_keys, bit, model);
     case ALG_SM4:
-      ret = construct_guess_SM4 (guess, m, n_m, bytenum, R, sbox, n_keys, bit);
-      if (ret < 0) return -1;
-      break;
+      return construct_guess_SM4 (guess, m, n_m, bytenum, R, sbox, n_keys, bit, model);
     default:
       fprintf (stderr, "Algorithm is not supported (yet).\n");
       return -1;
   }
+}
+
+/* Given the messages stored in m, use the bytenum-th byte to construct
+ * the guesses for round R for algorithm alg and store the guesses in guess.
+ * des_switch is only used by DES
+ */
+template <class TypeGuess>
+int construct_guess (TypeGuess ***guess, uint32_t alg, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint32_t des_switch, uint16_t * sbox, uint32_t n_keys, int8_t bit, const vector<int> & trace_index) {
+  int ret;
+
+  ret = construct_guess_alg (guess, (GuessModel<TypeGuess> *) NULL, alg, m, n_m, bytenum, R, des_switch, sbox, n_keys, bit);
+  if (ret < 0) return -1;
+  select_guess_columns(*guess, n_keys, trace_index);
   return 1;
 
 }
 
-template int construct_guess (uint8_t ***guess, uint32_t alg, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint32_t des_switch, uint16_t * sbox, uint32_t n_keys, int8_t bit);
+template <class TypeGuess>
+int construct_guess_model (GuessModel<TypeGuess> * model, uint32_t alg, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint32_t des_switch, uint16_t * sbox, uint32_t n_keys, int8_t bit, const vector<int> & trace_index) {
+  int ret;
+
+  ret = construct_guess_alg ((TypeGuess ***) NULL, model, alg, m, n_m, bytenum, R, des_switch, sbox, n_keys, bit);
+  if (ret < 0) return -1;
+
+  if (!trace_index.empty()) {
+    for (size_t j = 0; j < trace_index.size(); j++)
+      model->x[j] = model->x[trace_index[j]];
+    model->x.resize(trace_index.size());
+  }
+  return 1;
+}
 
+template int construct_guess (uint8_t ***guess, uint32_t alg, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint32_t des_switch, uint16_t * sbox, uint32_t n_keys, int8_t bit, const vector<int> & trace_index);
+template int construct_guess_model (GuessModel<uint8_t> * model, uint32_t alg, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint32_t des_switch, uint16_t * sbox, uint32_t n_keys, int8_t bit, const vector<int> & trace_index);
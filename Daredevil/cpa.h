@@ -28,6 +28,7 @@
 #include "aes.h"
 #include "des.h"
 #include "pearson.h"
+#include "guess.h"
 
 
 #define ALG_AES                 0
@@ -41,7 +42,13 @@
 
 /* Given the messages stored in m, use the bytenum-th byte to construct
  * the guesses for round R at position pos for algorithm alg and store the guesses in guess.
+ * If trace_index is not empty, only the guesses of these traces are kept.
  */
-template <class TypeGuess> int construct_guess (TypeGuess ***guess, uint32_t alg, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint32_t pos, uint16_t * sbox, uint32_t n_keys, int8_t bit);
+template <class TypeGuess> int construct_guess (TypeGuess ***guess, uint32_t alg, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint32_t pos, uint16_t * sbox, uint32_t n_keys, int8_t bit, const vector<int> & trace_index = vector<int>());
+
+/* Same as construct_guess, the guesses being kept as their inputs and the
+ * table of the model in model, generated by the correlation kernels.
+ */
+template <class TypeGuess> int construct_guess_model (GuessModel<TypeGuess> * model, uint32_t alg, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint32_t pos, uint16_t * sbox, uint32_t n_keys, int8_t bit, const vector<int> & trace_index = vector<int>());
 
 #endif
@@ -0,0 +1,433 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#include <string.h>
+#include <unordered_map>
+#include "dedup.h"
+#include "loader.h"
+#include "workers.h"
+#include "guess.h"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME  1099511628211ULL
+#define MIX_OFFSET 0x9e3779b97f4a7c15ULL
+#define MIX_PRIME  0xff51afd7ed558ccdULL
+
+/* Structure used by the threads hashing a slice of the columns.
+ */
+template <typename Type>
+struct HashColumns {
+
+  Type ** trace;
+  int start;
+  int length;
+  int n_traces;
+  uint64_t * hash;
+  int8_t * sign;
+
+  HashColumns(Type ** tr, int st, int len, int nt, uint64_t * h, int8_t * s):
+    trace(tr), start(st), length(len), n_traces(nt), hash(h), sign(s) {
+  }
+};
+
+/* Structure used by the threads hashing the samples of a chunk for a slice
+ * of the traces.
+ */
+template <typename Type>
+struct HashTraces {
+
+  Type ** traces;
+  int n_load;
+  int start;
+  int end;
+  uint64_t * h1;
+  uint64_t * h2;
+
+  HashTraces(Type ** tr, int nl, int st, int e, uint64_t * a, uint64_t * b):
+    traces(tr), n_load(nl), start(st), end(e), h1(a), h2(b) {
+  }
+};
+
+SampleGroups::SampleGroups(int n_cols): n_columns(n_cols), n_skipped(0)
+{
+  rep = (int *) malloc(n_cols * sizeof(int));
+  sign = (int8_t *) malloc(n_cols * sizeof(int8_t));
+  reset(0, n_cols);
+}
+
+SampleGroups::~SampleGroups()
+{
+  free(rep);
+  free(sign);
+}
+
+void SampleGroups::reset(int first, int n_cols)
+{
+  for (int i = first; i < first + n_cols; i++) {
+    rep[i] = i;
+    sign[i] = 1;
+  }
+}
+
+/* A column is represented by the differences to its first element, which do
+ * not depend on a constant offset. The sign of the first non zero difference
+ * is then used to map a column and its complement to the same values.
+ */
+template <class Type>
+static inline double canonical(Type * col, int j, int8_t sign)
+{
+  return sign * ((double) col[j] - (double) col[0]);
+}
+
+/* Bits of v for the hashes, -0.0 giving the bits of 0.0. The comparison is
+ * explicit, as -Ofast drops the addition of 0.0.
+ */
+static inline uint64_t value_bits(double v)
+{
+  uint64_t bits;
+
+  if (v == 0.0)
+    return 0;
+  memcpy(&bits, &v, sizeof(bits));
+  return bits;
+}
+
+  template <class Type>
+static void * hash_columns(void * args_in)
+{
+  HashColumns<Type> * H = (HashColumns<Type> *) args_in;
+  int i, j;
+  uint64_t h;
+  int8_t s;
+
+  for (i = H->start; i < H->start + H->length; i++) {
+    Type * col = H->trace[i];
+    s = 0;
+    for (j = 1; j < H->n_traces && !s; j++) {
+      if (col[j] != col[0])
+        s = ((double) col[j] > (double) col[0]) ? 1 : -1;
+    }
+    if (!s) s = 1;
+
+    h = FNV_OFFSET;
+    for (j = 1; j < H->n_traces; j++) {
+      h = (h ^ value_bits(canonical(col, j, s))) * FNV_PRIME;
+    }
+    H->hash[i] = h;
+    H->sign[i] = s;
+  }
+  return NULL;
+}
+
+  template <class Type>
+static bool same_column(Type ** trace, int a, int8_t sa, int b, int8_t sb, int n_traces)
+{
+  for (int j = 1; j < n_traces; j++) {
+    if (canonical(trace[a], j, sa) != canonical(trace[b], j, sb))
+      return false;
+  }
+  return true;
+}
+
+/* A column of packed bits is complemented when its first bit is set, so that
+ * its canonical words start with a 0. The bits past the last trace are left
+ * out.
+ */
+static inline BitWord canonical_word(const BitWord * col, int w, int n_traces)
+{
+  BitWord x = col[0] & 1 ? ~col[w] : col[w];
+  int n = n_traces - w * WORD_BITS;
+
+  return n < WORD_BITS ? x & (((BitWord) 1 << n) - 1) : x;
+}
+
+template <>
+void * hash_columns<BitWord>(void * args_in)
+{
+  HashColumns<BitWord> * H = (HashColumns<BitWord> *) args_in;
+  int n_words = row_length<BitWord>(H->n_traces);
+  uint64_t h;
+  BitWord any;
+
+  for (int i = H->start; i < H->start + H->length; i++) {
+    const BitWord * col = H->trace[i];
+    h = FNV_OFFSET;
+    any = 0;
+    for (int w = 0; w < n_words; w++) {
+      BitWord x = canonical_word(col, w, H->n_traces);
+      h = (h ^ x) * FNV_PRIME;
+      any |= x;
+    }
+    H->hash[i] = h;
+    H->sign[i] = (col[0] & 1) && any ? -1 : 1;
+  }
+  return NULL;
+}
+
+template <>
+bool same_column<BitWord>(BitWord ** trace, int a, int8_t, int b, int8_t, int n_traces)
+{
+  for (int w = 0; w < row_length<BitWord>(n_traces); w++) {
+    if (canonical_word(trace[a], w, n_traces) != canonical_word(trace[b], w, n_traces))
+      return false;
+  }
+  return true;
+}
+
+/* Hashes the columns in parallel, then buckets them by hash. Every collision
+ * is checked on the actual values, so that the grouping is exact.
+ */
+  template <class Type>
+int p_group_samples(Type ** trace, int first, int n_cols, int n_traces, int n_threads, SampleGroups * groups, const Config & conf, int offset)
+{
+  int n, rc, i, workload;
+  uint64_t * hash;
+  int8_t * sign;
+  unordered_map<uint64_t, vector<int> > buckets;
+
+  groups->reset(first, n_cols);
+  if (n_cols <= 1 || n_traces <= 1)
+    return 0;
+
+  workload = n_cols/n_threads;
+  while (workload < 1) {
+    n_threads -= 1;
+    workload = n_cols/n_threads;
+  }
+
+  hash = (uint64_t *) malloc(n_cols * sizeof(uint64_t));
+  sign = (int8_t *) malloc(n_cols * sizeof(int8_t));
+  if (hash == NULL || sign == NULL) {
+    fprintf (stderr, "[ERROR] Memory alloc failed.\n");
+    free (hash);
+    free (sign);
+    return -1;
+  }
+
+  vector<HashColumns<Type> > ta;
+  ta.reserve(n_threads);
+
+  for (n = 0; n < n_threads; n++)
+    ta.push_back(HashColumns<Type>(trace + first, n*workload, workload + ((n + 1) / n_threads) * (n_cols % n_threads), n_traces, hash, sign));
+  rc = workers_run(hash_columns<Type>, ta);
+  if (rc != 0) {
+    free (hash);
+    free (sign);
+    return -1;
+  }
+
+  for (i = 0; i < n_cols; i++) {
+    vector<int> & bucket = buckets[hash[i]];
+    int r = -1;
+    for (size_t b = 0; b < bucket.size(); b++) {
+      if (same_column(trace, first + bucket[b], sign[bucket[b]], first + i, sign[i], n_traces)) {
+        r = bucket[b];
+        break;
+      }
+    }
+    if (r == -1) {
+      bucket.push_back(i);
+      continue;
+    }
+    groups->rep[first + i] = first + r;
+    groups->sign[first + i] = sign[i] * sign[r];
+    groups->members[sample_index(conf, offset + r)].push_back(groups->sign[first + i] * sample_index(conf, offset + i));
+    groups->n_skipped++;
+  }
+
+  free (hash);
+  free (sign);
+  return 0;
+}
+
+void print_sample_groups(SampleGroups * groups, vector<int> & times)
+{
+  bool header = false;
+
+  sort(times.begin(), times.end());
+  times.erase(unique(times.begin(), times.end()), times.end());
+
+  for (size_t i = 0; i < times.size(); i++) {
+    map<int, vector<int> >::iterator it = groups->members.find(times[i]);
+    if (it == groups->members.end())
+      continue;
+    if (!header) {
+      cout << "[INFO]\tSamples also standing for identical (or complemented, -) samples:" << endl;
+      header = true;
+    }
+    cout << setw(8) << it->first << ":";
+    for (size_t j = 0; j < it->second.size(); j++)
+      cout << " " << it->second[j];
+    cout << endl;
+  }
+  if (header)
+    cout << endl;
+}
+
+/* Adds the value v to the two independent hashes of a trace.
+ */
+static inline void mix_value(uint64_t * h1, uint64_t * h2, double v)
+{
+  uint64_t bits = value_bits(v);
+
+  *h1 = (*h1 ^ bits) * FNV_PRIME;
+  *h2 = (*h2 + bits + MIX_OFFSET) * MIX_PRIME;
+  *h2 ^= *h2 >> 29;
+}
+
+  template <class Type>
+static void * hash_traces(void * args_in)
+{
+  HashTraces<Type> * H = (HashTraces<Type> *) args_in;
+
+  for (int k = 0; k < H->n_load; k++) {
+    const Type * row = H->traces[k];
+    for (int j = H->start; j < H->end; j++)
+      mix_value(&H->h1[j], &H->h2[j], sample_value(row, j));
+  }
+  return NULL;
+}
+
+/* The traces are read chunk by chunk of samples, as by the attacks, every
+ * chunk updating the hashes of all the traces in parallel.
+ */
+  template <class TypeTrace>
+int dedup_traces(Config & conf)
+{
+  int res, n, n_threads, workload,
+      n_traces = conf.n_traces,
+      n_samples = conf.n_samples,
+      ncol = min(get_ncol<TypeTrace>(conf.memory, conf.n_traces), n_samples);
+  uint32_t n_rows, n_columns = conf.guesses[0].n_columns;
+  uint8_t ** messages = NULL;
+  TypeTrace ** traces = NULL;
+  vector<int> selected, kept;
+  vector<uint64_t> h1(n_traces, FNV_OFFSET), h2(n_traces, MIX_OFFSET);
+  unordered_map<uint64_t, vector<pair<uint64_t, int> > > buckets;
+
+  if (ncol <= 0) {
+    fprintf(stderr, "[ERROR] Invalid parameters ncol(=%i).\n", ncol);
+    return -1;
+  }
+  if (conf.trace_index.empty()) {
+    for (int j = 0; j < n_traces; j++)
+      selected.push_back(j);
+  } else {
+    selected = conf.trace_index;
+  }
+
+  if (import_messages(&messages, &n_rows, conf.guesses, conf.n_file_guess) < 0) {
+    fprintf(stderr, "[ERROR] Importing the messages.\n");
+    return -1;
+  }
+  for (int j = 0; j < n_traces; j++) {
+    for (uint32_t c = 0; c < n_columns; c++)
+      mix_value(&h1[j], &h2[j], messages[selected[j]][c]);
+  }
+
+  TraceLoader<TypeTrace> loader(conf, ncol);
+  res = loader.init();
+  if (res != 0) {
+    fprintf(stderr, "[ERROR] Initializing the trace loader in dedup.\n");
+    return -1;
+  }
+  res = allocate_matrix(&traces, ncol, row_length<TypeTrace>(n_traces), MEM_TRACES);
+  if (res != 0) {
+    fprintf(stderr, "[ERROR] Allocating memory in dedup.\n");
+    return -1;
+  }
+
+  for (int s = 0; s < n_samples; s += ncol) {
+    int to_load = min(ncol, n_samples - s);
+    res = loader.load(traces, 0, s, to_load);
+    if (res != 0) {
+      fprintf(stderr, "[ERROR] Loading file.\n");
+      free_matrix(&traces, ncol);
+      return -1;
+    }
+
+    n_threads = max(1, min(conf.n_threads, n_traces));
+    workload = n_traces / n_threads;
+    vector<HashTraces<TypeTrace> > ta;
+    ta.reserve(n_threads);
+    for (n = 0; n < n_threads; n++) {
+      ta.push_back(HashTraces<TypeTrace>(traces, to_load, n*workload, n == n_threads - 1 ? n_traces : (n + 1)*workload, &h1[0], &h2[0]));
+    }
+    res = workers_run(hash_traces<TypeTrace>, ta);
+    if (res != 0) {
+      free_matrix(&traces, ncol);
+      return -1;
+    }
+  }
+  free_matrix(&traces, ncol);
+
+  /* The first trace of every group stands for the others.
+   */
+  conf.trace_weight.assign(conf.total_n_traces, 1);
+  for (int j = 0; j < n_traces; j++) {
+    vector<pair<uint64_t, int> > & bucket = buckets[h1[j]];
+    size_t b;
+    for (b = 0; b < bucket.size() && bucket[b].first != h2[j]; b++);
+    if (b < bucket.size()) {
+      conf.trace_weight[bucket[b].second]++;
+      continue;
+    }
+    bucket.push_back(make_pair(h2[j], selected[j]));
+    kept.push_back(selected[j]);
+  }
+
+  printf("[DEDUP] %i traces merged into identical ones, %lu weighted traces left.\n\n", n_traces - (int) kept.size(), kept.size());
+  if ((int) kept.size() == n_traces) {
+    conf.trace_weight.clear();
+    return 0;
+  }
+  if (kept.size() < 2) {
+    fprintf(stderr, "[ERROR] Not enough distinct traces left.\n");
+    return -1;
+  }
+  conf.trace_index = kept;
+  conf.n_traces = kept.size();
+  return 0;
+}
+
+int selected_weights(const Config & conf, vector<int> & weight)
+{
+  int total = 0;
+
+  weight.clear();
+  if (conf.trace_weight.empty())
+    return conf.n_traces;
+  for (int j = 0; j < conf.n_traces; j++) {
+    weight.push_back(conf.trace_weight[conf.trace_index.empty() ? j : conf.trace_index[j]]);
+    total += weight.back();
+  }
+  return total;
+}
+
+template int p_group_samples(float ** trace, int first, int n_cols, int n_traces, int n_threads, SampleGroups * groups, const Config & conf, int offset);
+template int p_group_samples(double ** trace, int first, int n_cols, int n_traces, int n_threads, SampleGroups * groups, const Config & conf, int offset);
+template int p_group_samples(int8_t ** trace, int first, int n_cols, int n_traces, int n_threads, SampleGroups * groups, const Config & conf, int offset);
+template int p_group_samples(int16_t ** trace, int first, int n_cols, int n_traces, int n_threads, SampleGroups * groups, const Config & conf, int offset);
+template int p_group_samples(BitWord ** trace, int first, int n_cols, int n_traces, int n_threads, SampleGroups * groups, const Config & conf, int offset);
+
+template int dedup_traces<float>(Config & conf);
+template int dedup_traces<double>(Config & conf);
+template int dedup_traces<int8_t>(Config & conf);
+template int dedup_traces<BitWord>(Config & conf);
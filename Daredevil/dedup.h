@@ -0,0 +1,100 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include "utils.h"
+
+/* Groups of time samples of a chunk that are identical (up to a constant
+ * offset) or complemented over all the traces. Such samples have the same
+ * correlation, up to the sign, so only the representative of each group is
+ * correlated.
+ */
+struct SampleGroups {
+
+  /* rep[i] is the index in the chunk of the representative of the sample i,
+   * sign[i] is -1 if the sample i is the complement of its representative.
+   */
+  int * rep;
+  int8_t * sign;
+  int n_columns;
+
+  /* Absolute index of a representative -> absolute indices of the members of
+   * its group (the representative excluded), negative when complemented.
+   */
+  map<int, vector<int> > members;
+
+  /* Number of samples skipped so far, used for reporting.
+   */
+  long int n_skipped;
+
+  SampleGroups(int n_cols);
+  ~SampleGroups();
+
+  /* Marks every column of the chunk as its own representative.
+   */
+  void reset(int first, int n_cols);
+
+  /* Returns true if the column i of the chunk has to be correlated.
+   */
+  bool is_rep(int i) const {
+    return rep[i] == i;
+  }
+
+  /* Returns true if the pair (i, j) of the chunk has the same product, up to
+   * the sign, as a pair which is correlated anyway for the given window.
+   */
+  bool is_redundant_pair(int i, int j, int window) const {
+    int a = min(rep[i], rep[j]), b = max(rep[i], rep[j]);
+    return (a != i || b != j) && (b - a < window);
+  }
+};
+
+/* Hashes the n_cols columns of trace starting at first and groups the ones
+ * which are identical or complemented. offset is the logical index of the
+ * column first, used to record the members of the groups.
+ */
+template <class Type>
+int p_group_samples(Type ** trace, int first, int n_cols, int n_traces, int n_threads, SampleGroups * groups, const Config & conf, int offset);
+
+/* Prints the groups of the samples in times which have at least one member.
+ */
+void print_sample_groups(SampleGroups * groups, vector<int> & times);
+
+/* Merges the selected traces which are identical to a previous one, for the
+ * same message, into it: the attacked samples (as loaded, after pooling and
+ * alignment) and the message of every trace are hashed on 128 bits, the
+ * first trace of every group is kept in conf.trace_index and its multiplicity
+ * recorded in conf.trace_weight, which the engines use as weights.
+ */
+template <class TypeTrace>
+int dedup_traces(Config & conf);
+
+/* Sets weight to the multiplicity of every selected trace, in the order of
+ * the selection, and returns the number of traces they stand for. weight is
+ * left empty if every trace counts once.
+ */
+int selected_weights(const Config & conf, vector<int> & weight);
+
+#endif
@@ -22,6 +22,8 @@
 #include "utils.h"
 #include "des.h"
 #include "aes.h"
+#include "guess.h"
+#include "workers.h"
 
 /* The following was largely inspired from
  * - Andrey Panin's implementation for Dovecot under the
@@ -300,51 +302,41 @@ int get_round_key(uint8_t * key, uint8_t * dst, uint8_t round)
   return 0;
 }
 
-template <class TypeGuess> int construct_guess_DES (TypeGuess ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint32_t pos, uint16_t * sbox, uint32_t n_keys, int8_t bit)
-{
-
-  TypeGuess **mem = NULL;
-  uint32_t i, nrows = 0;
-  uint8_t j;
-
-  if (R != 0) {
-    fprintf (stderr, "[ERROR]: construct_guess_DES: Currently only round 0 is supported.\n");
-    return -1;
-  }
-
-  for (i=0; i < n_m; i++) {
-    if (m[i].n_columns <= bytenum) {
-      fprintf (stderr, "[ERROR]: construct_guess_DES: ncolumns (%d) <= bytenum (%d).\n", m[i].n_columns, bytenum);
-      return -1;
-    }
-    nrows += m[i].n_rows;
-  }
-
-  if (import_matrices(&mem, m, n_m, 0) < 0) {
-    fprintf (stderr, "[ERROR]: import matrix.\n");
-    return -1;
-  }
-
-  if (*guess == NULL) {
-    if (allocate_matrix<TypeGuess> (guess, n_keys, nrows) < 0) {
-      fprintf (stderr, "[ERROR]: memory problem.\n");
-      free_matrix (&mem, nrows);
-      return -1;
-    }
+/* Structure used by the threads computing, for a block of messages, what
+ * the guesses depend on: the 6 bits entering the attacked sbox, completed for
+ * DES_8_64_ROUND by the 4 bits xored with its output.
+ */
+template <class TypeGuess>
+struct SboxInputs {
+
+  TypeGuess ** mem;
+  uint16_t * x;
+  uint32_t bytenum;
+  uint32_t pos;
+  uint32_t start;
+  uint32_t length;
+
+  SboxInputs(TypeGuess ** m, uint16_t * xx, uint32_t bn, uint32_t p, uint32_t st, uint32_t len):
+    mem(m), x(xx), bytenum(bn), pos(p), start(st), length(len) {
   }
+};
 
-
+  template <class TypeGuess>
+static void * sbox_inputs(void * args_in)
+{
+  SboxInputs<TypeGuess> * S = (SboxInputs<TypeGuess> *) args_in;
+  uint32_t i, bytenum = S->bytenum;
   uint8_t D[8]; /* The data block, as we manipulate it. */
 
-  for (i = 0; i < nrows; i++) {
+  for (i = S->start; i < S->start + S->length; i++) {
 
     /* Initial permutation of the data block */
-    permute(D, mem[i], InitialPermutation, 8);
+    permute(D, (uint8_t *) S->mem[i], InitialPermutation, 8);
 
     uint8_t LP_1[4];    /* Left half pushed across P */
 
     /* Push the left half of the data across P */
-    if (pos == DES_8_64_ROUND) {
+    if (S->pos == DES_8_64_ROUND) {
         permuteinv(LP_1, D, P, 4);
     }
 
@@ -365,56 +357,85 @@ template <class TypeGuess> int construct_guess_DES (TypeGuess ***guess, Matrix *
       Snum |= GETBIT(Rexp, bitnum);
     }
 
-    for (j=0; j < n_keys; j++) {
-
-      /* We attack 6 bits of the key. Data is 6*8 bits. We thus need to get
-       * the correct 6 bits according to bytenum.
-       */
-      switch (pos) {
-        case DES_8_64:
-          if (bit == -1) {
-            (*guess)[j][i] = HW (sbox[(uint8_t) bytenum*64 + (Snum ^ j)]);
-          } else if (bit >= 0) {
-            (*guess)[j][i] = (((sbox[(uint8_t) bytenum*64 + (Snum ^ j)])>>bit)&1);
-          }
-          break;
-        case DES_8_64_ROUND:
-          if (bit == -1) {
-            (*guess)[j][i] = HW (sbox[(uint8_t) bytenum*64 + (Snum ^ j)] ^ ((LP_1[bytenum >> 1]>>((1-(bytenum & 1))*4))&0xf));
-          } else if (bit >= 0) {
-            (*guess)[j][i] = (((sbox[(uint8_t) bytenum*64 + (Snum ^ j)] ^ ((LP_1[bytenum >> 1]>>((1-(bytenum & 1))*4))&0xf))>>bit)&1);
-          }
-          break;
-        case DES_32_16:
-          if (bit == -1) {
-            (*guess)[j][i] = HW(sbox[(bytenum*4+get_offset(Snum^j))*16 + get_4_middle_bits(Snum ^ j)]);
-          } else if (bit >= 0) {
-            (*guess)[j][i] = (((sbox[(bytenum*4+get_offset(Snum^j))*16 + get_4_middle_bits(Snum ^ j)])>>bit)&1);
-          }
-          break;
-        case DES_4_BITS:
-          if (bit == -1) {
-            (*guess)[j][i] = HW(get_4_middle_bits(Snum) ^ j);
-          } else if (bit >= 0) {
-            (*guess)[j][i] = (((get_4_middle_bits(Snum) ^ j)>>bit)&1);
-          }
-          break;
-        case DES_6_BITS:
-          if (bit == -1) {
-            (*guess)[j][i] = HW(Snum ^ j);
-          } else if (bit >= 0) {
-            (*guess)[j][i] = (((Snum ^ j)>>bit)&1);
-          }
-          break;
-        default:
-          fprintf (stderr, "Error: construct_guess_DES: position %d is not supported.\n", pos);
-          free_matrix (&mem, nrows);
-          return -1;
-      }
+    if (S->pos == DES_8_64_ROUND)
+      S->x[i] = (((LP_1[bytenum >> 1]>>((1-(bytenum & 1))*4))&0xf) << 6) | Snum;
+    else if (S->pos == DES_4_BITS)
+      S->x[i] = get_4_middle_bits(Snum);
+    else
+      S->x[i] = Snum;
+  }
+  return NULL;
+}
+
+template <class TypeGuess> int construct_guess_DES (TypeGuess ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint32_t pos, uint16_t * sbox, uint32_t n_keys, int8_t bit, GuessModel<TypeGuess> * model)
+{
+
+  TypeGuess **mem = NULL;
+  uint32_t i, nrows = 0;
+
+  if (R != 0) {
+    fprintf (stderr, "[ERROR]: construct_guess_DES: Currently only round 0 is supported.\n");
+    return -1;
+  }
+
+  if (pos > DES_6_BITS) {
+    fprintf (stderr, "Error: construct_guess_DES: position %d is not supported.\n", pos);
+    return -1;
+  }
+
+  for (i=0; i < n_m; i++) {
+    if (m[i].n_columns <= bytenum) {
+      fprintf (stderr, "[ERROR]: construct_guess_DES: ncolumns (%d) <= bytenum (%d).\n", m[i].n_columns, bytenum);
+      return -1;
     }
+    nrows += m[i].n_rows;
   }
-  free_matrix (&mem, nrows);
-  return 0;
+
+  if (import_messages(&mem, &nrows, m, n_m) < 0) {
+    fprintf (stderr, "[ERROR]: import matrix.\n");
+    return -1;
+  }
+
+  /* We attack 6 bits of the key. Data is 6*8 bits. We thus need to get
+   * the correct 6 bits according to bytenum. The guess only depends on these
+   * bits xored with the key (and the 4 bits above them for DES_8_64_ROUND),
+   * so it is read from a table.
+   */
+  TypeGuess lut[1024] = {0};
+  for (i = 0; i < 1024; i++) {
+    uint16_t v;
+    switch (pos) {
+      case DES_8_64:
+        if (i >= 64) continue;
+        v = sbox[(uint8_t) bytenum*64 + i];
+        break;
+      case DES_8_64_ROUND:
+        v = sbox[(uint8_t) bytenum*64 + (i & 0x3f)] ^ (i >> 6);
+        break;
+      case DES_32_16:
+        if (i >= 64) continue;
+        v = sbox[(bytenum*4+get_offset(i))*16 + get_4_middle_bits(i)];
+        break;
+      default:
+        v = i;
+        break;
+    }
+    if (bit == -1) {
+      lut[i] = HW (v);
+    } else if (bit >= 0) {
+      lut[i] = ((v>>bit)&1);
+    }
+  }
+
+  vector<uint16_t> x(nrows);
+  vector<SboxInputs<TypeGuess> > ta;
+  for (i = 0; i < nrows; i += GUESS_BLOCK)
+    ta.push_back(SboxInputs<TypeGuess>(mem, &x[0], bytenum, pos, i, min((uint32_t) GUESS_BLOCK, nrows - i)));
+  if (!ta.empty() && workers_run(sbox_inputs<TypeGuess>, ta) != 0)
+    return -1;
+  if (model != NULL)
+    return fill_guess_model(model, &x[0], lut, 1024, n_keys, nrows);
+  return fill_guess(guess, &x[0], lut, n_keys, nrows);
 }
 
-template int construct_guess_DES (uint8_t ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint32_t pos, uint16_t * sbox, uint32_t n_keys, int8_t bit);
+template int construct_guess_DES (uint8_t ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint32_t pos, uint16_t * sbox, uint32_t n_keys, int8_t bit, GuessModel<uint8_t> * model);
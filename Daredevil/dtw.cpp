@@ -0,0 +1,368 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include <omp.h>
+#include "dtw.h"
+#include "loader.h"
+#include "workers.h"
+#include "stats.h"
+
+#define DTW_MAGIC 0x32575444
+#define DTW_HEADER 8
+
+/* Number of traces averaged into the reference.
+ */
+#define DTW_REF_TRACES 256
+
+/* Structure used by the threads warping a slice of the traces of a batch.
+ * The paths are given as the offset of the sample matched with each sample of
+ * the reference, and are computed only if compute is set.
+ */
+template <class TypeTrace>
+struct DtwTraces {
+
+  TypeTrace ** rows;
+  int16_t ** offset;
+  const char * selected;
+  const float * ref;
+  int length;
+  int band;
+  float penalty;
+  int first;
+  int start;
+  int end;
+  bool compute;
+
+  DtwTraces(TypeTrace ** r, int16_t ** o, const char * s, const float * rf, int len, int b, float p, int f, int st, int e, bool c):
+    rows(r), offset(o), selected(s), ref(rf), length(len), band(b), penalty(p), first(f), start(st), end(e), compute(c) {
+  }
+};
+
+/* Normalizes n values of x to zero mean and unit variance.
+ */
+  template <class Type>
+static void normalize(const Type * x, float * out, int n)
+{
+  double s = 0, sq = 0, mean, dev;
+
+  for (int i = 0; i < n; i++) {
+    s += x[i];
+    sq += (double) x[i] * x[i];
+  }
+  mean = s / n;
+  dev = sqrt(max(sq / n - mean * mean, 1e-30));
+  for (int i = 0; i < n; i++)
+    out[i] = (x[i] - mean) / dev;
+}
+
+/* Warping path of x (normalized, length + 2 * band samples) on ref. The cell
+ * k of the row i of the band matches ref[i] with x[i + k]. As every row only
+ * depends on the previous one, the loops run along the band and are
+ * vectorized.
+ */
+static void warp_path(const float * x, const float * ref, int length, int band, float step_penalty, float * prev, float * cur, int8_t * choice, int16_t * offset)
+{
+  int i, k, width = 2 * band + 1;
+  float a, b, c, m, d, penalty;
+
+  /* A step repeating or skipping a sample costs step_penalty times the mean
+   * distance of the samples at the best constant shift. A change of shift
+   * is then only taken if it brings the trace closer to the reference over
+   * about step_penalty samples, which a genuine change of timing does, while
+   * following the noise of a few samples does not.
+   */
+  for (k = 0; k < width; k++) {
+    cur[k] = 0;
+    for (i = 0; i < length; i++) {
+      d = ref[i] - x[i + k];
+      cur[k] += d * d;
+    }
+  }
+  penalty = *min_element(cur, cur + width) / length * step_penalty;
+
+  /* prev and cur are padded with one cell on each side.
+   */
+  prev[0] = prev[width + 1] = cur[0] = cur[width + 1] = FLT_MAX;
+  for (k = 0; k < width; k++) {
+    d = ref[0] - x[k];
+    prev[k + 1] = d * d;
+  }
+
+  for (i = 1; i < length; i++) {
+    int8_t * ch = choice + (size_t) i * width;
+    for (k = 0; k < width; k++) {
+      a = prev[k + 2] + penalty;
+      b = prev[k + 1];
+      c = prev[k] + penalty;
+      m = min(b, min(a, c));
+      ch[k] = m == b ? 0 : (m == a ? 1 : -1);
+      d = ref[i] - x[i + k];
+      cur[k + 1] = m + d * d;
+    }
+    swap(prev, cur);
+  }
+
+  k = 0;
+  for (int l = 1; l < width; l++) {
+    if (prev[l + 1] < prev[k + 1])
+      k = l;
+  }
+  for (i = length - 1; i >= 0; i--) {
+    offset[i] = k - band;
+    if (i > 0)
+      k += choice[(size_t) i * width + k];
+  }
+}
+
+  template <class TypeTrace>
+static void * dtw_slice(void * args_in)
+{
+  DtwTraces<TypeTrace> * D = (DtwTraces<TypeTrace> *) args_in;
+  int width = 2 * D->band + 1,
+      n_x = D->length + 2 * D->band;
+  vector<float> x(n_x), prev(width + 2), cur(width + 2);
+  vector<int8_t> choice;
+  vector<TypeTrace> warped(D->length);
+
+  if (D->compute)
+    choice.resize((size_t) D->length * width);
+
+  for (int j = D->start; j < D->end; j++) {
+    TypeTrace * row = D->rows[j] + D->first - D->band;
+    if (D->compute) {
+      if (D->selected[j]) {
+        normalize(row, &x[0], n_x);
+        warp_path(&x[0], D->ref, D->length, D->band, D->penalty, &prev[0], &cur[0], &choice[0], D->offset[j]);
+      } else {
+        memset(D->offset[j], 0, D->length * sizeof(int16_t));
+      }
+    }
+    for (int i = 0; i < D->length; i++)
+      warped[i] = row[D->band + i + D->offset[j][i]];
+    memcpy(D->rows[j] + D->first, &warped[0], D->length * sizeof(TypeTrace));
+  }
+  return NULL;
+}
+
+/* Replaces ref by the mean of the first n_ref selected traces warped onto
+ * it, normalized. The rows hold at least n_ref traces.
+ */
+  template <class TypeTrace>
+static int mean_reference(Config & conf, TypeTrace ** rows, int n_ref, int length, int band, int first, float * ref)
+{
+  int f, r, n, n_threads, workload, width = conf.total_n_samples;
+  vector<int16_t> offset_buf((size_t) n_ref * length);
+  vector<int16_t *> offset(n_ref);
+  vector<char> sel(n_ref, true);
+  vector<double> mean(length, 0);
+
+  for (int j = 0; j < n_ref; j++) {
+    TypeTrace ** row = rows + j;
+    offset[j] = &offset_buf[(size_t) j * length];
+    locate_trace(conf, conf.trace_index.empty() ? j : conf.trace_index[j], &f, &r);
+    if (fload(conf.traces[f].filename, &row, 1, r, width, 0, width) != (size_t) width) {
+      fprintf(stderr, "[ERROR] Loading the reference traces.\n");
+      return -1;
+    }
+  }
+
+  n_threads = max(1, min(conf.n_threads, n_ref));
+  workload = n_ref / n_threads;
+  vector<DtwTraces<TypeTrace> > ta;
+  ta.reserve(n_threads);
+  for (n = 0; n < n_threads; n++) {
+    ta.push_back(DtwTraces<TypeTrace>(rows, &offset[0], &sel[0], ref, length, band, conf.dtw_penalty, first, n*workload, n == n_threads - 1 ? n_ref : (n + 1)*workload, true));
+  }
+  if (workers_run(dtw_slice<TypeTrace>, ta) != 0)
+    return -1;
+
+  for (int j = 0; j < n_ref; j++) {
+    for (int i = 0; i < length; i++)
+      mean[i] += rows[j][first + i];
+  }
+  normalize(&mean[0], ref, length);
+  return 0;
+}
+
+/* Opens the cache of the paths: returns the file positioned on the paths and
+ * sets compute to false if it matches header, otherwise creates it.
+ */
+static FILE * open_cache(Config & conf, const uint64_t header[DTW_HEADER], bool * compute)
+{
+  uint64_t h[DTW_HEADER];
+  FILE * f;
+
+  *compute = true;
+  if (conf.dtw_cache == "")
+    return NULL;
+  f = fopen(conf.dtw_cache.c_str(), "rb");
+  if (f != NULL) {
+    if (fread(h, sizeof(uint64_t), DTW_HEADER, f) == DTW_HEADER && memcmp(h, header, sizeof(h)) == 0) {
+      *compute = false;
+      printf("[DTW] Reusing the paths cached in %s.\n", conf.dtw_cache.c_str());
+      return f;
+    }
+    fclose(f);
+  }
+  f = fopen(conf.dtw_cache.c_str(), "wb");
+  if (f == NULL || fwrite(header, sizeof(uint64_t), DTW_HEADER, f) != DTW_HEADER) {
+    fprintf(stderr, "[WARNING] Cannot write the cache %s.\n", conf.dtw_cache.c_str());
+    if (f != NULL)
+      fclose(f);
+    return NULL;
+  }
+  return f;
+}
+
+  template <class TypeTrace>
+int dtw_traces(Config & conf)
+{
+  int res, f, r, n, n_threads, workload, batch,
+      band = conf.dtw_band,
+      width = conf.total_n_samples,
+      first = sample_index(conf, 0),
+      length = sample_index(conf, conf.n_samples - 1) + conf.pool_window - first,
+      ref_trace = conf.trace_index.empty() ? 0 : conf.trace_index[0],
+      row_offset = 0;
+  TypeTrace ** rows = NULL;
+  vector<float> ref(length);
+  FILE * out, * cache;
+  bool compute;
+  double start, end;
+
+  if (first - band < 0 || first + length + band > width) {
+    fprintf(stderr, "[ERROR] The attacked samples must be at least %i samples inside the traces to be warped.\n", band);
+    return -1;
+  }
+  for (int i = 0; i < conf.n_file_trace; i++) {
+    if ((int) conf.traces[i].n_columns != width) {
+      fprintf(stderr, "[ERROR] The trace files must have the same number of samples.\n");
+      return -1;
+    }
+  }
+
+  batch = max(1, min(1024, (int) (0.6 * conf.memory / ((double) width * sizeof(TypeTrace)))));
+  vector<int16_t> offset_buf((size_t) batch * length);
+  vector<int16_t *> offset(batch);
+  for (int j = 0; j < batch; j++)
+    offset[j] = &offset_buf[(size_t) j * length];
+  res = allocate_matrix(&rows, batch, width);
+  if (res != 0) {
+    fprintf(stderr, "[ERROR] Allocating memory for the warping.\n");
+    return -1;
+  }
+
+  vector<char> sel(conf.total_n_traces, conf.trace_index.empty());
+  if (conf.trace_index.empty())
+    fill(sel.begin() + conf.n_traces, sel.end(), false);
+  for (size_t j = 0; j < conf.trace_index.size(); j++)
+    sel[conf.trace_index[j]] = true;
+
+  /* The reference is the first selected trace, normalized, loaded before the
+   * batches as it may be in any of them. It is then replaced by the mean of
+   * the first selected traces warped onto it, which has much less noise for
+   * the paths to follow.
+   */
+  locate_trace(conf, ref_trace, &f, &r);
+  if (fload(conf.traces[f].filename, &rows, 1, r, length, first, width) != (size_t) length) {
+    fprintf(stderr, "[ERROR] Loading the reference trace.\n");
+    free_matrix(&rows, batch);
+    return -1;
+  }
+  normalize(rows[0], &ref[0], length);
+  if (mean_reference(conf, rows, min(batch, min(conf.n_traces, DTW_REF_TRACES)), length, band, first, &ref[0]) != 0) {
+    free_matrix(&rows, batch);
+    return -1;
+  }
+
+  /* The paths are only reused for the same trace files, selection and
+   * parameters.
+   */
+  uint64_t header[DTW_HEADER] = {DTW_MAGIC, (uint64_t) conf.total_n_traces, (uint64_t) length, (uint64_t) band, (uint64_t) first, (uint64_t) ref_trace, traces_key(conf), 0};
+  memcpy(&header[7], &conf.dtw_penalty, sizeof(conf.dtw_penalty));
+  cache = open_cache(conf, header, &compute);
+
+  out = fopen(conf.dtw_output.c_str(), "wb");
+  if (out == NULL) {
+    fprintf(stderr, "[ERROR] Opening %s.\n", conf.dtw_output.c_str());
+    return -1;
+  }
+
+  start = omp_get_wtime();
+  for (f = 0; f < conf.n_file_trace; f++) {
+    for (int b = 0; b < (int) conf.traces[f].n_rows; b += batch) {
+      int n_rows = min(batch, (int) conf.traces[f].n_rows - b);
+      if (fload(conf.traces[f].filename, &rows, n_rows, b, width, 0, width) != (size_t) n_rows * width) {
+        fprintf(stderr, "[ERROR] Loading the traces to warp.\n");
+        return -1;
+      }
+
+      if (!compute) {
+        for (int j = 0; j < n_rows; j++) {
+          if (fread(offset[j], sizeof(int16_t), length, cache) != (size_t) length) {
+            fprintf(stderr, "[ERROR] Reading the cache %s.\n", conf.dtw_cache.c_str());
+            return -1;
+          }
+        }
+      }
+
+      n_threads = max(1, min(conf.n_threads, n_rows));
+      workload = n_rows / n_threads;
+      vector<DtwTraces<TypeTrace> > ta;
+      ta.reserve(n_threads);
+      for (n = 0; n < n_threads; n++) {
+        ta.push_back(DtwTraces<TypeTrace>(rows, &offset[0], &sel[row_offset + b], &ref[0], length, band, conf.dtw_penalty, first, n*workload, n == n_threads - 1 ? n_rows : (n + 1)*workload, compute));
+      }
+      res = workers_run(dtw_slice<TypeTrace>, ta);
+      if (res != 0)
+        return -1;
+
+      for (int j = 0; j < n_rows; j++) {
+        if (fwrite(rows[j], sizeof(TypeTrace), width, out) != (size_t) width) {
+          fprintf(stderr, "[ERROR] Writing %s.\n", conf.dtw_output.c_str());
+          return -1;
+        }
+        if (compute && cache != NULL)
+          fwrite(offset[j], sizeof(int16_t), length, cache);
+      }
+    }
+    row_offset += conf.traces[f].n_rows;
+  }
+  end = omp_get_wtime();
+  fclose(out);
+  if (cache != NULL)
+    fclose(cache);
+  free_matrix(&rows, batch);
+
+  /* The warped traces replace the trace files.
+   */
+  conf.traces = (Matrix *) realloc(conf.traces, sizeof(Matrix));
+  conf.traces[0] = Matrix(conf.dtw_output.c_str(), conf.total_n_traces, width);
+  conf.n_file_trace = 1;
+  printf("[DTW] %i traces warped over %i samples in %lf seconds, written to %s.\n\n", conf.n_traces, length, end - start, conf.dtw_output.c_str());
+  return 0;
+}
+
+template int dtw_traces<float>(Config & conf);
+template int dtw_traces<double>(Config & conf);
+template int dtw_traces<int8_t>(Config & conf);
@@ -0,0 +1,40 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#ifndef DTW_H
+#define DTW_H
+
+#include "utils.h"
+
+/* Elastic alignment of the traces. Over the samples attacked, every selected
+ * trace is warped by a dynamic time warping restricted to a band of
+ * +-dtw_band samples onto a reference, the mean of the first selected traces
+ * warped onto the first one. Each sample of the reference is matched with one
+ * sample of the trace, moving by 0, 1 or 2 samples at a time, the steps of 0
+ * or 2 samples costing dtw_penalty times the distance of the trace to the
+ * reference at its best constant shift. The warped traces are written to
+ * dtw_output, which then replaces the trace files. The warping paths can be
+ * cached in dtw_cache and are reused as long as the trace files (see
+ * traces_key), the selection and the parameters match.
+ */
+template <class TypeTrace>
+int dtw_traces(Config & conf);
+
+#endif
@@ -30,73 +30,370 @@
 #include "string.h"
 #include "focpa.h"
 #include "socpa.h"
+#include "dedup.h"
+#include "loader.h"
+#include "stats.h"
+#include "affinity.h"
+#include "workers.h"
 
 extern pthread_mutex_t pt_lock;
 
-/* Implements first order CPA in a faster and multithreaded way on big files,
- * using the vertical partitioning approach.
+template <class Type>
+void print_groups(SampleGroups * groups, Type top_r[], int n_keys);
+
+/* A key byte attacked together with the others in a single pass over the
+ * traces: its guesses, their sums and its best correlations.
  */
-  template <class TypeTrace, class TypeReturn, class TypeGuess>
-int first_order(Config & conf)
+template <typename TypeReturn, typename TypeGuess>
+struct ByteTarget {
+
+  int bn;
+  TypeGuess ** guess;
+  GuessModel<TypeGuess> model;
+  TypeReturn ** precomp_k;
+  PriorityQueue<CorrFirstOrder<TypeReturn> > * pqueue;
+  CorrFirstOrder<TypeReturn> * top_corr;
+};
+
+/* Sets row to the sample x of every trace times its weight.
+ */
+  template <class TypeTrace, class TypeReturn>
+static inline void weigh_sample(const TypeTrace * x, const int * weight, int n_traces, TypeReturn * row)
+{
+  for (int j = 0; j < n_traces; j++)
+    row[j] = (TypeReturn) weight[j] * sample_value(x, j);
+}
+
+/* Sets row to the bits of the packed sample x, one by trace.
+ */
+  template <class TypeTrace>
+static inline void unpack_sample(const TypeTrace * x, int n_traces, int8_t * row)
 {
+  for (int j = 0; j < n_traces; j++)
+    row[j] = (int8_t) sample_value(x, j);
+}
 
-  long int memory = conf.memory;
+/* Sum and sum of squares of the sample x of the traces, weighted when row
+ * holds its weighted values.
+ */
+  template <class TypeTrace, class TypeReturn>
+static inline void sample_sums(const TypeTrace * x, const TypeReturn * row, int n_traces, TypeReturn & sum, TypeReturn & sum_sq)
+{
+  TypeReturn tmp;
+
+  sum = 0.0;
+  sum_sq = 0.0;
+  if (row != NULL) {
+    for (int j = 0; j < n_traces; j++) {
+      sum += row[j];
+      sum_sq += row[j] * sample_value(x, j);
+    }
+    return;
+  }
+  for (int j = 0; j < n_traces; j++) {
+    tmp = x[j];
+    sum += tmp;
+    sum_sq += tmp*tmp;
+  }
+}
 
-  double start, end;
+/* The bits of a packed sample are their own squares.
+ */
+  template <class TypeReturn>
+static inline void sample_sums(const BitWord * x, const TypeReturn * row, int n_traces, TypeReturn & sum, TypeReturn & sum_sq)
+{
+  sum = 0.0;
+  if (row != NULL) {
+    for (int j = 0; j < n_traces; j++)
+      sum += row[j];
+  } else {
+    sum = count_bits(x, n_traces);
+  }
+  sum_sq = sum;
+}
 
+/* Sets the row bits[k] to the guesses of the key k over n_traces traces, read
+ * from guess or generated from inputs and table (see GuessModel), packed like
+ * the traces of trace_type=b. Returns false if a guess is neither 0 nor
+ * 1, i.e. the model is not a single bit.
+ */
+  template <class TypeGuess>
+static bool pack_guesses(TypeGuess ** guess, const uint16_t * inputs, const TypeGuess * table, int n_keys, int n_traces, BitWord ** bits)
+{
+  TypeGuess g;
+
+  for (int k = 0; k < n_keys; k++) {
+    memset(bits[k], 0, row_length<BitWord>(n_traces) * sizeof(BitWord));
+    for (int j = 0; j < n_traces; j++) {
+      g = guess != NULL ? guess[k][j] : table[inputs[j] * n_keys + k];
+      if (g > 1)
+        return false;
+      bits[k][j / WORD_BITS] |= (BitWord) g << (j % WORD_BITS);
+    }
+  }
+  return true;
+}
+
+/* Sets sum_prod[k] to the number of traces where both the packed sample x
+ * and the bit guessed for the key k are 1, which is their dot product.
+ */
+  template <class TypeReturn>
+static inline void and_products(const BitWord * x, BitWord ** bits, int n_traces, int n_keys, TypeReturn * sum_prod)
+{
+  for (int k = 0; k < n_keys; k++)
+    sum_prod[k] = count_and_bits(x, bits[k], n_traces);
+}
+
+  template <class TypeTrace, class TypeReturn, class TypeGuess>
+static void * correlation_first_order_bytes(void * args_in);
+
+/* Loads the traces ncol samples at a time and runs the correlation fct on
+ * every chunk.
+ */
+  template <class TypeTrace, class TypeReturn, class TypeGuess, class TypeFile>
+static int correlate_chunks(TraceLoader<TypeFile> & loader, FinalConfig<TypeTrace, TypeReturn, TypeGuess> & fin_conf, SampleGroups * groups, void * (*fct)(void *), TypeReturn ** precomp_k, int ncol)
+{
+  Config & conf = *fin_conf.conf;
   int res,
-      n_keys = conf.total_n_keys,
       n_samples = conf.n_samples,
-      nmat = conf.n_file_trace,
-      nrows = conf.total_n_traces,
-      ncol = min(get_ncol<TypeTrace>(memory-(nrows*n_keys*sizeof(TypeGuess)), nrows), n_samples),
       col_incr = ncol,
-      col_offset = 0,
       row_offset = 0,
       sample_offset = 0,
-      cur_n_rows, cur_n_cols,
       samples_loaded = 0,
       to_load = ncol;
 
   uint8_t is_last_iter = 0;
-  unsigned int max_n_rows = 0;
 
+  /* The groups are found again at every pass over the files.
+   */
+  if (groups != NULL) {
+    groups->members.clear();
+    groups->n_skipped = 0;
+  }
+
+  /* We iterate over the all the files, loading ncol columns to memory at a
+   * time.
+   */
+  while (!is_last_iter) {
+
+    /* If the number of samples loaded so far + what we will load in this
+     * iteration is larger than the number of samples, it's the last iter.
+     */
+    if (samples_loaded + to_load >= n_samples){
+      is_last_iter = 1;
+      to_load = n_samples - samples_loaded;
+    }
+
+    /* We load to_load samples at a time, starting at the logical sample
+     * 'sample_offset + row_offset'. This offset depends on the iteration
+     * and the variable to_load depends on whether it is the first
+     * iteration or not (we have to load more in the first iteration)
+     */
+    res = loader.load(fin_conf.mat_args->trace, row_offset, sample_offset + row_offset, to_load);
+    if (res != 0) {
+      fprintf (stderr, "[ERROR] Loading file.\n");
+      return -1;
+    }
+
+    /* Identical or complemented samples are only correlated once.
+     */
+    if (groups != NULL) {
+      res = p_group_samples(fin_conf.mat_args->trace, 0, to_load, conf.n_traces, conf.n_threads, groups, conf, sample_offset);
+      if (res != 0) {
+        fprintf(stderr, "[ERROR] Grouping identical samples.\n");
+        return -1;
+      }
+    }
+
+    samples_loaded += to_load;
+
+    /* We set to_load to col_incr. So that only in the very first iteration
+     * we load ncol.
+     */
+    to_load = col_incr;
+
+    /* Same principle for row_offset
+     */
+    row_offset = 0;
+
+    res = split_work(fin_conf, fct, precomp_k, is_last_iter ? (n_samples - sample_offset) : col_incr, sample_offset);
+    if (res != 0) {
+      fprintf(stderr, "[ERROR] Computing correlations.\n");
+      return -1;
+    }
+    sample_offset += col_incr;
+  }
+  return 0;
+}
+
+/* Prints the best correlations of the key byte bn (and bit) and adds them to
+ * the sums and peaks of its candidates.
+ */
+  template <class TypeReturn>
+static void report_byte(Config & conf, int bn, int bit, int bitsperbyte, int n_keys, PriorityQueue<CorrFirstOrder<TypeReturn> > * pqueue,
+    CorrFirstOrder<TypeReturn> * top_r_by_key, SampleGroups * groups, CorrFirstOrder<TypeReturn> * sum_corels,
+    CorrFirstOrder<TypeReturn> * peak_corels, int & lowest_rank, ostringstream & best_out)
+{
+  /* Warning, when using DES, the correct key doesn't correspond to the actual
+   * good key, as we are predicting the input state based on a round key.
+   */
+  int correct_key = -1;
+  if (conf.key_size == 1 && conf.correct_key != -1) {
+    if (conf.des_switch == DES_4_BITS && conf.correct_key != -1) correct_key = get_4_middle_bits(conf.correct_key);
+    else correct_key = conf.correct_key;
+    pqueue->print(conf.top, correct_key);
+    print_top_r(top_r_by_key, n_keys, correct_key);
+    print_groups(groups, top_r_by_key, n_keys);
+  } else if (conf.complete_correct_key != NULL) {
+    if (conf.des_switch == DES_4_BITS) correct_key = get_4_middle_bits(conf.complete_correct_key[bn]);
+    else correct_key = conf.complete_correct_key[bn];
+
+    if (conf.bitnum == -1) {
+      sort(top_r_by_key, top_r_by_key + n_keys);
+      for (int i = n_keys - 1; i >= 0; i--) {
+        if (top_r_by_key[i] == correct_key) {
+          if (n_keys - i - 1 < lowest_rank) {
+            lowest_rank = n_keys - i - 1;
+            best_out.str(std::string());  /* Clear best_out. */
+            best_out << "Best bit: " << bit << " rank: " << n_keys - i - 1 << "." << setw(-2) << top_r_by_key[i] << endl;
+          }
+        }
+      }
+    } else {
+      print_top_r(top_r_by_key, n_keys, correct_key, conf.sep);
+      if (conf.sep == "")
+        print_groups(groups, top_r_by_key, n_keys);
+    }
+  } else if (conf.sep == "") {
+    print_groups(groups, top_r_by_key, n_keys);
+  }
+
+  int key_guess_used[256] = {0};
+  for (int i = 0; i < n_keys; i++) {
+    if (key_guess_used[top_r_by_key[i].key] == 0) {
+      key_guess_used[top_r_by_key[i].key] = 1;
+      sum_corels[top_r_by_key[i].key].corr += abs(top_r_by_key[i].corr);
+      if (abs(top_r_by_key[i].corr) > peak_corels[top_r_by_key[i].key].corr)
+        peak_corels[top_r_by_key[i].key].corr = abs(top_r_by_key[i].corr);
+    }
+  }
+
+  if ( ((conf.bitnum == -1) && (bit == bitsperbyte-1))      // 'all' case
+      || ((conf.bitnum != -1) && (bit >= 0))    // single bit case
+      || (conf.bitnum == -2))                   // 'none' case
+  {
+    int nbest=10; // TODO: make it a config parameter
+    sort (sum_corels, sum_corels + n_keys);
+    sort (peak_corels, peak_corels + n_keys);
+    cout << "Best " << nbest << " candidates for key byte #" << bn << " according to sum(abs(bit_correlations)):" << endl;
+    for (int i = 1; i <= nbest; i++) {
+      cout << setfill(' ') << setw(2) << i << ": 0x" << setfill('0') << setw(2) << hex << sum_corels[n_keys-i].key;
+      cout << setfill(' ') << dec << "  sum: " << setw(8) << left << sum_corels[n_keys-i].corr << right;
+      if (sum_corels[n_keys-i].key == correct_key)
+        cout << "  <==";
+      cout << endl;
+    }
+    cout << endl;
+    cout << "Best " << nbest << " candidates for key byte #" << bn << " according to highest abs(bit_correlations):" << endl;
+    for (int i = 1; i <= nbest; i++) {
+      cout << setfill(' ') << setw(2) << i << ": 0x" << setfill('0') << setw(2) << hex << peak_corels[n_keys-i].key;
+      cout << setfill(' ') << dec << "  peak: " << setw(8) << left << peak_corels[n_keys-i].corr << right;
+      if (peak_corels[n_keys-i].key == correct_key)
+        cout << "  <==";
+      cout << endl;
+    }
+    cout << endl;
+  }
+}
+
+/* Returns the number of samples of the traces kept in memory along with the
+ * guesses and sums of n_guesses key bytes.
+ */
+  template <class TypeTrace, class TypeReturn, class TypeGuess, class TypeFile>
+static int first_order_ncol(const Config & conf, int n_guesses)
+{
+  MemoryPlan plan;
+  int n_keys = conf.total_n_keys;
+
+  /* The guesses of a single key byte may also be packed like the traces.
+   */
+  if (packed_traces<TypeTrace>() && n_guesses == 1)
+    plan_matrix<TypeTrace>(plan, n_keys, row_length<TypeTrace>(conf.n_traces), false);
+
+  if (!conf.memory_auto)
+    return min(get_ncol<TypeTrace>(conf.memory - n_guesses * guess_bytes<TypeGuess>(conf) - plan.fixed, conf.n_traces), conf.n_samples);
+
+  plan_matrix<TypeTrace>(plan, 0, row_length<TypeTrace>(conf.n_traces), true);
+  plan_loader<TypeFile>(conf, plan);
+  plan.fixed += n_guesses * guess_bytes<TypeGuess>(conf);
+  plan_matrix<TypeReturn>(plan, (long int) n_guesses * n_keys, 2, false);
+  plan_attack<TypeReturn>(conf, plan);
+  return plan_ncol(conf, plan, conf.n_samples, "first order");
+}
+
+/* Implements first order CPA in a faster and multithreaded way on big files,
+ * using the vertical partitioning approach.
+ */
+  template <class TypeTrace, class TypeReturn, class TypeGuess, class TypeFile>
+int first_order(Config & conf)
+{
+
+  double start, end = 0;
+
+  int res,
+      n_keys = conf.total_n_keys,
+      nrows = conf.n_traces,
+      n_targets = 0,
+      ncol;
+
+  /* With joint_bytes, all the targeted key bytes are attacked in a single
+   * pass over the traces, which then need to leave room for all their
+   * guesses. Attacking the bits individually or localizing keeps one pass
+   * per key byte.
+   */
+  for (int bn = 0; bn < conf.key_size; bn++)
+    if (conf.bytenum == -1 || conf.bytenum == bn)
+      n_targets++;
+  bool joint = conf.joint_bytes && conf.bitnum == -2 && n_targets > 1 && conf.sample_score == NULL;
+  ncol = first_order_ncol<TypeTrace, TypeReturn, TypeGuess, TypeFile>(conf, joint ? n_targets : 1);
+  if (joint && ncol <= 0) {
+    fprintf(stderr, "[WARNING] Not enough memory for the guesses of %i key bytes, attacking them one by one.\n", n_targets);
+    joint = false;
+    ncol = first_order_ncol<TypeTrace, TypeReturn, TypeGuess, TypeFile>(conf, 1);
+  }
 
   TypeTrace ** traces = NULL;
-  TypeTrace ** tmp = NULL;
   TypeGuess ** guesses = NULL;
+  BitWord ** guess_bits = NULL;
+  GuessModel<TypeGuess> model;
   TypeReturn ** precomp_k;
 
-  if (col_incr <= 0) {
+  if (ncol <= 0) {
     fprintf(stderr, "[ERROR] Invalid parameters ncol(=%i).\n", ncol);
     return -1;
   }
 
-  /* We determine the size of the file having the largest number of rows, to
-   * allocate memory for tmp.
-   */
-  for (int i = 0; i < nmat; i++){
-    if(conf.traces[i].n_rows > max_n_rows)
-      max_n_rows = conf.traces[i].n_rows;
-  }
-
-  res = allocate_matrix(&tmp, max_n_rows, ncol);
+  TraceLoader<TypeFile> loader(conf, ncol);
+  res = loader.init();
   if (res != 0) {
-    fprintf (stderr, "[ERROR] Allocating matrix in focpa vp.\n");
+    fprintf (stderr, "[ERROR] Initializing the trace loader in focpa vp.\n");
     return -1;
   }
 
-  res = allocate_matrix(&traces, ncol, nrows);
+  res = allocate_matrix(&traces, ncol, row_length<TypeTrace>(nrows), MEM_TRACES);
   if (res != 0) {
     fprintf (stderr, "[ERROR] Allocating matrix in focpa vp.\n");
     return -1;
   }
+  affinity_place(traces, ncol, row_length<TypeTrace>(nrows) * sizeof(TypeTrace), false);
 
-  res = allocate_matrix(&precomp_k, n_keys, 2);
+  res = allocate_matrix(&precomp_k, n_keys, 2, MEM_GUESSES);
   if (res != 0){
     fprintf(stderr, "[ERROR] Memory allocation failed in focpa vp\n");
     return -1;
   }
+  for (int k = 0; k < n_keys; k++)
+    precomp_k[k][0] = precomp_k[k][1] = 0;
 
   /* We initialize the priority queues to store the highest correlations.
    */
@@ -116,6 +413,21 @@ int first_order(Config & conf)
 
 
   MatArgs<TypeTrace, TypeReturn, TypeGuess> mat_args = MatArgs<TypeTrace, TypeReturn, TypeGuess> (traces, guesses, NULL);
+  vector<int> weight;
+  mat_args.n_weight = selected_weights(conf, weight);
+  mat_args.weight = weight.empty() ? NULL : &weight[0];
+
+  /* On packed traces counting once each, the guesses of a single bit model
+   * are packed too, the sums of their products with a sample being counted
+   * 64 traces at a time.
+   */
+  if (packed_traces<TypeTrace>() && mat_args.weight == NULL && !joint) {
+    res = allocate_matrix(&guess_bits, n_keys, row_length<BitWord>(nrows), MEM_GUESSES);
+    if (res != 0) {
+      fprintf(stderr, "[ERROR] Memory allocation failed in focpa vp\n");
+      return -1;
+    }
+  }
 
   FirstOrderQueues<TypeReturn>* queues = new FirstOrderQueues<TypeReturn>(pqueue, top_r_by_key);
   if(queues == NULL){
@@ -123,9 +435,59 @@ int first_order(Config & conf)
     return -1;
   }
 
-  FinalConfig<TypeTrace, TypeReturn, TypeGuess> fin_conf = FinalConfig<TypeTrace, TypeReturn, TypeGuess>(&mat_args, &conf, (void*)queues);
+  SampleGroups * groups = NULL;
+  if (conf.dedup_samples)
+    groups = new SampleGroups(ncol);
+
+  FinalConfig<TypeTrace, TypeReturn, TypeGuess> fin_conf = FinalConfig<TypeTrace, TypeReturn, TypeGuess>(&mat_args, &conf, (void*)queues, (void*)groups);
   pthread_mutex_init(&pt_lock, NULL);
 
+  /* The guesses of all the key bytes are built first, then every chunk of
+   * the traces is correlated with all of them while it is in memory, instead
+   * of loading the traces again for every key byte.
+   */
+  vector<ByteTarget<TypeReturn, TypeGuess> > targets;
+  size_t next_target = 0;
+  if (joint) {
+    start = omp_get_wtime();
+    for (int bn = 0; bn < conf.key_size; bn++) {
+      if (conf.bytenum != -1 && conf.bytenum != bn)
+        continue;
+      ByteTarget<TypeReturn, TypeGuess> t;
+      t.bn = bn;
+      t.guess = NULL;
+      res = allocate_matrix(&t.precomp_k, n_keys, 2, MEM_GUESSES);
+      if (res != 0){
+        fprintf(stderr, "[ERROR] Memory allocation failed in focpa vp\n");
+        return -1;
+      }
+      for (int k = 0; k < n_keys; k++)
+        t.precomp_k[k][0] = t.precomp_k[k][1] = 0;
+      res = prepare_guesses(fin_conf, &t.guess, t.model, bn, -1, t.precomp_k);
+      if (res != 0)
+        return -1;
+
+      t.pqueue = new PriorityQueue<CorrFirstOrder <TypeReturn> >;
+      t.pqueue->init(conf.top);
+      t.top_corr = new CorrFirstOrder <TypeReturn> [n_keys];
+      targets.push_back(t);
+    }
+    fin_conf.mat_args->guess = NULL;
+    fin_conf.mat_args->inputs = NULL;
+    fin_conf.mat_args->table = NULL;
+
+    fin_conf.queues = (void *) &targets;
+    res = correlate_chunks(loader, fin_conf, groups, correlation_first_order_bytes<TypeTrace, TypeReturn, TypeGuess>, (TypeReturn **) NULL, ncol);
+    fin_conf.queues = (void *) queues;
+    if (res != 0)
+      return -1;
+    end = omp_get_wtime();
+    if (conf.sep == "") {
+      printf("[INFO] Joint attack of %i key bytes done in %lf seconds.\n\n", n_targets, end - start);
+      fflush(stdout);
+    }
+  }
+
   vector<CorrFirstOrder<TypeReturn>*> sum_bit_corels;
   vector<CorrFirstOrder<TypeReturn>*> peak_bit_corels;
   /* We loop over all the key bytes.
@@ -153,8 +515,8 @@ int first_order(Config & conf)
     /* Potentially attack each bit individually. */
     int bitsperbyte;
 
-    if (conf.algo == ALG_AES) bitsperbyte = 8;
-    else if (conf.algo == ALG_DES) bitsperbyte = 4;
+    if (conf.algo == ALG_DES) bitsperbyte = 4;
+    else bitsperbyte = 8;
 
     for (int bit=0; bit >= 0 && bit < bitsperbyte; bit=(bit!=-1)?bit+1:bit) {
       if (conf.bitnum == -2) bit = -1;
@@ -165,154 +527,26 @@ int first_order(Config & conf)
         else if (conf.key_size > 1) printf("%i%s", bit, conf.sep.c_str());
       }
 
-      res = construct_guess (&fin_conf.mat_args->guess, conf.algo, conf.guesses, conf.n_file_guess, bn, conf.round, conf.des_switch, conf.sbox, conf.total_n_keys, bit);
-      if (res < 0) {
-        fprintf (stderr, "[ERROR] Constructing guess.\n");
-        return -1;
-      }
-
-      res = split_work(fin_conf, precomp_guesses<TypeTrace, TypeReturn, TypeGuess>, precomp_k, n_keys);
-      if (res != 0) {
-        fprintf(stderr, "[ERROR] Precomputing sum and sum of square for the guesses.\n");
-        return -1;
-      }
-
-
-      /* We iterate over the all the files, loading ncol columns to memory at a
-       * time.
+      /* The correlations of a jointly attacked byte are already known.
        */
-      while (!is_last_iter) {
-
-        /* If the number of samples loaded so far + what we will load in this
-         * iteration is larger than the number of samples, it's the last iter.
-         */
-        if (samples_loaded + to_load >= n_samples){
-          is_last_iter = 1;
-          to_load = n_samples - samples_loaded;
-        }
-
-        /* We iterate over all the files, loading to_load samples at a time and
-         * starting at offset 'conf.index_sample + sample_offset + row_offset'
-         * in the files. This offset depends on the iteration and the variable
-         * to_load depends on whether it is the first iteration or not
-         * (we have to load more in the first iteration)
-         */
-        for (int i = 0; i < nmat; i++){
-          cur_n_rows = conf.traces[i].n_rows;
-          cur_n_cols = conf.traces[i].n_columns;
-
-          res = load_file_v_1(conf.traces[i].filename, &tmp, cur_n_rows, to_load, conf.index_sample + sample_offset + row_offset, cur_n_cols);
-          if (res != 0) {
-            fprintf (stderr, "[ERROR] Loading file.\n");
-            return -1;
-          }
-
-          /* We copy the array tmp in the array traces at the good offset, and we
-           * transpose it at the same time.
-           * row_offset is used to make the distinction between the first iteration
-           * and the following.
-           */
-          for (int j = 0; j < cur_n_rows; j++){
-            for (int k = 0; k < to_load; k++){
-              fin_conf.mat_args->trace[k + row_offset][j + col_offset] = tmp[j][k];
-            }
-          }
-          col_offset += conf.traces[i].n_rows;
-        }
-
-        samples_loaded += to_load;
-
-        /* We set to_load to col_incr. So that only in the very first iteration
-         * we load ncol.
-         */
-        to_load = col_incr;
-
-        /* Same principle for row_offset
-         */
-        row_offset = 0;
-
-        col_offset = 0;
-
-        res = split_work(fin_conf, correlation_first_order<TypeTrace, TypeReturn, TypeGuess>, precomp_k, is_last_iter ? (n_samples - sample_offset) : col_incr, sample_offset);
-        if (res != 0) {
-          fprintf(stderr, "[ERROR] Computing correlations.\n");
-          return -1;
-        }
-        sample_offset += col_incr;
-
-        /* If we are at the last iteration at that point, no need to do more
-         * work.
-         */
-        if (is_last_iter)
-          break;
-      }
-
-      /* Warning, when using DES, the correct key doesn't correspond to the actual
-       * good key, as we are predicting the input state based on a round key.
-       */
-      int correct_key = -1;
-      if (conf.key_size == 1 && conf.correct_key != -1) {
-        if (conf.des_switch == DES_4_BITS && conf.correct_key != -1) correct_key = get_4_middle_bits(conf.correct_key);
-        else correct_key = conf.correct_key;
-        pqueue->print(conf.top, correct_key);
-        print_top_r(top_r_by_key, n_keys, correct_key);
-      } else if (conf.complete_correct_key != NULL) {
-        if (conf.des_switch == DES_4_BITS) correct_key = get_4_middle_bits(conf.complete_correct_key[bn]);
-        else correct_key = conf.complete_correct_key[bn];
-
-        if (conf.bitnum == -1) {
-          sort(top_r_by_key, top_r_by_key + n_keys);
-          for (int i = n_keys - 1; i >= 0; i--) {
-            if (top_r_by_key[i] == correct_key) {
-              if (n_keys - i - 1 < lowest_rank) {
-                lowest_rank = n_keys - i - 1;
-                best_out.str(std::string());  /* Clear best_out. */
-                best_out << "Best bit: " << bit << " rank: " << n_keys - i - 1 << "." << setw(-2) << top_r_by_key[i] << endl;
-              }
-            }
-          }
-        } else {
-          print_top_r(top_r_by_key, n_keys, correct_key, conf.sep);
-        }
+      if (joint) {
+        ByteTarget<TypeReturn, TypeGuess> & t = targets[next_target++];
+        report_byte(conf, bn, bit, bitsperbyte, n_keys, t.pqueue, t.top_corr, groups, sum_bit_corels.back(), peak_bit_corels.back(), lowest_rank, best_out);
+        continue;
       }
 
-      int key_guess_used[256] = {0};
-      for (int i = 0; i < n_keys; i++) {
-        if (key_guess_used[top_r_by_key[i].key] == 0) {
-          key_guess_used[top_r_by_key[i].key] = 1;
-          sum_bit_corels.back()[top_r_by_key[i].key].corr += abs(top_r_by_key[i].corr);
-          if (abs(top_r_by_key[i].corr) > peak_bit_corels.back()[top_r_by_key[i].key].corr)
-            peak_bit_corels.back()[top_r_by_key[i].key].corr = abs(top_r_by_key[i].corr);
-        }
-      }
+      res = prepare_guesses(fin_conf, &guesses, model, bn, bit, precomp_k);
+      if (res != 0)
+        return -1;
+      mat_args.guess_bits = NULL;
+      if (guess_bits != NULL && pack_guesses(mat_args.guess, mat_args.inputs, mat_args.table, n_keys, nrows, guess_bits))
+        mat_args.guess_bits = guess_bits;
 
-    if ( ((conf.bitnum == -1) && (bit == bitsperbyte-1))      // 'all' case
-	      || ((conf.bitnum != -1) && (bit >= 0))    // single bit case
-	      || (conf.bitnum == -2))                   // 'none' case
-    {
-        int nbest=10; // TODO: make it a config parameter
-        sort (sum_bit_corels.back(), sum_bit_corels.back() + n_keys);
-        sort (peak_bit_corels.back(), peak_bit_corels.back() + n_keys);
-        cout << "Best " << nbest << " candidates for key byte #" << bn << " according to sum(abs(bit_correlations)):" << endl;
-        for (int i = 1; i <= nbest; i++) {
-          cout << setfill(' ') << setw(2) << i << ": 0x" << setfill('0') << setw(2) << hex << sum_bit_corels.back()[n_keys-i].key;
-          cout << setfill(' ') << dec << "  sum: " << setw(8) << left << sum_bit_corels.back()[n_keys-i].corr << right;
-          if (sum_bit_corels.back()[n_keys-i].key == correct_key)
-            cout << "  <==";
-          cout << endl;
-        }
-        cout << endl;
-        cout << "Best " << nbest << " candidates for key byte #" << bn << " according to highest abs(bit_correlations):" << endl;
-        for (int i = 1; i <= nbest; i++) {
-          cout << setfill(' ') << setw(2) << i << ": 0x" << setfill('0') << setw(2) << hex << peak_bit_corels.back()[n_keys-i].key;
-          cout << setfill(' ') << dec << "  peak: " << setw(8) << left << peak_bit_corels.back()[n_keys-i].corr << right;
-          if (peak_bit_corels.back()[n_keys-i].key == correct_key)
-            cout << "  <==";
-          cout << endl;
-        }
-        cout << endl;
-      }
+      res = correlate_chunks(loader, fin_conf, groups, correlation_first_order<TypeTrace, TypeReturn, TypeGuess>, precomp_k, ncol);
+      if (res != 0)
+        return -1;
 
+      report_byte(conf, bn, bit, bitsperbyte, n_keys, pqueue, top_r_by_key, groups, sum_bit_corels.back(), peak_bit_corels.back(), lowest_rank, best_out);
 
       /* We reset the variables and arrays.
        */
@@ -323,15 +557,10 @@ int first_order(Config & conf)
       }
 
       end = omp_get_wtime();
-
-      is_last_iter = 0;
-      col_offset = 0;
-      row_offset = 0;
-      sample_offset = 0;
-      samples_loaded = 0;
-      to_load = ncol;
     }
-    if (conf.sep == ""){
+    if (conf.sep == "" && groups != NULL)
+      printf("[INFO] %li duplicated samples were not correlated.\n", groups->n_skipped);
+    if (conf.sep == "" && !joint){
       printf("[INFO] Attack of byte number %i done in %lf seconds.\n", bn, end - start);
       fflush(stdout);
     }
@@ -360,14 +589,23 @@ int first_order(Config & conf)
       delete sum_bit_corels[i];
       delete peak_bit_corels[i];
   }
+  for (size_t i = 0; i < targets.size(); i++) {
+    targets[i].pqueue->release();
+    delete targets[i].pqueue;
+    delete[] targets[i].top_corr;
+    free_matrix(&targets[i].precomp_k, n_keys);
+    free_matrix(&targets[i].guess, n_keys);
+  }
 
   delete[] top_r_by_key;
+  pqueue->release();
   delete pqueue;
   delete queues;
+  delete groups;
   free_matrix(&precomp_k, n_keys);
   free_matrix(&traces, ncol);
-  free_matrix(&tmp, max_n_rows);
-  free_matrix(&fin_conf.mat_args->guess, n_keys);
+  free_matrix(&guesses, n_keys);
+  free_matrix(&guess_bits, n_keys);
   pthread_mutex_destroy(&pt_lock);
   return 0;
 }
@@ -382,58 +620,207 @@ void * correlation_first_order(void * args_in)
 {
   General<TypeTrace, TypeReturn, TypeGuess> * G = (General<TypeTrace, TypeReturn, TypeGuess> *) args_in;
   FirstOrderQueues<TypeReturn> * queues = (FirstOrderQueues<TypeReturn> *)(G->fin_conf->queues);
-  int i, k, j,
+  int i, k,
       n_keys = G->fin_conf->conf->total_n_keys,
       n_traces = G->fin_conf->conf->n_traces,
-      first_sample = G->fin_conf->conf->index_sample,
-      offset = G->global_offset;
+      offset = G->global_offset,
+      time;
   TypeReturn corr,
     sum_trace,
     sum_sq_trace,
     tmp;
-  CorrFirstOrder<TypeReturn> * q = (CorrFirstOrder<TypeReturn> *) malloc(n_keys * sizeof(CorrFirstOrder<TypeReturn>));
-  if (q == NULL){
+  SampleGroups * groups = (SampleGroups *) G->fin_conf->groups;
+  SampleStats * stats = G->fin_conf->conf->stats;
+  MatArgs<TypeTrace, TypeReturn, TypeGuess> * mat_args = G->fin_conf->mat_args;
+  const int * weight = mat_args->weight;
+  int n_weight = mat_args->n_weight;
+  CorrFirstOrder<TypeReturn> * q = scratch_array<CorrFirstOrder<TypeReturn> >(n_keys);
+  TypeReturn * sum_prod = scratch_array<TypeReturn>(n_keys);
+  TypeReturn * row = weight != NULL ? scratch_array<TypeReturn>(n_traces) : NULL;
+  bool unpack = weight == NULL && packed_traces<TypeTrace>() && mat_args->guess_bits == NULL;
+  int8_t * bits = unpack ? scratch_array<int8_t>(n_traces) : NULL;
+  if (q == NULL || sum_prod == NULL || (weight != NULL && row == NULL) || (unpack && bits == NULL)){
     fprintf (stderr, "[ERROR] Allocating memory for q in correlation\n");
+    return NULL;
   }
 
+  LocalTop<CorrFirstOrder<TypeReturn> > local(G->fin_conf->conf->top, n_keys, G->fin_conf->conf->key_size == 1,
+      G->start + offset, G->length);
+
   for (i = G->start; i < G->start + G->length; i++) {
-    sum_trace = 0.0;
-    sum_sq_trace = 0.0;
-    for (j = 0; j < n_traces; j++){
-      tmp = G->fin_conf->mat_args->trace[i][j];
-      sum_trace += tmp;
-      sum_sq_trace += tmp*tmp;
+    if (groups != NULL && !groups->is_rep(i))
+      continue;
+
+    /* The sample of a weighted trace counts as many times as its weight.
+     * Packed samples are unpacked once, for all the keys, unless the
+     * guesses are packed too.
+     */
+    if (weight != NULL)
+      weigh_sample(mat_args->trace[i], weight, n_traces, row);
+    else if (bits != NULL)
+      unpack_sample(mat_args->trace[i], n_traces, bits);
+
+    /* The sums of the sample are read from the statistics when already
+     * computed for a previous key byte or run.
+     */
+    if (stats_get(stats, i + offset, STATS_SUM | STATS_SUM_SQ)) {
+      sum_trace = stats->sum[i + offset];
+      sum_sq_trace = stats->sum_sq[i + offset];
+    } else {
+      sample_sums(mat_args->trace[i], row, n_traces, sum_trace, sum_sq_trace);
+      stats_put(stats, i + offset, STATS_SUM | STATS_SUM_SQ, sum_trace, sum_sq_trace);
     }
 
-    sum_sq_trace = sqrt(n_traces*sum_sq_trace - sum_trace*sum_trace);
+    sum_sq_trace = sqrt(n_weight*sum_sq_trace - sum_trace*sum_trace);
+    time = sample_index(*G->fin_conf->conf, i + offset);
 
-    for (k = 0; k < n_keys; k++) {
-      tmp = sqrt(n_traces * G->precomp_guesses[k][1] - G->precomp_guesses[k][0] * G->precomp_guesses[k][0]);
+    /* The sample is correlated with the guesses of all the keys at once.
+     * The guesses are only packed along with the traces, whose rows then
+     * hold BitWord.
+     */
+    if (packed_traces<TypeTrace>() && mat_args->guess_bits != NULL)
+      and_products((const BitWord *) mat_args->trace[i], mat_args->guess_bits, n_traces, n_keys, sum_prod);
+    else if (weight != NULL)
+      dot_products(mat_args->guess, mat_args->inputs, mat_args->table, row, n_traces, n_keys, sum_prod);
+    else if (bits != NULL)
+      dot_products(mat_args->guess, mat_args->inputs, mat_args->table, bits, n_traces, n_keys, sum_prod);
+    else
+      dot_products(mat_args->guess, mat_args->inputs, mat_args->table, mat_args->trace[i], n_traces, n_keys, sum_prod);
 
-      corr = pearson_v_2_2<TypeReturn, TypeTrace, TypeGuess>(G->fin_conf->mat_args->guess[k],\
-        G->precomp_guesses[k][0], tmp, G->fin_conf->mat_args->trace[i], sum_trace, sum_sq_trace, n_traces);
+    for (k = 0; k < n_keys; k++) {
+      tmp = sqrt(n_weight * G->precomp_guesses[k][1] - G->precomp_guesses[k][0] * G->precomp_guesses[k][0]);
+      corr = pearson_sums(sum_prod[k], G->precomp_guesses[k][0], tmp, sum_trace, sum_sq_trace, n_weight);
 
       if (!isnormal(corr)) corr = (TypeReturn) 0;
 
       q[k].corr  = corr;
-      q[k].time  = i + first_sample + offset;
+      q[k].time  = time;
       q[k].key   = k;
     }
 
-    pthread_mutex_lock(&pt_lock);
-    for (int key=0; key < n_keys; key++) {
-      if (G->fin_conf->conf->key_size == 1)
-        queues->pqueue->insert(q[key]);
-      if (queues->top_corr[key] < q[key]){
-        queues->top_corr[key] = q[key];
+    local.insert(q, n_keys);
+    if (G->fin_conf->conf->sample_score != NULL)
+      local.update_score(i + offset, q, n_keys);
+  }
+
+  /* The best correlations of the slice are merged once.
+   */
+  pthread_mutex_lock(&pt_lock);
+  local.merge(queues->pqueue, queues->top_corr, G->fin_conf->conf->sample_score);
+  pthread_mutex_unlock(&pt_lock);
+  return NULL;
+}
+
+/* Same as correlation_first_order for all the key bytes of the targets in
+ * fin_conf->queues: the sums of a sample are computed once, and its row of
+ * the traces is correlated with the guesses of every key byte while in
+ * cache.
+ */
+  template <class TypeTrace, class TypeReturn, class TypeGuess>
+static void * correlation_first_order_bytes(void * args_in)
+{
+  General<TypeTrace, TypeReturn, TypeGuess> * G = (General<TypeTrace, TypeReturn, TypeGuess> *) args_in;
+  vector<ByteTarget<TypeReturn, TypeGuess> > & targets = *(vector<ByteTarget<TypeReturn, TypeGuess> > *)(G->fin_conf->queues);
+  int i, k,
+      n_keys = G->fin_conf->conf->total_n_keys,
+      n_traces = G->fin_conf->conf->n_traces,
+      offset = G->global_offset,
+      time;
+  size_t b;
+  TypeReturn corr,
+    sum_trace,
+    sum_sq_trace,
+    tmp;
+  SampleGroups * groups = (SampleGroups *) G->fin_conf->groups;
+  SampleStats * stats = G->fin_conf->conf->stats;
+  MatArgs<TypeTrace, TypeReturn, TypeGuess> * mat_args = G->fin_conf->mat_args;
+  const int * weight = mat_args->weight;
+  int n_weight = mat_args->n_weight;
+  CorrFirstOrder<TypeReturn> * q = scratch_array<CorrFirstOrder<TypeReturn> >(n_keys);
+  TypeReturn * sum_prod = scratch_array<TypeReturn>(n_keys);
+  TypeReturn * row = weight != NULL ? scratch_array<TypeReturn>(n_traces) : NULL;
+  int8_t * bits = weight == NULL && packed_traces<TypeTrace>() ? scratch_array<int8_t>(n_traces) : NULL;
+  vector<LocalTop<CorrFirstOrder<TypeReturn> > *> local;
+
+  if (q == NULL || sum_prod == NULL || (weight != NULL && row == NULL) || (packed_traces<TypeTrace>() && weight == NULL && bits == NULL)){
+    fprintf (stderr, "[ERROR] Allocating memory for q in correlation\n");
+    return NULL;
+  }
+
+  for (b = 0; b < targets.size(); b++)
+    local.push_back(new LocalTop<CorrFirstOrder<TypeReturn> >(G->fin_conf->conf->top, n_keys, G->fin_conf->conf->key_size == 1, G->start + offset, 0));
+
+  for (i = G->start; i < G->start + G->length; i++) {
+    if (groups != NULL && !groups->is_rep(i))
+      continue;
+
+    if (weight != NULL)
+      weigh_sample(mat_args->trace[i], weight, n_traces, row);
+    else if (bits != NULL)
+      unpack_sample(mat_args->trace[i], n_traces, bits);
+
+    if (stats_get(stats, i + offset, STATS_SUM | STATS_SUM_SQ)) {
+      sum_trace = stats->sum[i + offset];
+      sum_sq_trace = stats->sum_sq[i + offset];
+    } else {
+      sample_sums(mat_args->trace[i], row, n_traces, sum_trace, sum_sq_trace);
+      stats_put(stats, i + offset, STATS_SUM | STATS_SUM_SQ, sum_trace, sum_sq_trace);
+    }
+
+    sum_sq_trace = sqrt(n_weight*sum_sq_trace - sum_trace*sum_trace);
+    time = sample_index(*G->fin_conf->conf, i + offset);
+
+    for (b = 0; b < targets.size(); b++) {
+      TypeReturn ** precomp_k = targets[b].precomp_k;
+      GuessModel<TypeGuess> & model = targets[b].model;
+      const uint16_t * inputs = model.table.empty() ? NULL : &model.x[0];
+      const TypeGuess * table = model.table.empty() ? NULL : &model.table[0];
+      if (weight != NULL)
+        dot_products(targets[b].guess, inputs, table, row, n_traces, n_keys, sum_prod);
+      else if (bits != NULL)
+        dot_products(targets[b].guess, inputs, table, bits, n_traces, n_keys, sum_prod);
+      else
+        dot_products(targets[b].guess, inputs, table, mat_args->trace[i], n_traces, n_keys, sum_prod);
+
+      for (k = 0; k < n_keys; k++) {
+        tmp = sqrt(n_weight * precomp_k[k][1] - precomp_k[k][0] * precomp_k[k][0]);
+        corr = pearson_sums(sum_prod[k], precomp_k[k][0], tmp, sum_trace, sum_sq_trace, n_weight);
+
+        if (!isnormal(corr)) corr = (TypeReturn) 0;
+
+        q[k].corr  = corr;
+        q[k].time  = time;
+        q[k].key   = k;
       }
+      local[b]->insert(q, n_keys);
     }
-    pthread_mutex_unlock(&pt_lock);
   }
-  free (q);
+
+  pthread_mutex_lock(&pt_lock);
+  for (b = 0; b < targets.size(); b++)
+    local[b]->merge(targets[b].pqueue, targets[b].top_corr, NULL);
+  pthread_mutex_unlock(&pt_lock);
+  for (b = 0; b < targets.size(); b++)
+    delete local[b];
   return NULL;
 }
 
+/* Prints the samples standing for a group among the best correlations by key.
+ */
+template <class Type>
+void print_groups(SampleGroups * groups, Type top_r[], int n_keys)
+{
+  int nbest = 20;
+  vector<int> times;
+
+  if (groups == NULL)
+    return;
+  sort(top_r, top_r + n_keys);
+  for (int i = n_keys - 1; i >= 0 && i >= n_keys - nbest; i--)
+    times.push_back(top_r[i].time);
+  print_sample_groups(groups, times);
+}
+
 template <class T> T productReduce(vector<T> &xs) {
     T acc = 1;
     for(const T &x: xs) {
@@ -511,8 +898,18 @@ template int first_order<float, double, uint8_t>(Config & conf);
 template int first_order<double, double, uint8_t>(Config & conf);
 template int first_order<int8_t, double, uint8_t>(Config & conf);
 template int first_order<int8_t, float, uint8_t>(Config & conf);
+template int first_order<int8_t, double, uint8_t, float>(Config & conf);
+template int first_order<int8_t, double, uint8_t, double>(Config & conf);
+template int first_order<int16_t, double, uint8_t, float>(Config & conf);
+template int first_order<int16_t, double, uint8_t, double>(Config & conf);
+template int first_order<int16_t, double, uint8_t, int8_t>(Config & conf);
+template int first_order<int16_t, float, uint8_t, int8_t>(Config & conf);
+template int first_order<BitWord, double, uint8_t>(Config & conf);
 
 template void * correlation_first_order<int8_t, double, uint8_t> (void * args_in);
 template void * correlation_first_order<int8_t, float, uint8_t> (void * args_in);
 template void * correlation_first_order<float, double, uint8_t> (void * args_in);
 template void * correlation_first_order<double, double, uint8_t> (void * args_in);
+template void * correlation_first_order<int16_t, double, uint8_t> (void * args_in);
+template void * correlation_first_order<int16_t, float, uint8_t> (void * args_in);
+template void * correlation_first_order<BitWord, double, uint8_t> (void * args_in);
@@ -21,9 +21,11 @@
 #ifndef FOCPA_H
 #define FOCPA_H
 
-/* First order cpa for large files
+/* First order cpa for large files. The traces are read from files of
+ * TypeFile and attacked as TypeTrace, quantized if TypeTrace is an integer
+ * type and TypeFile is not.
  */
-template <class TypeTrace, class TypeReturn, class TypeGuess>
+template <class TypeTrace, class TypeReturn, class TypeGuess, class TypeFile = TypeTrace>
 int first_order(Config & conf);
 
 
@@ -0,0 +1,152 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#include "guess.h"
+#include "workers.h"
+
+/* The messages imported from the matrices m, kept for the whole run.
+ */
+static Matrix * cached_of = NULL;
+static uint32_t cached_n_m = 0;
+static uint32_t cached_n_rows = 0;
+static uint8_t ** cached_messages = NULL;
+
+/* Structure used by the threads building a block of traces of the guesses.
+ */
+template <class TypeGuess>
+struct GuessBlock {
+
+  TypeGuess ** guess;
+  const uint16_t * x;
+  const TypeGuess * lut;
+  uint32_t n_keys;
+  uint32_t start;
+  uint32_t length;
+
+  GuessBlock(TypeGuess ** g, const uint16_t * xx, const TypeGuess * l, uint32_t nk, uint32_t st, uint32_t len):
+    guess(g), x(xx), lut(l), n_keys(nk), start(st), length(len) {
+  }
+};
+
+  template <class Type>
+int import_messages(Type *** mem, uint32_t * nrows, Matrix * m, uint32_t n_m)
+{
+  static_assert(sizeof(Type) == 1, "messages are bytes");
+
+  if (cached_messages == NULL || cached_of != m || cached_n_m != n_m) {
+    release_messages();
+    cached_n_rows = 0;
+    for (uint32_t i = 0; i < n_m; i++)
+      cached_n_rows += m[i].n_rows;
+    if (import_matrices(&cached_messages, m, n_m, 0, 0, 0, MEM_GUESSES) < 0) {
+      cached_messages = NULL;
+      return -1;
+    }
+    cached_of = m;
+    cached_n_m = n_m;
+  }
+  *mem = (Type **) cached_messages;
+  *nrows = cached_n_rows;
+  return 0;
+}
+
+void release_messages()
+{
+  if (cached_messages != NULL)
+    free_matrix(&cached_messages, cached_n_rows);
+  cached_messages = NULL;
+  cached_of = NULL;
+}
+
+  template <class TypeGuess>
+static void * guess_block(void * args_in)
+{
+  GuessBlock<TypeGuess> * B = (GuessBlock<TypeGuess> *) args_in;
+  const uint16_t * x = B->x + B->start;
+
+  for (uint32_t j = 0; j < B->n_keys; j++) {
+    TypeGuess * g = B->guess[j] + B->start;
+    for (uint32_t i = 0; i < B->length; i++)
+      g[i] = B->lut[x[i] ^ j];
+  }
+  return NULL;
+}
+
+  template <class TypeGuess>
+int fill_guess(TypeGuess *** guess, const uint16_t * x, const TypeGuess * lut, uint32_t n_keys, uint32_t nrows)
+{
+  vector<GuessBlock<TypeGuess> > ta;
+
+  if (*guess == NULL) {
+    if (allocate_matrix<TypeGuess> (guess, n_keys, nrows, MEM_GUESSES) < 0) {
+      fprintf (stderr, "[ERROR]: Allocating memory for guesses.\n");
+      return -1;
+    }
+  }
+
+  for (uint32_t start = 0; start < nrows; start += GUESS_BLOCK)
+    ta.push_back(GuessBlock<TypeGuess>(*guess, x, lut, n_keys, start, min((uint32_t) GUESS_BLOCK, nrows - start)));
+  if (ta.empty())
+    return 0;
+  return workers_run(guess_block<TypeGuess>, ta);
+}
+
+  template <class TypeGuess>
+int fill_guess_model(GuessModel<TypeGuess> * model, const uint16_t * x, const TypeGuess * lut, uint32_t n_lut, uint32_t n_keys, uint32_t nrows)
+{
+  model->x.assign(x, x + nrows);
+  model->table.resize(n_lut * n_keys);
+  for (uint32_t v = 0; v < n_lut; v++)
+    for (uint32_t j = 0; j < n_keys; j++)
+      model->table[v * n_keys + j] = lut[v ^ j];
+  return 0;
+}
+
+  template <class TypeGuess, class TypeReturn>
+void model_sums(const GuessModel<TypeGuess> & model, uint32_t n_keys, uint32_t n_traces, const int * weight, TypeReturn ** sums)
+{
+  vector<uint32_t> count(model.table.size() / n_keys, 0);
+  TypeReturn g;
+
+  for (uint32_t i = 0; i < n_traces; i++)
+    count[model.x[i]] += weight != NULL ? weight[i] : 1;
+  for (uint32_t k = 0; k < n_keys; k++) {
+    sums[k][0] = sums[k][1] = 0;
+    for (uint32_t v = 0; v < count.size(); v++) {
+      if (count[v] == 0)
+        continue;
+      g = model.table[v * n_keys + k];
+      sums[k][0] += count[v] * g;
+      sums[k][1] += count[v] * g * g;
+    }
+  }
+}
+
+template int import_messages(uint8_t *** mem, uint32_t * nrows, Matrix * m, uint32_t n_m);
+template int import_messages(int8_t *** mem, uint32_t * nrows, Matrix * m, uint32_t n_m);
+
+template int fill_guess(uint8_t *** guess, const uint16_t * x, const uint8_t * lut, uint32_t n_keys, uint32_t nrows);
+template int fill_guess(int8_t *** guess, const uint16_t * x, const int8_t * lut, uint32_t n_keys, uint32_t nrows);
+
+template int fill_guess_model(GuessModel<uint8_t> * model, const uint16_t * x, const uint8_t * lut, uint32_t n_lut, uint32_t n_keys, uint32_t nrows);
+template int fill_guess_model(GuessModel<int8_t> * model, const uint16_t * x, const int8_t * lut, uint32_t n_lut, uint32_t n_keys, uint32_t nrows);
+
+template void model_sums(const GuessModel<uint8_t> & model, uint32_t n_keys, uint32_t n_traces, const int * weight, float ** sums);
+template void model_sums(const GuessModel<uint8_t> & model, uint32_t n_keys, uint32_t n_traces, const int * weight, double ** sums);
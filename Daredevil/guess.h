@@ -0,0 +1,82 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#ifndef GUESS_H
+#define GUESS_H
+
+#include <stdint.h>
+#include "utils.h"
+
+/* Number of traces of a task building the guesses, small enough for the
+ * inputs of the task to stay in cache over all the keys.
+ */
+#define GUESS_BLOCK 16384
+
+/* Sets mem to the messages of the n_m matrices m and nrows to their total
+ * number of rows. The messages are imported on the first call and kept until
+ * release_messages, so that the guesses of every key byte and bit are built
+ * without reading the files again. Returns -1 on failure.
+ */
+  template <class Type>
+int import_messages(Type *** mem, uint32_t * nrows, Matrix * m, uint32_t n_m);
+
+/* Frees the messages kept by import_messages.
+ */
+void release_messages();
+
+/* The guesses of a key byte kept as the inputs x of the traces (see
+ * fill_guess_model) and the guesses of all the keys for every input,
+ * table[v * n_keys + k] = lut[v ^ k], instead of a matrix of n_keys rows of
+ * all the traces: the correlation kernels then generate them while reading
+ * the traces.
+ */
+template <class TypeGuess>
+struct GuessModel {
+
+  vector<uint16_t> x;
+  vector<TypeGuess> table;
+};
+
+/* Builds the n_keys rows of guess over nrows traces, allocating it if NULL,
+ * the guess of the trace i for the key j being lut[x[i] ^ j]: x holds what
+ * the guesses depend on for every trace (e.g. a byte of the message), lut
+ * the leakage model applied to it combined with the key (e.g. the Hamming
+ * weight of the sbox output). The traces are split in blocks built in
+ * parallel.
+ */
+  template <class TypeGuess>
+int fill_guess(TypeGuess *** guess, const uint16_t * x, const TypeGuess * lut, uint32_t n_keys, uint32_t nrows);
+
+/* Same as fill_guess, model being set to x and to the guesses of all the keys
+ * for every one of the n_lut inputs instead of building the rows of the
+ * guesses.
+ */
+  template <class TypeGuess>
+int fill_guess_model(GuessModel<TypeGuess> * model, const uint16_t * x, const TypeGuess * lut, uint32_t n_lut, uint32_t n_keys, uint32_t nrows);
+
+/* Sets sums[k][0] and sums[k][1] to the sum and the sum of squares of the
+ * guesses of the key k over the first n_traces traces of model, from the
+ * number of traces of every input, every trace counting weight[i] times
+ * unless weight is NULL.
+ */
+  template <class TypeGuess, class TypeReturn>
+void model_sums(const GuessModel<TypeGuess> & model, uint32_t n_keys, uint32_t n_traces, const int * weight, TypeReturn ** sums);
+
+#endif
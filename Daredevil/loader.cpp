@@ -0,0 +1,455 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#include <math.h>
+#include <limits>
+#include <string.h>
+#include "loader.h"
+#include "workers.h"
+
+/* Structure used by the threads pooling and transposing a slice of the points
+ * of a chunk.
+ */
+template <class TypeTrace, class TypeDst>
+struct PoolPoints {
+
+  const TypeTrace * const * tmp;
+  const int * dst;
+  const int * raw_offset;
+  const int * row_shift;
+  int n_rows;
+  TypeDst ** traces;
+  int start;
+  int length;
+  char pool;
+  int window;
+  /* The quantization of the points, NULL if not quantized.
+   */
+  const double * gain;
+  const double * offset;
+
+  PoolPoints(const TypeTrace * const * t, const int * d, const int * ro, const int * rs, int nr, TypeDst ** tr, int st, int len, char p, int w, const double * g, const double * o):
+    tmp(t), dst(d), raw_offset(ro), row_shift(rs), n_rows(nr), traces(tr), start(st), length(len), pool(p), window(w), gain(g), offset(o) {
+  }
+};
+
+/* Quantizes x to the symmetric range of TypeDst, saturating.
+ */
+template <class TypeDst>
+static inline TypeDst quantize(double x, double gain, double offset)
+{
+  const double top = numeric_limits<TypeDst>::max();
+  double q = rint((x - offset) * gain);
+
+  return (TypeDst) (q > top ? top : (q < -top ? -top : q));
+}
+
+/* Writes the bit of the trace col in the row of a sample, packed in the
+ * words of BitWord rows, which have to be cleared first.
+ */
+template <class TypeDst>
+static inline void put_bit(TypeDst * row, int col, int bit)
+{
+  row[col] = (TypeDst) bit;
+}
+
+static inline void put_bit(BitWord * row, int col, int bit)
+{
+  row[col / WORD_BITS] |= (BitWord) bit << (col % WORD_BITS);
+}
+
+/* Pools the window samples of x. The loops are kept trivial so that the
+ * compiler vectorizes them.
+ */
+template <class TypeTrace>
+static inline double pool_samples(const TypeTrace * x, int window, char pool)
+{
+  double acc = 0;
+  int i;
+
+  switch (pool) {
+    case 's':
+      for (i = 0; i < window; i++)
+        acc += x[i];
+      return acc;
+    case 'm':
+      for (i = 0; i < window; i++)
+        acc += x[i];
+      return acc / window;
+    case 'a':
+      for (i = 0; i < window; i++)
+        acc = fmax(acc, fabs((double) x[i]));
+      return acc;
+    case 'q':
+      for (i = 0; i < window; i++)
+        acc += (double) x[i] * x[i];
+      return acc;
+  }
+  return x[0];
+}
+
+  template <class TypeTrace, class TypeDst>
+static void * pool_points(void * args_in)
+{
+  PoolPoints<TypeTrace, TypeDst> * P = (PoolPoints<TypeTrace, TypeDst> *) args_in;
+  int j, k;
+
+  for (k = P->start; k < P->start + P->length; k++) {
+    TypeDst * row = P->traces[k];
+    for (j = 0; j < P->n_rows; j++) {
+      if (P->dst[j] == -1)
+        continue;
+      double x = pool_samples(P->tmp[j] + P->raw_offset[k] + P->row_shift[j], P->window, P->pool);
+      row[P->dst[j]] = P->gain != NULL ? quantize<TypeDst>(x, P->gain[k], P->offset[k]) : (TypeDst) x;
+    }
+  }
+  return NULL;
+}
+
+  template <class TypeTrace>
+TraceLoader<TypeTrace>::TraceLoader(Config & c, int ncol):
+  conf(&c), tmp(NULL), shifted(NULL), max_n_rows(0), n_columns(ncol),
+  n_raw_columns(ncol * max(c.pool_window, c.pool_stride)),
+  margin(c.trace_shift.empty() ? 0 : c.align_shift)
+{
+  /* Every contiguous segment is read with margin more samples on both sides,
+   * for the shifts of the aligned traces.
+   */
+  n_raw_columns += 2 * margin * max((size_t) 1, c.sample_ranges.size());
+
+  /* The bytes of a segment of packed samples hold at most 14 more bits.
+   */
+  if (c.type_trace == 'b')
+    n_raw_columns = row_length<TypeTrace>(ncol + 16 * max((size_t) 1, c.sample_ranges.size()));
+}
+
+  template <class TypeTrace>
+TraceLoader<TypeTrace>::~TraceLoader()
+{
+  if (tmp != NULL)
+    free_matrix(&tmp, max_n_rows);
+  free(shifted);
+}
+
+  template <class TypeTrace>
+void plan_loader(const Config & conf, MemoryPlan & plan)
+{
+  long int max_n_rows = 0,
+      margin = conf.trace_shift.empty() ? 0 : conf.align_shift;
+
+  if (conf.projected != NULL)
+    return;
+  for (int i = 0; i < conf.n_file_trace; i++)
+    max_n_rows = max(max_n_rows, (long int) conf.traces[i].n_rows);
+
+  /* A bit by sample, and two bytes by segment, for the packed traces.
+   */
+  if (conf.type_trace == 'b') {
+    plan.per_col += (max_n_rows + 7) / 8;
+    plan.fixed += max_n_rows * (2 * max((size_t) 1, conf.sample_ranges.size()) + sizeof(TypeTrace)
+        + MATRIX_ALIGN + 2 * sizeof(TypeTrace *) + sizeof(int));
+    plan.fixed += conf.total_n_traces * sizeof(int);
+    return;
+  }
+
+  /* A row of tmp by trace of the largest file, padded, its pointer in
+   * shifted and its shift.
+   */
+  plan.per_col += max_n_rows * max(conf.pool_window, conf.pool_stride) * sizeof(TypeTrace);
+  plan.fixed += max_n_rows * (2 * margin * max((size_t) 1, conf.sample_ranges.size()) * sizeof(TypeTrace)
+      + MATRIX_ALIGN + 2 * sizeof(TypeTrace *) + sizeof(int));
+  plan.fixed += conf.total_n_traces * sizeof(int);
+}
+
+  template <class TypeTrace>
+int TraceLoader<TypeTrace>::init()
+{
+  int res, n_selected = 0;
+
+  if (conf->projected != NULL)
+    return 0;
+
+  /* We determine the size of the file having the largest number of rows, to
+   * allocate memory for tmp.
+   */
+  for (int i = 0; i < conf->n_file_trace; i++){
+    if(conf->traces[i].n_rows > max_n_rows)
+      max_n_rows = conf->traces[i].n_rows;
+  }
+
+  res = allocate_matrix(&tmp, max_n_rows, n_raw_columns);
+  if (res != 0) {
+    fprintf (stderr, "[ERROR] Allocating matrix in loader.\n");
+    return -1;
+  }
+
+  shifted = (TypeTrace **) malloc(max_n_rows * sizeof(TypeTrace *));
+  if (shifted == NULL) {
+    fprintf (stderr, "[ERROR] Allocating matrix in loader.\n");
+    return -1;
+  }
+
+  /* Without an explicit selection, we keep the first n_traces traces.
+   */
+  raw_offset.resize(n_columns);
+  row_shift.resize(max_n_rows);
+  dst.assign(conf->total_n_traces, -1);
+  if (conf->trace_index.empty()) {
+    for (int j = 0; j < conf->n_traces; j++)
+      dst[j] = n_selected++;
+  } else {
+    for (size_t j = 0; j < conf->trace_index.size(); j++)
+      dst[conf->trace_index[j]] = n_selected++;
+  }
+  if (n_selected != conf->n_traces) {
+    fprintf (stderr, "[ERROR] %i traces selected, %i expected.\n", n_selected, conf->n_traces);
+    return -1;
+  }
+  return 0;
+}
+
+/* The logical samples are split into contiguous segments of the files, which
+ * are read next to each other in tmp before being pooled and transposed.
+ */
+  template <class TypeTrace>
+  template <class TypeDst>
+int TraceLoader<TypeTrace>::load(TypeDst ** traces, int dst_row, int first, int n_load)
+{
+  int res, i, j, k, n, cur_n_rows, cur_n_cols, raw_pos, raw_start,
+      row_offset = 0,
+      stride = conf->pool_stride,
+      window = conf->pool_window;
+
+  /* The samples are quantized when float traces are loaded as integers.
+   */
+  const double * gain = NULL, * offset = NULL;
+  if (numeric_limits<TypeDst>::is_integer && !numeric_limits<TypeTrace>::is_integer && !conf->quant_gain.empty()) {
+    gain = &conf->quant_gain[first];
+    offset = &conf->quant_offset[first];
+  }
+
+  if (n_load > n_columns) {
+    fprintf (stderr, "[ERROR] Loading %i samples in a chunk of %i.\n", n_load, n_columns);
+    return -1;
+  }
+
+  if (conf->type_trace == 'b')
+    return load_packed(traces, dst_row, first, n_load);
+
+  if (conf->projected != NULL) {
+    for (k = 0; k < n_load; k++)
+      for (j = 0; j < conf->n_traces; j++)
+        traces[k + dst_row][j] = gain != NULL ? quantize<TypeDst>(conf->projected[first + k][j], gain[k], offset[k]) : (TypeDst) conf->projected[first + k][j];
+    return 0;
+  }
+
+  for (i = 0; i < conf->n_file_trace; i++){
+    cur_n_rows = conf->traces[i].n_rows;
+    cur_n_cols = conf->traces[i].n_columns;
+
+    /* Skips the files of which no trace is selected.
+     */
+    for (j = 0; j < cur_n_rows && dst[row_offset + j] == -1; j++);
+    if (j == cur_n_rows) {
+      row_offset += cur_n_rows;
+      continue;
+    }
+
+    k = 0;
+    raw_pos = 0;
+    while (k < n_load) {
+      int start = sample_index(*conf, first + k),
+          length = 1,
+          raw_length;
+
+      while (k + length < n_load && sample_index(*conf, first + k + length) == start + length * stride)
+        length++;
+      raw_length = (length - 1) * stride + window + 2 * margin;
+      raw_start = start - margin;
+      if (raw_start < 0 || raw_start + raw_length > cur_n_cols) {
+        fprintf (stderr, "[ERROR] Samples [%i, %i) out of the traces.\n", raw_start, raw_start + raw_length);
+        return -1;
+      }
+
+      for (j = 0; j < cur_n_rows; j++)
+        shifted[j] = tmp[j] + raw_pos;
+      res = load_file_v_1(conf->traces[i].filename, &shifted, cur_n_rows, raw_length, raw_start, cur_n_cols);
+      if (res != 0) {
+        fprintf (stderr, "[ERROR] Loading file.\n");
+        return -1;
+      }
+      for (j = 0; j < length; j++)
+        raw_offset[k + j] = raw_pos + margin + j * stride;
+      raw_pos += raw_length;
+      k += length;
+    }
+
+    /* The shift of every aligned trace.
+     */
+    for (j = 0; j < cur_n_rows; j++)
+      row_shift[j] = conf->trace_shift.empty() ? 0 : conf->trace_shift[row_offset + j];
+
+    /* Without pooling, we copy the array tmp in the array traces at the good
+     * offset, and we transpose it AND typecast to TypeDst at the same time.
+     */
+    if (conf->pool == 0) {
+      for (j = 0; j < cur_n_rows; j++){
+        int col = dst[row_offset + j];
+        if (col == -1)
+          continue;
+        if (gain != NULL) {
+          for (k = 0; k < n_load; k++)
+            traces[k + dst_row][col] = quantize<TypeDst>(tmp[j][raw_offset[k] + row_shift[j]], gain[k], offset[k]);
+          continue;
+        }
+        for (k = 0; k < n_load; k++){
+          traces[k + dst_row][col] = (TypeDst) tmp[j][raw_offset[k] + row_shift[j]];
+        }
+      }
+      row_offset += cur_n_rows;
+      continue;
+    }
+
+    /* Otherwise the points are pooled in parallel, each thread writing its
+     * own rows of traces.
+     */
+    int n_threads = min(conf->n_threads, n_load),
+        workload = n_load / n_threads;
+    vector<PoolPoints<TypeTrace, TypeDst> > ta;
+    ta.reserve(n_threads);
+
+    for (n = 0; n < n_threads; n++) {
+      ta.push_back(PoolPoints<TypeTrace, TypeDst>(tmp, &dst[row_offset], &raw_offset[0], &row_shift[0], cur_n_rows, traces + dst_row,
+            n*workload, workload + ((n + 1) / n_threads) * (n_load % n_threads), conf->pool, window, gain, offset));
+    }
+    res = workers_run(pool_points<TypeTrace, TypeDst>, ta);
+    if (res != 0)
+      return -1;
+    row_offset += cur_n_rows;
+  }
+  return 0;
+}
+
+/* The contiguous segments of the samples are read with the bytes holding
+ * them, next to each other in the rows of tmp, raw_offset being then the
+ * position in bits of every sample in a row.
+ */
+  template <class TypeTrace>
+  template <class TypeDst>
+int TraceLoader<TypeTrace>::load_packed(TypeDst ** traces, int dst_row, int first, int n_load)
+{
+  int res, i, j, k, cur_n_rows, cur_n_cols, raw_pos,
+      row_offset = 0;
+  vector<uint8_t *> rows(max_n_rows);
+
+  if (packed_traces<TypeDst>()) {
+    for (k = 0; k < n_load; k++)
+      memset(traces[k + dst_row], 0, row_length<TypeDst>(conf->n_traces) * sizeof(TypeDst));
+  }
+
+  for (i = 0; i < conf->n_file_trace; i++){
+    cur_n_rows = conf->traces[i].n_rows;
+    cur_n_cols = conf->traces[i].n_columns;
+
+    for (j = 0; j < cur_n_rows && dst[row_offset + j] == -1; j++);
+    if (j == cur_n_rows) {
+      row_offset += cur_n_rows;
+      continue;
+    }
+
+    k = 0;
+    raw_pos = 0;
+    while (k < n_load) {
+      int start = sample_index(*conf, first + k),
+          length = 1,
+          first_byte, n_bytes;
+      uint8_t ** dst_rows = &rows[0];
+
+      while (k + length < n_load && sample_index(*conf, first + k + length) == start + length)
+        length++;
+      if (start < 0 || start + length > cur_n_cols) {
+        fprintf (stderr, "[ERROR] Samples [%i, %i) out of the traces.\n", start, start + length);
+        return -1;
+      }
+      first_byte = start / 8;
+      n_bytes = (start + length + 7) / 8 - first_byte;
+
+      for (j = 0; j < cur_n_rows; j++)
+        rows[j] = (uint8_t *) tmp[j] + raw_pos;
+      res = load_file_v_1(conf->traces[i].filename, &dst_rows, cur_n_rows, n_bytes, first_byte, (cur_n_cols + 7) / 8);
+      if (res != 0) {
+        fprintf (stderr, "[ERROR] Loading file.\n");
+        return -1;
+      }
+      for (j = 0; j < length; j++)
+        raw_offset[k + j] = 8 * raw_pos + start % 8 + j;
+      raw_pos += n_bytes;
+      k += length;
+    }
+
+    for (j = 0; j < cur_n_rows; j++){
+      int col = dst[row_offset + j];
+      const uint8_t * bytes = (const uint8_t *) tmp[j];
+      if (col == -1)
+        continue;
+      for (k = 0; k < n_load; k++)
+        put_bit(traces[k + dst_row], col, (bytes[raw_offset[k] / 8] >> (raw_offset[k] % 8)) & 1);
+    }
+    row_offset += cur_n_rows;
+  }
+  return 0;
+}
+
+  template <class TypeGuess>
+void select_guess_columns(TypeGuess ** guess, int n_keys, const vector<int> & trace_index)
+{
+  if (trace_index.empty())
+    return;
+  for (int k = 0; k < n_keys; k++) {
+    for (size_t j = 0; j < trace_index.size(); j++)
+      guess[k][j] = guess[k][trace_index[j]];
+  }
+}
+
+template struct TraceLoader<float>;
+template struct TraceLoader<double>;
+template struct TraceLoader<int8_t>;
+template struct TraceLoader<BitWord>;
+
+template int TraceLoader<float>::load(float ** traces, int dst_row, int first, int n_load);
+template int TraceLoader<double>::load(double ** traces, int dst_row, int first, int n_load);
+template int TraceLoader<int8_t>::load(int8_t ** traces, int dst_row, int first, int n_load);
+template int TraceLoader<float>::load(double ** traces, int dst_row, int first, int n_load);
+template int TraceLoader<int8_t>::load(double ** traces, int dst_row, int first, int n_load);
+template int TraceLoader<int8_t>::load(float ** traces, int dst_row, int first, int n_load);
+template int TraceLoader<float>::load(int8_t ** traces, int dst_row, int first, int n_load);
+template int TraceLoader<float>::load(int16_t ** traces, int dst_row, int first, int n_load);
+template int TraceLoader<double>::load(int8_t ** traces, int dst_row, int first, int n_load);
+template int TraceLoader<double>::load(int16_t ** traces, int dst_row, int first, int n_load);
+template int TraceLoader<int8_t>::load(int16_t ** traces, int dst_row, int first, int n_load);
+template int TraceLoader<BitWord>::load(BitWord ** traces, int dst_row, int first, int n_load);
+template int TraceLoader<BitWord>::load(double ** traces, int dst_row, int first, int n_load);
+
+template void plan_loader<float>(const Config & conf, MemoryPlan & plan);
+template void plan_loader<double>(const Config & conf, MemoryPlan & plan);
+template void plan_loader<int8_t>(const Config & conf, MemoryPlan & plan);
+template void plan_loader<BitWord>(const Config & conf, MemoryPlan & plan);
+
+template void select_guess_columns(uint8_t ** guess, int n_keys, const vector<int> & trace_index);
@@ -0,0 +1,146 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <vector>
+#include "utils.h"
+
+/* Loads the time samples of the trace files chunk by chunk, used by all the
+ * attacks. The time samples are indexed logically, from 0 to conf.n_samples,
+ * and mapped to the samples of the files by the sample ranges of the
+ * configuration. Only the selected traces (see conf.trace_index) are kept,
+ * and the chunk is transposed, so that a row of the destination array holds
+ * one time sample of all the selected traces. After a PCA, the chunks are
+ * copied from the projected traces instead.
+ *
+ * The files of bit-packed traces (TypeTrace BitWord) hold one bit by sample,
+ * 8 samples by byte starting with the least significant bit, every trace
+ * being padded to a whole byte. Their rows are read in bytes, in tmp.
+ */
+template <class TypeTrace>
+struct TraceLoader {
+
+  Config * conf;
+
+  /* Temporary array in which the rows of a file are read, and the same array
+   * shifted to the position of a sample range. With pooling, a row holds the
+   * raw samples of n_columns points, starting at raw_offset[k] for point k.
+   */
+  TypeTrace ** tmp;
+  TypeTrace ** shifted;
+  unsigned int max_n_rows;
+  int n_columns;
+  int n_raw_columns;
+  vector<int> raw_offset;
+
+  /* Number of samples read around the segments for the aligned traces, and
+   * the shift of each row of the current file.
+   */
+  int margin;
+  vector<int> row_shift;
+
+  /* Destination column of every trace of the files, -1 if not selected.
+   */
+  vector<int> dst;
+
+  TraceLoader(Config & c, int ncol);
+  ~TraceLoader();
+
+  /* Initializes the loader, returns -1 on failure.
+   */
+  int init();
+
+  /* Loads the n_load logical samples starting at first in the rows dst_row,
+   * dst_row + 1, ... of traces, pooling them and converting them to TypeDst.
+   * Float samples loaded as integers are quantized by conf.quant_gain and
+   * conf.quant_offset once computed.
+   */
+  template <class TypeDst>
+  int load(TypeDst ** traces, int dst_row, int first, int n_load);
+
+  /* Same as load for the files of bit-packed traces, the bits being
+   * packed in the rows of traces again if TypeDst is BitWord.
+   */
+  template <class TypeDst>
+  int load_packed(TypeDst ** traces, int dst_row, int first, int n_load);
+};
+
+/* Adds to plan the buffers of a TraceLoader reading the files, for every
+ * sample loaded at a time.
+ */
+template <class TypeTrace>
+void plan_loader(const Config & conf, MemoryPlan & plan);
+
+/* Returns the index in the trace files of the logical sample s, i.e. the
+ * first sample of its pooling window, or the component s after a PCA.
+ */
+inline int sample_index(const Config & conf, int s)
+{
+  if (conf.projected != NULL)
+    return s;
+  if (conf.sample_ranges.empty())
+    return conf.index_sample + s * conf.pool_stride;
+  for (size_t r = 0; r < conf.sample_ranges.size(); r++) {
+    if (s < conf.sample_ranges[r].second)
+      return conf.sample_ranges[r].first + s * conf.pool_stride;
+    s -= conf.sample_ranges[r].second;
+  }
+  return -1;
+}
+
+/* Returns the logical sample following the last one of the range of the
+ * files holding the logical sample s, or n_samples when the samples are not
+ * split in ranges. The ranges are not adjacent in the traces, so the samples
+ * of a second order pair are taken in a single range.
+ */
+inline int range_end(const Config & conf, int s)
+{
+  int end = 0;
+
+  if (conf.projected != NULL)
+    return conf.n_samples;
+  for (size_t r = 0; r < conf.sample_ranges.size(); r++) {
+    end += conf.sample_ranges[r].second;
+    if (s < end)
+      return end;
+  }
+  return conf.n_samples;
+}
+
+/* Finds the file and the row in the file of the trace index.
+ */
+inline void locate_trace(const Config & conf, int index, int * file, int * row)
+{
+  *file = 0;
+  while (index >= (int) conf.traces[*file].n_rows) {
+    index -= conf.traces[*file].n_rows;
+    (*file)++;
+  }
+  *row = index;
+}
+
+/* Keeps in guess only the columns of the selected traces, in order.
+ */
+template <class TypeGuess>
+void select_guess_columns(TypeGuess ** guess, int n_keys, const vector<int> & trace_index);
+
+#endif
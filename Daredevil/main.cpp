@@ -20,23 +20,184 @@
 /* ===================================================================== */
 #include <omp.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "utils.h"
 #include "cpa.h"
 #include "socpa.h"
 #include "focpa.h"
+#include "poi.h"
+#include "pca.h"
+#include "quality.h"
+#include "align.h"
+#include "dtw.h"
+#include "snr.h"
+#include "ttest.h"
+#include "stats.h"
+#include "quantize.h"
+#include "workers.h"
+#include "affinity.h"
+#include "guess.h"
+#include "dedup.h"
 
 
+template <class TypeTrace, class TypeReturn, class TypeGuess>
+int correlate(Config & conf)
+{
+    int res = stats_open<TypeReturn>(conf);
+    if (res != 0)
+      return res;
+    if(conf.attack_order != 1)
+      res = second_order<TypeTrace, TypeReturn, TypeGuess>(conf);
+    else if (conf.quant_bits == 8)
+      res = first_order<int8_t, TypeReturn, TypeGuess, TypeTrace>(conf);
+    else if (conf.quant_bits == 16)
+      res = first_order<int16_t, TypeReturn, TypeGuess, TypeTrace>(conf);
+    else
+      res = first_order<TypeTrace, TypeReturn, TypeGuess>(conf);
+    mem_report("correlation");
+    if (res != 0)
+      return res;
+    return stats_save(conf);
+}
+
+/* The bit-packed traces are only correlated, they are not quantized.
+ */
+template <class TypeReturn, class TypeGuess>
+int correlate_bits(Config & conf)
+{
+    int res = stats_open<TypeReturn>(conf);
+    if (res != 0)
+      return res;
+    if(conf.attack_order != 1)
+      res = second_order<BitWord, TypeReturn, TypeGuess>(conf);
+    else
+      res = first_order<BitWord, TypeReturn, TypeGuess>(conf);
+    mem_report("correlation");
+    if (res != 0)
+      return res;
+    return stats_save(conf);
+}
+
+/* Runs correlate_fct with the standard output discarded: the rankings of the
+ * coarse pass are only on a subset of the traces and are not reported, the
+ * errors and warnings still going to the standard error.
+ */
+static int correlate_quiet(Config & conf, int (*correlate_fct)(Config &))
+{
+    int res, saved, null;
+
+    fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    null = open("/dev/null", O_WRONLY);
+    if (saved >= 0 && null >= 0)
+      dup2(null, STDOUT_FILENO);
+    if (null >= 0)
+      close(null);
+    res = correlate_fct(conf);
+    fflush(stdout);
+    if (saved >= 0) {
+      dup2(saved, STDOUT_FILENO);
+      close(saved);
+    }
+    return res;
+}
+
+/* Runs correlate_fct, on a subset of the traces first to localize the points
+ * of interest with poi_subset.
+ */
+int correlate_poi(Config & conf, int (*correlate_fct)(Config &))
+{
+    int res;
+    PoiState state;
+    if (conf.poi_subset <= 0)
+      return correlate_fct(conf);
+
+    res = poi_coarse(conf, state);
+    if (res == 0)
+      res = correlate_quiet(conf, correlate_fct);
+    if (res == 0)
+      res = poi_fine(conf, state);
+    if (res == 0)
+      res = correlate_fct(conf);
+    poi_restore(conf, state);
+    return res;
+}
+
 template <class TypeTrace, class TypeReturn, class TypeGuess>
 int attack(Config & conf)
 {
     int res = -1;
+    if (conf.ttest)
+      printf("[ATTACK] Computing t-tests...\n");
+    else if (conf.snr)
+      printf("[ATTACK] Computing signal-to-noise ratios...\n");
+    else
+      printf("[ATTACK] Computing %i-order correlations...\n", conf.attack_order);
+    fflush(stdout);
+    if (conf.quality_filter && !conf.quality_done) {
+      res = filter_traces<TypeTrace>(conf);
+      mem_report("quality filter");
+      if (res != 0)
+        return res;
+      conf.quality_done = true;
+    }
+    if (conf.align_length > 0 && conf.trace_shift.empty()) {
+      res = align_traces<TypeTrace>(conf);
+      mem_report("alignment");
+      if (res != 0)
+        return res;
+    }
+    if (conf.dtw_band > 0 && string(conf.traces[0].filename) != conf.dtw_output) {
+      res = dtw_traces<TypeTrace>(conf);
+      mem_report("elastic alignment");
+      if (res != 0)
+        return res;
+    }
+    if (conf.dedup_traces && !conf.dedup_done && !conf.ttest && !conf.snr) {
+      res = dedup_traces<TypeTrace>(conf);
+      mem_report("trace deduplication");
+      if (res != 0)
+        return res;
+      conf.dedup_done = true;
+    }
+    if (conf.pca_components > 0 && conf.projected == NULL) {
+      res = pca_project<TypeTrace>(conf);
+      mem_report("projection");
+      if (res != 0)
+        return res;
+    }
+    if (conf.ttest || conf.snr) {
+      res = conf.ttest ? ttest<TypeTrace>(conf) : snr<TypeTrace>(conf);
+      mem_report(conf.ttest ? "t-test" : "signal-to-noise ratio");
+      return res;
+    }
+    if (conf.quant_bits > 0 && conf.quant_gain.empty()) {
+      res = quantize_traces<TypeTrace>(conf);
+      mem_report("quantization");
+      if (res != 0)
+        return res;
+    }
+    return correlate_poi(conf, correlate<TypeTrace, TypeReturn, TypeGuess>);
+}
+
+/* The other stages need the values of the samples, and are not supported by
+ * the bit-packed traces (see load_config).
+ */
+template <class TypeReturn, class TypeGuess>
+int attack_bits(Config & conf)
+{
+    int res;
     printf("[ATTACK] Computing %i-order correlations...\n", conf.attack_order);
     fflush(stdout);
-    if(conf.attack_order == 1)
-      res = first_order<TypeTrace, TypeReturn, TypeGuess>(conf);
-    else
-      res = second_order<TypeTrace, TypeReturn, TypeGuess>(conf);
-    return res;
+    if (conf.dedup_traces && !conf.dedup_done) {
+      res = dedup_traces<BitWord>(conf);
+      mem_report("trace deduplication");
+      if (res != 0)
+        return res;
+      conf.dedup_done = true;
+    }
+    return correlate_poi(conf, correlate_bits<TypeReturn, TypeGuess>);
 }
 
 int run(Config & conf)
@@ -50,6 +211,8 @@ int run(Config & conf)
         return attack<int8_t, double, uint8_t>(conf);
       }else if (conf.type_trace == 'd'){
         return attack<double, double, uint8_t>(conf);
+      }else if (conf.type_trace == 'b'){
+        return attack_bits<double, uint8_t>(conf);
       //}else if (conf.type_trace == 'u'){
         //attack<uint8_t, double, uint8_t>(conf);
       }else{
@@ -98,6 +261,18 @@ int main(int argc, char * argv[])
 
   print_config(conf);
 
+  mem_init(conf.memory_cap, conf.memory_report);
+  set_huge_pages(conf.huge_pages);
+
+  /* The worker threads are started once for all the attacks.
+   */
+  affinity_init(conf);
+  res = workers_start(conf.n_threads);
+  if (res != 0) {
+    fprintf(stderr, "[ERROR] Starting the worker threads.\n");
+    return -1;
+  }
+
   for (size_t i = 0; i < conf.all_sboxes.size(); i++) {
     res = parse_sbox_file(conf.all_sboxes[i].c_str(), &conf.sbox);
     if (res != 0){
@@ -107,13 +282,21 @@ int main(int argc, char * argv[])
 
     printf("[INFO] Lookup table specified at %s\n\n", conf.all_sboxes[i].c_str());
     start = omp_get_wtime();
+    workers_reset_usage();
     res = run(conf);
     end = omp_get_wtime();
+    workers_print_usage();
     printf("[INFO] Total attack of file %s done in %lf seconds.\n\n", conf.all_sboxes[i].c_str(), end - start);
     fflush(stdout);
-    if (res != 0)
+    if (res != 0) {
+      release_messages();
+      workers_stop();
       return res;
-    free(conf.sbox);
+    }
+    mem_free(conf.sbox);
   }
+  release_messages();
+  workers_stop();
+  mem_report("release");
   return 0;
 }
@@ -0,0 +1,26 @@
+#!/usr/bin/env python
+
+# Little helper to pack int8 traces of 0/1 samples (e.g. the bits of the memory
+# traces serialized by Deadpool with serializechars) into bit-packed traces,
+# to be used with trace_type=b. The samples are packed 8 by byte starting with
+# the least significant bit, every trace being padded to a whole byte. The
+# configuration keeps the same number of rows and columns.
+# Usage: pack_bits.py traces rows columns packed_traces
+
+import sys
+
+in_filename=sys.argv[1]
+nrows=int(sys.argv[2])
+ncolumns=int(sys.argv[3])
+out_filename=sys.argv[4]
+
+with open(in_filename, 'rb') as fin, open(out_filename, 'wb') as fout:
+    for i in range(nrows):
+        row = bytearray(fin.read(ncolumns))
+        assert len(row) == ncolumns, "Trace %i is truncated" % i
+        packed = bytearray((ncolumns + 7) // 8)
+        for j in range(ncolumns):
+            if row[j] not in (0, 1):
+                sys.exit("Sample %i of trace %i is neither 0 nor 1" % (j, i))
+            packed[j >> 3] |= row[j] << (j & 7)
+        fout.write(packed)
@@ -0,0 +1,355 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#include <math.h>
+#include <string.h>
+#include <random>
+#include "pca.h"
+#include "loader.h"
+#include "workers.h"
+
+#define PCA_SEED        0x5eed
+#define PCA_MAX_ITER    200
+#define PCA_TOLERANCE   1e-10
+
+/* Structure used by the threads working on a slice of rows: the rows n,
+ * n + n_threads, ... for the covariance (triangular, hence interleaved), and
+ * a contiguous slice otherwise.
+ */
+struct PcaRows {
+
+  double ** a;
+  double ** b;
+  double ** c;
+  const double * mean;
+  int n_rows;
+  int n_columns;
+  int depth;
+  int start;
+  int length;
+  int step;
+
+  PcaRows(double ** x, double ** y, double ** z, const double * m, int nr, int nc, int d, int st, int len, int sp):
+    a(x), b(y), c(z), mean(m), n_rows(nr), n_columns(nc), depth(d), start(st), length(len), step(sp) {
+  }
+};
+
+/* Splits the n rows among n_threads threads, interleaved or in slices.
+ */
+static vector<PcaRows> split_rows(double ** a, double ** b, double ** c, const double * mean, int n, int n_columns, int depth, int n_threads, bool interleaved)
+{
+  vector<PcaRows> args;
+  int workload;
+
+  n_threads = max(1, min(n_threads, n));
+  workload = n / n_threads;
+  for (int t = 0; t < n_threads; t++) {
+    if (interleaved)
+      args.push_back(PcaRows(a, b, c, mean, n, n_columns, depth, t, n, n_threads));
+    else
+      args.push_back(PcaRows(a, b, c, mean, n, n_columns, depth, t*workload, workload + ((t + 1) / n_threads) * (n % n_threads), 1));
+  }
+  return args;
+}
+
+/* c[i][j] = a[i] . a[j] / (depth - 1) for j >= i, where the rows of a are the
+ * centered samples of the training traces. Four rows are handled at once so
+ * that every row j is read once for all of them.
+ */
+static void * covariance_rows(void * args_in)
+{
+  PcaRows * P = (PcaRows *) args_in;
+  int i, j, t, r, n_blk;
+  double s[4];
+
+  for (i = P->start * 4; i < P->n_rows; i += P->step * 4) {
+    n_blk = min(4, P->n_rows - i);
+    for (j = i; j < P->n_rows; j++) {
+      for (r = 0; r < n_blk; r++) {
+        double acc = 0;
+        const double * x = P->a[i + r], * y = P->a[j];
+        for (t = 0; t < P->depth; t++)
+          acc += x[t] * y[t];
+        s[r] = acc;
+      }
+      for (r = 0; r < n_blk; r++) {
+        if (j >= i + r)
+          P->c[i + r][j] = s[r] / (P->depth - 1);
+      }
+    }
+  }
+  return NULL;
+}
+
+/* c = a * b, with a of n_rows x depth and b of depth x n_columns.
+ */
+static void * multiply_rows(void * args_in)
+{
+  PcaRows * P = (PcaRows *) args_in;
+  int i, j, t;
+
+  for (i = P->start; i < P->start + P->length; i++) {
+    double * z = P->c[i];
+    memset(z, 0, P->n_columns * sizeof(double));
+    for (t = 0; t < P->depth; t++) {
+      double x = P->a[i][t];
+      const double * y = P->b[t];
+      for (j = 0; j < P->n_columns; j++)
+        z[j] += x * y[j];
+    }
+  }
+  return NULL;
+}
+
+/* Accumulates the projection of a chunk: for the components i of the slice,
+ * c[i][t] += sum_k a[i][k] * (b[k][t] - mean[k]) over the depth samples of
+ * the chunk and the n_columns traces.
+ */
+static void * project_rows(void * args_in)
+{
+  PcaRows * P = (PcaRows *) args_in;
+  int i, k, t;
+
+  for (i = P->start; i < P->start + P->length; i++) {
+    double * z = P->c[i];
+    for (k = 0; k < P->depth; k++) {
+      double w = P->a[i][k], m = P->mean[k];
+      const double * y = P->b[k];
+      for (t = 0; t < P->n_columns; t++)
+        z[t] += w * (y[t] - m);
+    }
+  }
+  return NULL;
+}
+
+/* Orthonormalizes the columns of q (n x k) with the modified Gram-Schmidt
+ * process.
+ */
+static void orthonormalize(double ** q, int n, int k)
+{
+  int i, j, r;
+  double d, norm;
+
+  for (i = 0; i < k; i++) {
+    for (j = 0; j < i; j++) {
+      d = 0;
+      for (r = 0; r < n; r++)
+        d += q[r][i] * q[r][j];
+      for (r = 0; r < n; r++)
+        q[r][i] -= d * q[r][j];
+    }
+    norm = 0;
+    for (r = 0; r < n; r++)
+      norm += q[r][i] * q[r][i];
+    norm = sqrt(norm);
+    for (r = 0; r < n; r++)
+      q[r][i] = norm > 0 ? q[r][i] / norm : 0;
+  }
+}
+
+/* Loads the n_load samples starting at first of the selected traces into
+ * x, chunk by chunk.
+ */
+  template <class TypeTrace>
+static int load_samples(Config & conf, double ** x, int first, int n_load, int chunk)
+{
+  int res;
+  TraceLoader<TypeTrace> loader(conf, chunk);
+
+  res = loader.init();
+  for (int s = 0; s < n_load && res == 0; s += chunk)
+    res = loader.load(x, s, first + s, min(chunk, n_load - s));
+  return res;
+}
+
+  template <class TypeTrace>
+int pca_project(Config & conf)
+{
+  int res, i, j, k, it,
+      n = conf.n_samples,
+      n_comp = conf.pca_components,
+      n_train = min(conf.pca_train, conf.n_traces),
+      x_rows = n,
+      chunk;
+  double ** x = NULL, ** cov = NULL, ** q = NULL, ** z = NULL, ** w = NULL,
+         ** proj = NULL,
+         * mean = NULL, total = 0, kept = 0, diff;
+  vector<int> trace_index = conf.trace_index;
+  int n_traces = conf.n_traces;
+  vector<PcaRows> args;
+
+  if (n_comp > n || n_comp > n_train - 1) {
+    fprintf(stderr, "[ERROR] %i components out of %i samples and %i training traces.\n", n_comp, n, n_train);
+    return -1;
+  }
+  if (((double) n * n + (double) n * n_train + 2.0 * n * n_comp) * sizeof(double) > 0.6 * conf.memory) {
+    fprintf(stderr, "[ERROR] Not enough memory for the covariance of %i samples.\n", n);
+    return -1;
+  }
+  printf("[PCA] Covariance of %i samples over %i traces.\n", n, n_train);
+  fflush(stdout);
+
+  chunk = min(n, max(1, get_ncol<TypeTrace>(conf.memory - (long int) (n * (n + n_train) * sizeof(double)), conf.total_n_traces)));
+
+  res = allocate_matrix(&x, n, n_train);
+  res |= allocate_matrix(&cov, n, n);
+  res |= allocate_matrix(&q, n, n_comp);
+  res |= allocate_matrix(&z, n, n_comp);
+  res |= allocate_matrix(&w, n_comp, n);
+  mean = (double *) calloc(n, sizeof(double));
+  if (res != 0 || mean == NULL) {
+    fprintf(stderr, "[ERROR] Allocating memory for the PCA.\n");
+    res = -1;
+    goto end;
+  }
+
+  /* The training traces are the first n_train selected ones.
+   */
+  if (!conf.trace_index.empty())
+    conf.trace_index.resize(n_train);
+  conf.n_traces = n_train;
+  res = load_samples<TypeTrace>(conf, x, 0, n, chunk);
+  conf.trace_index = trace_index;
+  conf.n_traces = n_traces;
+  if (res != 0)
+    goto end;
+
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < n_train; j++)
+      mean[i] += x[i][j];
+    mean[i] /= n_train;
+    for (j = 0; j < n_train; j++)
+      x[i][j] -= mean[i];
+  }
+
+  args = split_rows(x, NULL, cov, NULL, (n + 3) / 4 * 4, 0, n_train, conf.n_threads, true);
+  for (size_t t = 0; t < args.size(); t++)
+    args[t].n_rows = n;
+  res = workers_run(covariance_rows, args);
+  if (res != 0)
+    goto end;
+  for (i = 0; i < n; i++) {
+    total += cov[i][i];
+    for (j = 0; j < i; j++)
+      cov[i][j] = cov[j][i];
+  }
+
+  /* Subspace iteration from a random basis, until the basis is stable.
+   */
+  {
+    mt19937 rng(PCA_SEED);
+    normal_distribution<double> d(0, 1);
+    for (i = 0; i < n; i++)
+      for (k = 0; k < n_comp; k++)
+        q[i][k] = d(rng);
+    orthonormalize(q, n, n_comp);
+  }
+  args = split_rows(cov, q, z, NULL, n, n_comp, n, conf.n_threads, false);
+  for (it = 0; it < PCA_MAX_ITER; it++) {
+    res = workers_run(multiply_rows, args);
+    if (res != 0)
+      goto end;
+    orthonormalize(z, n, n_comp);
+    diff = 0;
+    for (i = 0; i < n; i++)
+      for (k = 0; k < n_comp; k++)
+        diff += (fabs(z[i][k]) - fabs(q[i][k])) * (fabs(z[i][k]) - fabs(q[i][k]));
+    swap(q, z);
+    for (size_t t = 0; t < args.size(); t++) {
+      args[t].b = q;
+      args[t].c = z;
+    }
+    if (diff < PCA_TOLERANCE)
+      break;
+  }
+
+  /* The variance along each component is q_k' * cov * q_k.
+   */
+  res = workers_run(multiply_rows, args);
+  if (res != 0)
+    goto end;
+  for (k = 0; k < n_comp; k++) {
+    for (i = 0; i < n; i++) {
+      w[k][i] = q[i][k];
+      kept += q[i][k] * z[i][k];
+    }
+  }
+  printf("[PCA] %i components keep %.2f%% of the variance (%i iterations).\n", n_comp, total > 0 ? 100 * kept / total : 0, min(it + 1, PCA_MAX_ITER));
+  free_matrix(&x, n);
+  free_matrix(&cov, n);
+  x = cov = NULL;
+
+  /* We project all the selected traces, chunk by chunk.
+   */
+  x_rows = chunk;
+  res = allocate_matrix(&x, chunk, conf.n_traces);
+  res |= allocate_matrix(&proj, n_comp, conf.n_traces, MEM_TRACES);
+  if (res != 0) {
+    fprintf(stderr, "[ERROR] Allocating memory for the PCA.\n");
+    res = -1;
+    goto end;
+  }
+  for (k = 0; k < n_comp; k++)
+    memset(proj[k], 0, conf.n_traces * sizeof(double));
+  {
+    TraceLoader<TypeTrace> loader(conf, chunk);
+    res = loader.init();
+    for (int s = 0; s < n && res == 0; s += chunk) {
+      int n_load = min(chunk, n - s);
+      res = loader.load(x, 0, s, n_load);
+      if (res != 0)
+        break;
+      vector<double *> w_chunk(n_comp);
+      for (k = 0; k < n_comp; k++)
+        w_chunk[k] = w[k] + s;
+      args = split_rows(&w_chunk[0], x, proj, mean + s, n_comp, conf.n_traces, n_load, conf.n_threads, false);
+      res = workers_run(project_rows, args);
+    }
+  }
+  if (res != 0)
+    goto end;
+
+  conf.projected = proj;
+  proj = NULL;
+  conf.n_samples = n_comp;
+  if (conf.window > conf.n_samples)
+    conf.window = conf.n_samples;
+  printf("[PCA] %i traces projected on %i components.\n\n", conf.n_traces, n_comp);
+
+end:
+  if (x != NULL)
+    free_matrix(&x, x_rows);
+  if (cov != NULL)
+    free_matrix(&cov, n);
+  if (q != NULL)
+    free_matrix(&q, n);
+  if (z != NULL)
+    free_matrix(&z, n);
+  if (w != NULL)
+    free_matrix(&w, n_comp);
+  if (proj != NULL)
+    free_matrix(&proj, n_comp);
+  free(mean);
+  return res;
+}
+
+template int pca_project<float>(Config & conf);
+template int pca_project<double>(Config & conf);
+template int pca_project<int8_t>(Config & conf);
@@ -0,0 +1,36 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#ifndef PCA_H
+#define PCA_H
+
+#include "utils.h"
+
+/* Principal component analysis of the traces. The covariance of the time
+ * samples is computed over the first pca_train selected traces, and all the
+ * selected traces are then projected on its pca_components main eigenvectors.
+ * The projection is accumulated chunk by chunk while the traces are loaded
+ * and kept in conf.projected, from which the attacks then load their chunks:
+ * the logical sample s becomes the component s.
+ */
+template <class TypeTrace>
+int pca_project(Config & conf);
+
+#endif
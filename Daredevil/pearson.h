@@ -22,8 +22,150 @@
 #define PEARSON_H
 
 #include <math.h>
+#include <stdint.h>
+#ifdef __AVX512VPOPCNTDQ__
+#include <immintrin.h>
+#endif
 
+/* Dot product of the guesses and of integer traces. The products are summed
+ * exactly in 32 bits integers over blocks too short to overflow, which the
+ * compiler vectorizes much better than the products of doubles.
+ */
+  template <class Type2>
+static inline double dot_product_int(const uint8_t * t_hypot, const Type2 * t_real, int length, int block)
+{
+  double acc = 0.0;
 
+  for (int i = 0; i < length; i += block) {
+    int32_t sum = 0;
+    int end = length - i < block ? length : i + block;
+    for (int j = i; j < end; j++)
+      sum += (int32_t) t_hypot[j] * t_real[j];
+    acc += sum;
+  }
+  return acc;
+}
+
+  template <class Type1, class Type2, class Type3>
+static inline void dot_product(const Type3 * t_hypot, const Type2 * t_real, int length, Type1 & sum_prod)
+{
+  for(int i = 0; i < length; i++) {
+    sum_prod += (Type1) t_hypot[i] * (Type1) t_real[i];
+  }
+}
+
+/* 255 * 128 * 65536 and 255 * 32768 * 256 both fit in 31 bits.
+ */
+static inline void dot_product(const uint8_t * t_hypot, const int8_t * t_real, int length, double & sum_prod)
+{
+  sum_prod = dot_product_int(t_hypot, t_real, length, 65536);
+}
+
+static inline void dot_product(const uint8_t * t_hypot, const int16_t * t_real, int length, double & sum_prod)
+{
+  sum_prod = dot_product_int(t_hypot, t_real, length, 256);
+}
+
+/* Number of bits set in a row of length packed bits, whose bits past length
+ * are 0.
+ */
+static inline int count_bits(const uint64_t * x, int length)
+{
+  int n = 0;
+
+  for (int w = 0; w < (length + 63) / 64; w++)
+    n += __builtin_popcountll(x[w]);
+  return n;
+}
+
+/* Number of traces set in both rows x and y of length packed bits, i.e. the
+ * dot product of two rows of bits. Counts 512 bits at a time when the
+ * compiler targets AVX-512 VPOPCNTDQ, e.g. with -march=native.
+ */
+static inline int count_and_bits(const uint64_t * x, const uint64_t * y, int length)
+{
+  int n = 0,
+      w = 0,
+      n_words = (length + 63) / 64;
+
+#ifdef __AVX512VPOPCNTDQ__
+  __m512i acc = _mm512_setzero_si512();
+  for (; w + 8 <= n_words; w += 8)
+    acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_and_si512(_mm512_loadu_si512(x + w), _mm512_loadu_si512(y + w))));
+  n = _mm512_reduce_add_epi64(acc);
+#endif
+  for (; w < n_words; w++)
+    n += __builtin_popcountll(x[w] & y[w]);
+  return n;
+}
+
+/* Number of keys whose dot products dot_products_table accumulates together,
+ * in registers.
+ */
+#define KEY_TILE 32
+
+/* Dot products of t_real with the guesses of the n_keys keys, generated from
+ * the input x[i] of every trace and the guesses of all the keys for every
+ * input, table[v * n_keys + k], instead of read from a matrix of n_keys
+ * rows. The keys are taken KEY_TILE at a time, the guesses of a tile for the
+ * input of a trace being contiguous. The products of integers are summed
+ * exactly, as by dot_product_int.
+ */
+  template <class Type1, class Type2, class Type3>
+static inline void dot_products_table(const uint16_t * x, const Type3 * table, const Type2 * t_real, int length, int n_keys, Type1 * sum_prod)
+{
+  for (int k = 0; k < n_keys; k += KEY_TILE) {
+    int n = n_keys - k < KEY_TILE ? n_keys - k : KEY_TILE;
+    Type1 acc[KEY_TILE] = {0};
+    if (n == KEY_TILE) {
+      for (int i = 0; i < length; i++) {
+        const Type3 * g = table + x[i] * n_keys + k;
+        Type1 t = (Type1) t_real[i];
+        for (int kk = 0; kk < KEY_TILE; kk++)
+          acc[kk] += (Type1) g[kk] * t;
+      }
+    } else {
+      for (int i = 0; i < length; i++) {
+        const Type3 * g = table + x[i] * n_keys + k;
+        Type1 t = (Type1) t_real[i];
+        for (int kk = 0; kk < n; kk++)
+          acc[kk] += (Type1) g[kk] * t;
+      }
+    }
+    for (int kk = 0; kk < n; kk++)
+      sum_prod[k + kk] = acc[kk];
+  }
+}
+
+/* Dot products of t_real with the guesses of the n_keys keys, read from the
+ * rows of guess or, when table is not NULL, generated from the inputs x by
+ * dot_products_table. Every product is summed in a local: sum_prod may alias
+ * the guesses for the compiler, which would then store and reload the sum at
+ * every trace instead of vectorizing the loop.
+ */
+  template <class Type1, class Type2, class Type3>
+static inline void dot_products(Type3 * const * guess, const uint16_t * x, const Type3 * table, const Type2 * t_real, int length, int n_keys, Type1 * sum_prod)
+{
+  if (table != NULL) {
+    dot_products_table(x, table, t_real, length, n_keys, sum_prod);
+    return;
+  }
+  for (int k = 0; k < n_keys; k++) {
+    Type1 acc = 0;
+    dot_product(guess[k], t_real, length, acc);
+    sum_prod[k] = acc;
+  }
+}
+
+/* Computes the correlation of two vectors given the sum of their products
+ * and the precomputed values sum_* and std_dev_*.
+ */
+  template <class Type1>
+static inline Type1 pearson_sums(Type1 sum_prod, Type1 sum_hypot, Type1 std_dev_hypot, Type1 sum_real, Type1 std_dev_real, int length)
+{
+  return length * (( sum_prod - (sum_hypot * sum_real)/length ) /
+   (std_dev_hypot * std_dev_real));
+}
 
 /* Computes the correlation between the vectors t_hypot and t_real, given the
  * precomputed values sum_* and std_dev_*, using the single pass approach. The
@@ -34,13 +176,9 @@ Type1 pearson_v_2_2(Type3 t_hypot[], Type1 sum_hypot, Type1 std_dev_hypot, Type2
 {
   Type1 sum_prod = 0.0;
 
-  for(int i = 0; i < length; i++) {
-    sum_prod += (Type1) t_hypot[i] * (Type1) t_real[i];
-  }
-
-  return length * (( sum_prod - (sum_hypot * sum_real)/length ) /
-   (std_dev_hypot * std_dev_real));
+  dot_product(t_hypot, t_real, length, sum_prod);
 
+  return pearson_sums(sum_prod, sum_hypot, std_dev_hypot, sum_real, std_dev_real, length);
 }
 
 #endif
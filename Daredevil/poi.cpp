@@ -0,0 +1,151 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#include <random>
+#include "poi.h"
+#include "loader.h"
+
+#define POI_SEED 0x5eed
+
+int poi_coarse(Config & conf, PoiState & state)
+{
+  vector<int> all;
+
+  state.trace_index = conf.trace_index;
+  state.n_traces = conf.n_traces;
+  state.n_samples = conf.n_samples;
+  state.window = conf.window;
+  state.sample_ranges = conf.sample_ranges;
+
+  if (conf.poi_subset >= conf.n_traces) {
+    fprintf(stderr, "[WARNING] poi_subset (%i) >= number of traces (%i), using all of them.\n", conf.poi_subset, conf.n_traces);
+  } else {
+    /* Partial Fisher-Yates shuffle of the selected traces, with a fixed seed
+     * so that the runs can be reproduced.
+     */
+    if (conf.trace_index.empty()) {
+      for (int j = 0; j < conf.n_traces; j++)
+        all.push_back(j);
+    } else {
+      all = conf.trace_index;
+    }
+    mt19937 rng(POI_SEED);
+    for (int j = 0; j < conf.poi_subset; j++) {
+      uniform_int_distribution<int> d(j, all.size() - 1);
+      swap(all[j], all[d(rng)]);
+    }
+    all.resize(conf.poi_subset);
+    sort(all.begin(), all.end());
+    conf.trace_index = all;
+    conf.n_traces = conf.poi_subset;
+  }
+
+  conf.sample_score = (double *) calloc(conf.n_samples, sizeof(double));
+  if (conf.sample_score == NULL) {
+    fprintf(stderr, "[ERROR] Allocating memory for the sample scores.\n");
+    return -1;
+  }
+  printf("[POI] Coarse pass on %i traces and %i samples, its rankings are not reported.\n\n", conf.n_traces, conf.n_samples);
+  fflush(stdout);
+  return 0;
+}
+
+int poi_fine(Config & conf, PoiState & state)
+{
+  vector<pair<double, int> > best;
+  vector<int> points;
+  vector<pair<int, int> > ranges;
+
+  for (int s = 0; s < conf.n_samples; s++)
+    best.push_back(make_pair(conf.sample_score[s], s));
+  sort(best.rbegin(), best.rend());
+
+  /* The strongest samples, each one at least poi_margin samples away from
+   * the ones already selected, so that one leakage does not take all the
+   * windows.
+   */
+  for (size_t i = 0; i < best.size() && (int) points.size() < conf.poi_count; i++) {
+    bool close = false;
+    for (size_t p = 0; p < points.size() && !close; p++)
+      close = abs(points[p] - best[i].second) <= conf.poi_margin;
+    if (!close)
+      points.push_back(best[i].second);
+  }
+  sort(points.begin(), points.end());
+
+  printf("[POI] Points of interest:");
+  for (size_t p = 0; p < points.size(); p++)
+    printf(" %i", sample_index(conf, points[p]));
+  printf("\n");
+
+  /* The windows are taken in the logical samples of the coarse pass and
+   * merged, then translated into ranges of the files.
+   */
+  int first = -1, last = -1;
+  for (size_t p = 0; p <= points.size(); p++) {
+    int lo = 0, hi = 0;
+    if (p < points.size()) {
+      lo = max(0, points[p] - conf.poi_margin);
+      hi = min(conf.n_samples - 1, points[p] + conf.poi_margin);
+      if (first != -1 && lo <= last + 1) {
+        last = max(last, hi);
+        continue;
+      }
+    }
+    for (int s = first; first != -1 && s <= last; s++) {
+      int idx = sample_index(conf, s);
+      if (!ranges.empty() && ranges.back().first + ranges.back().second * conf.pool_stride == idx)
+        ranges.back().second++;
+      else
+        ranges.push_back(make_pair(idx, 1));
+    }
+    first = lo;
+    last = hi;
+  }
+
+  free(conf.sample_score);
+  conf.sample_score = NULL;
+  conf.trace_index = state.trace_index;
+  conf.n_traces = state.n_traces;
+  conf.sample_ranges = ranges;
+  conf.n_samples = 0;
+  for (size_t r = 0; r < ranges.size(); r++)
+    conf.n_samples += ranges[r].second;
+  if (conf.window > conf.n_samples)
+    conf.window = conf.n_samples;
+
+  if (conf.n_samples == 0) {
+    fprintf(stderr, "[ERROR] No point of interest found.\n");
+    return -1;
+  }
+  printf("[POI] Fine pass on %i traces and %i samples in %lu windows.\n\n", conf.n_traces, conf.n_samples, ranges.size());
+  return 0;
+}
+
+void poi_restore(Config & conf, PoiState & state)
+{
+  free(conf.sample_score);
+  conf.sample_score = NULL;
+  conf.trace_index = state.trace_index;
+  conf.n_traces = state.n_traces;
+  conf.n_samples = state.n_samples;
+  conf.window = state.window;
+  conf.sample_ranges = state.sample_ranges;
+}
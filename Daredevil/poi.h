@@ -0,0 +1,57 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#ifndef POI_H
+#define POI_H
+
+#include "utils.h"
+
+/* Coarse-to-fine localization of the points of interest. The attack is first
+ * run on a random subset of the traces over all the samples, the strongest
+ * samples are then selected and the attack is run again with all the traces,
+ * only on the windows around these samples.
+ */
+
+/* The part of the configuration modified by the localization.
+ */
+struct PoiState {
+
+  vector<int> trace_index;
+  int n_traces;
+  int n_samples;
+  int window;
+  vector<pair<int, int> > sample_ranges;
+};
+
+/* Selects poi_subset random traces and starts recording the score of the
+ * samples. The configuration is saved in state.
+ */
+int poi_coarse(Config & conf, PoiState & state);
+
+/* Selects the windows around the poi_count best samples of the coarse pass,
+ * with all the traces.
+ */
+int poi_fine(Config & conf, PoiState & state);
+
+/* Restores the configuration saved in state.
+ */
+void poi_restore(Config & conf, PoiState & state);
+
+#endif
@@ -0,0 +1,196 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#include <math.h>
+#include <limits>
+#include <string.h>
+#include "quality.h"
+#include "loader.h"
+#include "workers.h"
+
+/* Statistics of one trace.
+ */
+struct TraceQuality {
+
+  double energy;
+  int n_clipped;
+  bool finite;
+};
+
+/* Structure used by the threads computing the statistics of a slice of the
+ * traces of a batch.
+ */
+template <class TypeTrace>
+struct QualityTraces {
+
+  TypeTrace ** rows;
+  int n_columns;
+  int start;
+  int end;
+  double clip_low;
+  double clip_high;
+  TraceQuality * quality;
+
+  QualityTraces(TypeTrace ** r, int nc, int st, int e, double lo, double hi, TraceQuality * q):
+    rows(r), n_columns(nc), start(st), end(e), clip_low(lo), clip_high(hi), quality(q) {
+  }
+};
+
+/* NaN and infinite values have all the bits of the exponent set. The bits
+ * are checked directly, since the compiler may assume finite values.
+ */
+static inline bool not_finite(double v)
+{
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return ((bits >> 52) & 0x7ff) == 0x7ff;
+}
+
+  template <class TypeTrace>
+static void * quality_slice(void * args_in)
+{
+  QualityTraces<TypeTrace> * Q = (QualityTraces<TypeTrace> *) args_in;
+
+  for (int j = Q->start; j < Q->end; j++) {
+    const TypeTrace * x = Q->rows[j];
+    double e = 0;
+    int c = 0, nf = 0;
+    for (int i = 0; i < Q->n_columns; i++) {
+      double v = x[i];
+      e += v * v;
+      c += (v <= Q->clip_low) | (v >= Q->clip_high);
+      nf |= not_finite(v);
+    }
+    Q->quality[j].energy = e / Q->n_columns;
+    Q->quality[j].n_clipped = c;
+    Q->quality[j].finite = !nf;
+  }
+  return NULL;
+}
+
+static double median(vector<double> v)
+{
+  size_t m = v.size() / 2;
+  nth_element(v.begin(), v.begin() + m, v.end());
+  return v[m];
+}
+
+  template <class TypeTrace>
+int filter_traces(Config & conf)
+{
+  int res, n, n_threads, workload, batch,
+      first = sample_index(conf, 0),
+      length = sample_index(conf, conf.n_samples - 1) + conf.pool_window - first,
+      row_offset = 0,
+      n_nan = 0, n_clip = 0, n_outlier = 0;
+  double clip_low = -numeric_limits<double>::infinity(),
+         clip_high = numeric_limits<double>::infinity(),
+         med, mad;
+  TypeTrace ** rows = NULL;
+  vector<TraceQuality> quality(conf.total_n_traces);
+  vector<int> selected, kept;
+  vector<double> energy;
+
+  /* int8 traces clip on the rails of the ADC, the other types on the level
+   * given in the configuration.
+   */
+  if (conf.type_trace == 'i') {
+    clip_low = -128;
+    clip_high = 127;
+  }
+  if (conf.quality_clip > 0) {
+    clip_low = -conf.quality_clip;
+    clip_high = conf.quality_clip;
+  }
+
+  batch = max(1, min(4096, (int) (0.6 * conf.memory / ((double) length * sizeof(TypeTrace)))));
+  res = allocate_matrix(&rows, batch, length);
+  if (res != 0) {
+    fprintf(stderr, "[ERROR] Allocating memory for the trace filter.\n");
+    return -1;
+  }
+
+  for (int f = 0; f < conf.n_file_trace; f++) {
+    for (int b = 0; b < (int) conf.traces[f].n_rows; b += batch) {
+      int n_rows = min(batch, (int) conf.traces[f].n_rows - b);
+      if (fload(conf.traces[f].filename, &rows, n_rows, b, length, first, conf.traces[f].n_columns) != (size_t) n_rows * length) {
+        fprintf(stderr, "[ERROR] Loading the traces to filter.\n");
+        return -1;
+      }
+
+      n_threads = max(1, min(conf.n_threads, n_rows));
+      workload = n_rows / n_threads;
+      vector<QualityTraces<TypeTrace> > ta;
+      ta.reserve(n_threads);
+      for (n = 0; n < n_threads; n++) {
+        ta.push_back(QualityTraces<TypeTrace>(rows, length, n*workload, n == n_threads - 1 ? n_rows : (n + 1)*workload, clip_low, clip_high, &quality[row_offset + b]));
+      }
+      res = workers_run(quality_slice<TypeTrace>, ta);
+      if (res != 0)
+        return -1;
+    }
+    row_offset += conf.traces[f].n_rows;
+  }
+  free_matrix(&rows, batch);
+
+  if (conf.trace_index.empty()) {
+    for (int j = 0; j < conf.n_traces; j++)
+      selected.push_back(j);
+  } else {
+    selected = conf.trace_index;
+  }
+
+  /* The robust statistics of the energy are taken over the valid traces.
+   */
+  for (size_t j = 0; j < selected.size(); j++) {
+    if (quality[selected[j]].finite)
+      energy.push_back(quality[selected[j]].energy);
+  }
+  med = energy.empty() ? 0 : median(energy);
+  for (size_t j = 0; j < energy.size(); j++)
+    energy[j] = fabs(energy[j] - med);
+  mad = energy.empty() ? 0 : median(energy);
+
+  for (size_t j = 0; j < selected.size(); j++) {
+    TraceQuality & q = quality[selected[j]];
+    if (!q.finite)
+      n_nan++;
+    else if (q.n_clipped > conf.quality_clip_ratio * length)
+      n_clip++;
+    else if (mad > 0 && 0.6745 * fabs(q.energy - med) / mad > conf.quality_z)
+      n_outlier++;
+    else
+      kept.push_back(selected[j]);
+  }
+
+  printf("[FILTER] %lu traces rejected: %i with NaN or Inf, %i clipped, %i outliers.\n\n", selected.size() - kept.size(), n_nan, n_clip, n_outlier);
+  if (kept.size() < 2) {
+    fprintf(stderr, "[ERROR] Not enough traces left after the filter.\n");
+    return -1;
+  }
+  if (kept.size() < selected.size() || !conf.trace_index.empty())
+    conf.trace_index = kept;
+  conf.n_traces = kept.size();
+  return 0;
+}
+
+template int filter_traces<float>(Config & conf);
+template int filter_traces<double>(Config & conf);
+template int filter_traces<int8_t>(Config & conf);
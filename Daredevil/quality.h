@@ -0,0 +1,36 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include "utils.h"
+
+/* Rejection of the corrupted traces. The attacked samples of every selected
+ * trace are read once, and a trace is rejected if it holds a NaN or an
+ * infinite value, if more than quality_clip_ratio of its samples are clipped,
+ * or if the robust z-score (median and median absolute deviation) of its
+ * energy exceeds quality_z. The rejected traces are removed from
+ * conf.trace_index, which all the engines and the guesses follow.
+ */
+template <class TypeTrace>
+int filter_traces(Config & conf);
+
+#endif
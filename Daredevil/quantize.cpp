@@ -0,0 +1,137 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#include <math.h>
+#include <float.h>
+#include "quantize.h"
+#include "loader.h"
+
+  template <class TypeTrace>
+int quantize_traces(Config & conf)
+{
+  int res = 0, i, j, s, n_load,
+      n = conf.n_samples,
+      n_train = min(conf.quant_train, conf.n_traces),
+      worst = 0,
+      chunk;
+  double top = (1 << (conf.quant_bits - 1)) - 1,
+         lo = DBL_MAX, hi = -DBL_MAX,
+         total_var = 0, total_noise = 0, worst_loss = 0;
+  double ** x = NULL;
+  TraceLoader<TypeTrace> * loader = NULL;
+  vector<double> low(n, DBL_MAX), high(n, -DBL_MAX);
+  vector<int> trace_index = conf.trace_index;
+  int n_traces = conf.n_traces;
+
+  chunk = min(n, max(1, get_ncol<double>(conf.memory, n_train)));
+  res = allocate_matrix(&x, chunk, n_train);
+  if (res != 0) {
+    fprintf(stderr, "[ERROR] Allocating memory for the quantization.\n");
+    return -1;
+  }
+
+  /* The training traces are the first n_train selected ones.
+   */
+  if (!conf.trace_index.empty())
+    conf.trace_index.resize(n_train);
+  conf.n_traces = n_train;
+
+  loader = new TraceLoader<TypeTrace>(conf, chunk);
+  res = loader->init();
+  for (s = 0; s < n && res == 0; s += chunk) {
+    n_load = min(chunk, n - s);
+    res = loader->load(x, 0, s, n_load);
+    for (i = 0; i < n_load && res == 0; i++) {
+      for (j = 0; j < n_train; j++) {
+        low[s + i] = min(low[s + i], x[i][j]);
+        high[s + i] = max(high[s + i], x[i][j]);
+      }
+      lo = min(lo, low[s + i]);
+      hi = max(hi, high[s + i]);
+    }
+  }
+  if (res != 0)
+    goto end;
+
+  /* The range [low, high] is mapped on [-top, top].
+   */
+  conf.quant_offset.resize(n);
+  conf.quant_gain.resize(n);
+  for (s = 0; s < n; s++) {
+    double l = conf.quant_per_sample ? low[s] : lo,
+           h = conf.quant_per_sample ? high[s] : hi;
+    conf.quant_offset[s] = (h + l) / 2;
+    conf.quant_gain[s] = h > l ? 2 * top / (h - l) : 1;
+  }
+
+  /* The loss of SNR of a sample is 1 + noise / variance, the quantization
+   * noise being independent from the signal.
+   */
+  for (s = 0; s < n && res == 0; s += chunk) {
+    n_load = min(chunk, n - s);
+    res = loader->load(x, 0, s, n_load);
+    for (i = 0; i < n_load && res == 0; i++) {
+      double g = conf.quant_gain[s + i], o = conf.quant_offset[s + i],
+             sum = 0, sum_sq = 0, noise = 0, var, loss;
+      for (j = 0; j < n_train; j++) {
+        double q = rint((x[i][j] - o) * g), e;
+        q = q > top ? top : (q < -top ? -top : q);
+        e = x[i][j] - (q / g + o);
+        sum += x[i][j];
+        sum_sq += x[i][j] * x[i][j];
+        noise += e * e;
+      }
+      var = sum_sq / n_train - (sum / n_train) * (sum / n_train);
+      noise /= n_train;
+      total_var += var;
+      total_noise += noise;
+      loss = var > 0 ? 10 * log10(1 + noise / var) : 0;
+      if (loss > worst_loss) {
+        worst_loss = loss;
+        worst = s + i;
+      }
+    }
+  }
+  if (res != 0)
+    goto end;
+
+  printf("[QUANTIZE] int%i with %s scale over %i traces: SQNR %.1f dB, SNR loss %.4f dB (at most %.4f dB at sample %i).\n\n",
+      conf.quant_bits, conf.quant_per_sample ? "per sample" : "a global", n_train,
+      10 * log10(total_var / max(total_noise, DBL_MIN)),
+      10 * log10(1 + (total_var > 0 ? total_noise / total_var : 0)),
+      worst_loss, sample_index(conf, worst));
+  fflush(stdout);
+
+end:
+  delete loader;
+  conf.trace_index = trace_index;
+  conf.n_traces = n_traces;
+  free_matrix(&x, chunk);
+  if (res != 0) {
+    conf.quant_offset.clear();
+    conf.quant_gain.clear();
+    fprintf(stderr, "[ERROR] Loading the traces to quantize.\n");
+  }
+  return res;
+}
+
+template int quantize_traces<float>(Config & conf);
+template int quantize_traces<double>(Config & conf);
+template int quantize_traces<int8_t>(Config & conf);
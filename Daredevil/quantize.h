@@ -0,0 +1,37 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include "utils.h"
+
+/* Computes the quantization of float traces to quant_bits integers. The
+ * range of every sample (or of all of them with a global scale) is measured
+ * over the first quant_train selected traces and mapped on the symmetric
+ * integer range, the samples out of it saturating. The resulting scales are
+ * stored in conf.quant_gain and conf.quant_offset, used by the loader, and
+ * the loss of signal-to-noise ratio due to the quantization noise measured
+ * on the same traces is reported.
+ */
+template <class TypeTrace>
+int quantize_traces(Config & conf);
+
+#endif
@@ -1,5 +1,6 @@
 #include "utils.h"
 #include "sm4.h"
+#include "guess.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,14 +37,15 @@ static uint8_t HW(uint8_t v)
  * @param n_keys 输入：密钥猜测空间大小（必须为256）
  * @param bit 输入：计算模式（-1=汉明重量；0~7=指定比特位）
  * @param is_little_endian 输入：是否小端序存储（默认大端，符合SM4国标）
+ * @param model 输出：非NULL时只保存每条迹的输入与查表，不构造猜测矩阵
  * @return 0=成功；-1=失败
  */
 template <class TypeGuess>
 int construct_guess_SM4(TypeGuess ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum,
                         uint32_t R, uint16_t *sbox, uint32_t n_keys, int8_t bit, 
-                        bool is_little_endian) {
+                        bool is_little_endian, GuessModel<TypeGuess> *model) {
     TypeGuess **mem = NULL;
-    uint32_t i, j, nrows = 0;
+    uint32_t i, nrows = 0;
 
     // 1. 入参合法性校验
     // 1.1 轮数校验（当前仅支持轮0）
@@ -83,86 +85,73 @@ int construct_guess_SM4(TypeGuess ***guess, Matrix *m, uint32_t n_m, uint32_t by
         nrows += m[i].n_rows;
     }
 
-    // 3. 导入消息矩阵到内存
-    if (import_matrices(&mem, m, n_m, 0) < 0) {
+    // 3. 取得消息矩阵（整个运行只导入一次）
+    if (import_messages(&mem, &nrows, m, n_m) < 0) {
         fprintf(stderr, "[ERROR]: construct_guess_SM4: Failed to import matrices.\n");
         return -1;
     }
 
-    // 4. 分配猜测矩阵内存（若未初始化）
-    if (*guess == NULL) {
-        if (allocate_matrix<TypeGuess>(guess, n_keys, nrows) < 0) {
-            fprintf(stderr, "[ERROR]: construct_guess_SM4: Failed to allocate guess matrix.\n");
-            free_matrix(&mem, nrows); // 释放已分配的内存，避免泄漏
-            return -1;
-        }
-    }
-
-    // 5. 核心逻辑：构造猜测矩阵
+    // 4. 核心逻辑：构造猜测矩阵
     // SM4轮0攻击点：T(X₁⊕X₂⊕X₃⊕rk₀) = L(τ(X₁⊕X₂⊕X₃⊕rk₀))
     // 其中 τ(x) = (Sbox(a₀), Sbox(a₁), Sbox(a₂), Sbox(a₃))，攻击τ的单个字节
-    for (i = 0; i < nrows; i++) {
-        // 5.1 计算目标字节的偏移量（适配大小端）
-        uint32_t x1_offset = 1 * SM4_WORD_BYTES + bytenum; // X₁的起始偏移：4字节
-        uint32_t x2_offset = 2 * SM4_WORD_BYTES + bytenum; // X₂的起始偏移：8字节
-        uint32_t x3_offset = 3 * SM4_WORD_BYTES + bytenum; // X₃的起始偏移：12字节
-        
-        if (is_little_endian) {
-            // 小端序：32位字的字节存储顺序为 [3,2,1,0]（如X₁的字节7,6,5,4）
-            x1_offset = 1 * SM4_WORD_BYTES + (SM4_WORD_BYTES - 1 - bytenum);
-            x2_offset = 2 * SM4_WORD_BYTES + (SM4_WORD_BYTES - 1 - bytenum);
-            x3_offset = 3 * SM4_WORD_BYTES + (SM4_WORD_BYTES - 1 - bytenum);
-        }
+    // 4.1 计算目标字节的偏移量（适配大小端）
+    uint32_t x1_offset = 1 * SM4_WORD_BYTES + bytenum; // X₁的起始偏移：4字节
+    uint32_t x2_offset = 2 * SM4_WORD_BYTES + bytenum; // X₂的起始偏移：8字节
+    uint32_t x3_offset = 3 * SM4_WORD_BYTES + bytenum; // X₃的起始偏移：12字节
+
+    if (is_little_endian) {
+        // 小端序：32位字的字节存储顺序为 [3,2,1,0]（如X₁的字节7,6,5,4）
+        x1_offset = 1 * SM4_WORD_BYTES + (SM4_WORD_BYTES - 1 - bytenum);
+        x2_offset = 2 * SM4_WORD_BYTES + (SM4_WORD_BYTES - 1 - bytenum);
+        x3_offset = 3 * SM4_WORD_BYTES + (SM4_WORD_BYTES - 1 - bytenum);
+    }
 
-        // 5.2 提取X₁、X₂、X₃的目标字节
-        uint8_t x1_byte = (uint8_t)mem[i][x1_offset];
-        uint8_t x2_byte = (uint8_t)mem[i][x2_offset];
-        uint8_t x3_byte = (uint8_t)mem[i][x3_offset];
-
-        // 5.3 计算 X₁⊕X₂⊕X₃（T函数输入的前半部分）
-        uint8_t xor_result = x1_byte ^ x2_byte ^ x3_byte;
-
-        // 5.4 遍历所有密钥猜测值，构造猜测矩阵
-        for (j = 0; j < n_keys; j++) {
-            // 肖-来白盒SM4：S_ij(x) = Sbox(x ⊕ k_j)（k_j为轮密钥的单个字节）
-            uint8_t sbox_input = xor_result ^ (uint8_t)j;
-            uint8_t sbox_output = (uint8_t)sbox[sbox_input]; // S盒输出（8位）
-
-            // 根据bit参数计算猜测值
-            if (bit == -1) {
-                // 模式1：计算汉明重量
-                (*guess)[j][i] = (TypeGuess)HW(sbox_output);
-            } else {
-                // 模式2：提取指定比特位（0=最低位，7=最高位）
-                (*guess)[j][i] = (TypeGuess)((sbox_output >> bit) & 0x01);
-            }
+    // 4.2 猜测值只取决于 X₁⊕X₂⊕X₃⊕k_j，预先按S盒输出建表
+    TypeGuess lut[256];
+    for (i = 0; i < 256; i++) {
+        uint8_t sbox_output = (uint8_t)sbox[i]; // S盒输出（8位）
+        if (bit == -1) {
+            // 模式1：计算汉明重量
+            lut[i] = (TypeGuess)HW(sbox_output);
+        } else {
+            // 模式2：提取指定比特位（0=最低位，7=最高位）
+            lut[i] = (TypeGuess)((sbox_output >> bit) & 0x01);
         }
     }
 
-    // 6. 释放临时内存，避免泄漏
-    free_matrix(&mem, nrows);
-    return 0;
+    // 4.3 计算每条迹的 X₁⊕X₂⊕X₃（T函数输入的前半部分）
+    vector<uint16_t> x(nrows);
+    for (i = 0; i < nrows; i++)
+        x[i] = (uint8_t)(mem[i][x1_offset] ^ mem[i][x2_offset] ^ mem[i][x3_offset]);
+
+    // 4.4 按迹分块并行构造猜测矩阵（若未分配则先分配）：guess[j][i] = lut[x[i] ⊕ j]
+    if (model != NULL)
+        return fill_guess_model(model, &x[0], lut, 256, n_keys, nrows);
+    return fill_guess(guess, &x[0], lut, n_keys, nrows);
 }
 
 // 模板实例化（仅保留必要类型，移除冗余）
 template int construct_guess_SM4(uint8_t ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum,
                                  uint32_t R, uint16_t *sbox, uint32_t n_keys, int8_t bit,
-                                 bool is_little_endian);
+                                 bool is_little_endian, GuessModel<uint8_t> *model);
 
 template int construct_guess_SM4(int8_t ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum,
                                  uint32_t R, uint16_t *sbox, uint32_t n_keys, int8_t bit,
-                                 bool is_little_endian);
+                                 bool is_little_endian, GuessModel<int8_t> *model);
 
 // 兼容原有接口（默认大端序）
 template <class TypeGuess>
 int construct_guess_SM4(TypeGuess ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum,
-                        uint32_t R, uint16_t *sbox, uint32_t n_keys, int8_t bit) {
-    return construct_guess_SM4(guess, m, n_m, bytenum, R, sbox, n_keys, bit, false);
+                        uint32_t R, uint16_t *sbox, uint32_t n_keys, int8_t bit,
+                        GuessModel<TypeGuess> *model) {
+    return construct_guess_SM4(guess, m, n_m, bytenum, R, sbox, n_keys, bit, false, model);
 }
 
 // 原有接口的模板实例化（保证向下兼容）
 template int construct_guess_SM4(uint8_t ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum,
-                                 uint32_t R, uint16_t *sbox, uint32_t n_keys, int8_t bit);
+                                 uint32_t R, uint16_t *sbox, uint32_t n_keys, int8_t bit,
+                                 GuessModel<uint8_t> *model);
 
 template int construct_guess_SM4(int8_t ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum,
-                                 uint32_t R, uint16_t *sbox, uint32_t n_keys, int8_t bit);
\ No newline at end of file
+                                 uint32_t R, uint16_t *sbox, uint32_t n_keys, int8_t bit,
+                                 GuessModel<int8_t> *model);
\ No newline at end of file
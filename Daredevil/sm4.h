@@ -2,7 +2,8 @@
 #define SM4_H
 
 #include "utils.h"
+#include "guess.h"
 
-template <class TypeGuess> int construct_guess_SM4 (TypeGuess ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint16_t * sbox, uint32_t n_keys, int8_t bit);
+template <class TypeGuess> int construct_guess_SM4 (TypeGuess ***guess, Matrix *m, uint32_t n_m, uint32_t bytenum, uint32_t R, uint16_t * sbox, uint32_t n_keys, int8_t bit, GuessModel<TypeGuess> * model = NULL);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,243 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#include <string.h>
+#include <omp.h>
+#include "snr.h"
+#include "cpa.h"
+#include "des.h"
+#include "loader.h"
+#include "workers.h"
+
+#define SNR_CLASSES 256
+
+/* Structure used by the threads computing the SNR of a slice of the samples
+ * of a chunk.
+ */
+template <class TypeTrace>
+struct SnrSamples {
+
+  TypeTrace ** trace;
+  const uint8_t * label;
+  const double * count;
+  int n_traces;
+  int start;
+  int length;
+  double * snr;
+
+  SnrSamples(TypeTrace ** tr, const uint8_t * l, const double * c, int nt, int st, int len, double * s):
+    trace(tr), label(l), count(c), n_traces(nt), start(st), length(len), snr(s) {
+  }
+};
+
+/* The per class sums are accumulated in a single pass over the traces.
+ */
+  template <class TypeTrace>
+static void * snr_samples(void * args_in)
+{
+  SnrSamples<TypeTrace> * S = (SnrSamples<TypeTrace> *) args_in;
+  double sum[SNR_CLASSES], sq[SNR_CLASSES], mean, m, v, signal, noise, x;
+  int i, t, c;
+
+  for (i = S->start; i < S->start + S->length; i++) {
+    memset(sum, 0, sizeof(sum));
+    memset(sq, 0, sizeof(sq));
+    for (t = 0; t < S->n_traces; t++) {
+      x = S->trace[i][t];
+      sum[S->label[t]] += x;
+      sq[S->label[t]] += x * x;
+    }
+
+    mean = 0;
+    for (c = 0; c < SNR_CLASSES; c++)
+      mean += sum[c];
+    mean /= S->n_traces;
+
+    signal = noise = 0;
+    for (c = 0; c < SNR_CLASSES; c++) {
+      if (S->count[c] == 0)
+        continue;
+      m = sum[c] / S->count[c];
+      v = sq[c] / S->count[c] - m * m;
+      signal += S->count[c] * (m - mean) * (m - mean);
+      noise += S->count[c] * v;
+    }
+    S->snr[i] = noise > 0 ? signal / noise : 0;
+  }
+  return NULL;
+}
+
+/* Computes the class of every selected trace for the key byte bn, returns -1
+ * on failure.
+ */
+static int snr_labels(Config & conf, int bn, vector<uint8_t> & label)
+{
+  uint8_t ** mem = NULL;
+  int res, key = -1, n_rows = 0;
+
+  label.resize(conf.n_traces);
+
+  if (conf.snr == 'p') {
+    for (int i = 0; i < conf.n_file_guess; i++) {
+      if ((int) conf.guesses[i].n_columns <= bn) {
+        fprintf(stderr, "[ERROR] No plaintext byte %i in the guess files.\n", bn);
+        return -1;
+      }
+      n_rows += conf.guesses[i].n_rows;
+    }
+    if (import_matrices(&mem, conf.guesses, conf.n_file_guess, 0) < 0) {
+      fprintf(stderr, "[ERROR] Importing the plaintexts.\n");
+      return -1;
+    }
+    for (int j = 0; j < conf.n_traces; j++)
+      label[j] = mem[conf.trace_index.empty() ? j : conf.trace_index[j]][bn];
+    free_matrix(&mem, n_rows);
+    return 0;
+  }
+
+  /* The model values are the guesses of the correct key.
+   */
+  if (conf.key_size == 1 && conf.correct_key != -1)
+    key = conf.correct_key;
+  else if (conf.complete_correct_key != NULL)
+    key = conf.complete_correct_key[bn];
+  if (key == -1) {
+    fprintf(stderr, "[ERROR] The correct key is needed for snr=model.\n");
+    return -1;
+  }
+  if (conf.des_switch == DES_4_BITS)
+    key = get_4_middle_bits(key);
+
+  res = construct_guess(&mem, conf.algo, conf.guesses, conf.n_file_guess, bn, conf.round, conf.des_switch, conf.sbox, conf.total_n_keys, conf.bitnum >= 0 ? conf.bitnum : -1, conf.trace_index);
+  if (res < 0) {
+    fprintf(stderr, "[ERROR] Constructing guess.\n");
+    return -1;
+  }
+  for (int j = 0; j < conf.n_traces; j++)
+    label[j] = mem[key][j];
+  free_matrix(&mem, conf.total_n_keys);
+  return 0;
+}
+
+  template <class TypeTrace>
+int snr(Config & conf)
+{
+  int res, n, bn,
+      n_samples = conf.n_samples,
+      n_threads,
+      workload,
+      ncol = min(get_ncol<TypeTrace>(conf.memory, conf.n_traces), n_samples);
+  TypeTrace ** traces = NULL;
+  double * profile = NULL, count[SNR_CLASSES];
+  vector<uint8_t> label;
+  FILE * out = NULL;
+  double start, end;
+
+  if (ncol <= 0) {
+    fprintf(stderr, "[ERROR] Invalid parameters ncol(=%i).\n", ncol);
+    return -1;
+  }
+
+  TraceLoader<TypeTrace> loader(conf, ncol);
+  res = loader.init();
+  if (res != 0) {
+    fprintf(stderr, "[ERROR] Initializing the trace loader in snr.\n");
+    return -1;
+  }
+  res = allocate_matrix(&traces, ncol, conf.n_traces, MEM_TRACES);
+  profile = (double *) malloc(n_samples * sizeof(double));
+  if (res != 0 || profile == NULL) {
+    fprintf(stderr, "[ERROR] Allocating memory in snr.\n");
+    return -1;
+  }
+
+  if (conf.snr_file != "") {
+    out = fopen(conf.snr_file.c_str(), "w");
+    if (out == NULL) {
+      fprintf(stderr, "[ERROR] Opening %s.\n", conf.snr_file.c_str());
+      return -1;
+    }
+  }
+
+  for (bn = 0; bn < conf.key_size; bn++) {
+    if (conf.bytenum != -1 && conf.bytenum != bn)
+      continue;
+    start = omp_get_wtime();
+
+    res = snr_labels(conf, bn, label);
+    if (res != 0)
+      return -1;
+    memset(count, 0, sizeof(count));
+    for (int j = 0; j < conf.n_traces; j++)
+      count[label[j]]++;
+
+    for (int s = 0; s < n_samples; s += ncol) {
+      int to_load = min(ncol, n_samples - s);
+      res = loader.load(traces, 0, s, to_load);
+      if (res != 0) {
+        fprintf(stderr, "[ERROR] Loading file.\n");
+        return -1;
+      }
+
+      n_threads = min(conf.n_threads, to_load);
+      workload = to_load / n_threads;
+      vector<SnrSamples<TypeTrace> > ta;
+      ta.reserve(n_threads);
+      for (n = 0; n < n_threads; n++) {
+        ta.push_back(SnrSamples<TypeTrace>(traces, &label[0], count, conf.n_traces, n*workload, workload + ((n + 1) / n_threads) * (to_load % n_threads), profile + s));
+      }
+      res = workers_run(snr_samples<TypeTrace>, ta);
+      if (res != 0)
+        return -1;
+    }
+
+    /* The best samples, then the whole profile.
+     */
+    vector<pair<double, int> > best;
+    for (int s = 0; s < n_samples; s++)
+      best.push_back(make_pair(profile[s], s));
+    partial_sort(best.begin(), best.begin() + min(conf.top, n_samples), best.end(), greater<pair<double, int> >());
+
+    if (conf.sep == "") {
+      printf("[SNR] Best %i samples for byte #%i:\n", min(conf.top, n_samples), bn);
+      for (int i = 0; i < min(conf.top, n_samples); i++)
+        printf("%2i: %8i  snr: %g\n", i + 1, sample_index(conf, best[i].second), best[i].first);
+    } else {
+      printf("%i%s%i%s%g\n", bn, conf.sep.c_str(), sample_index(conf, best[0].second), conf.sep.c_str(), best[0].first);
+    }
+    if (out != NULL) {
+      for (int s = 0; s < n_samples; s++)
+        fprintf(out, "%i %i %g\n", bn, sample_index(conf, s), profile[s]);
+    }
+
+    end = omp_get_wtime();
+    if (conf.sep == "") printf("\n[INFO] SNR of byte number %i done in %lf seconds.\n\n", bn, end - start);
+  }
+
+  if (out != NULL)
+    fclose(out);
+  free(profile);
+  free_matrix(&traces, ncol);
+  return 0;
+}
+
+template int snr<float>(Config & conf);
+template int snr<double>(Config & conf);
+template int snr<int8_t>(Config & conf);
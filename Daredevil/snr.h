@@ -0,0 +1,36 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#ifndef SNR_H
+#define SNR_H
+
+#include "utils.h"
+
+/* Computes, for every targeted key byte, the signal-to-noise ratio of every
+ * time sample: the variance of the means of the classes of traces, divided
+ * by the mean of the variances of the classes. The class of a trace is its
+ * plaintext byte (snr=plaintext), or the value of the leakage model under the
+ * correct key (snr=model). The best samples are printed, and the whole
+ * profile is written to snr_file if specified.
+ */
+template <class TypeTrace>
+int snr(Config & conf);
+
+#endif
@@ -21,10 +21,34 @@
 #include "socpa.h"
 #include "cpa.h"
 #include "utils.h"
+#include "dedup.h"
+#include "loader.h"
+#include "workers.h"
+#include "affinity.h"
 #include "string.h"
 
 pthread_mutex_t pt_lock;
 
+/* Returns the number of samples of the traces kept in memory along with the
+ * guesses of a key byte.
+ */
+  template <class TypeTrace, class TypeReturn, class TypeGuess>
+static int second_order_ncol(const Config & conf)
+{
+  MemoryPlan plan;
+  int n_keys = conf.total_n_keys;
+
+  if (!conf.memory_auto)
+    return min(get_ncol<TypeReturn>(conf.memory - guess_bytes<TypeGuess>(conf), conf.n_traces), conf.n_samples);
+
+  plan_matrix<TypeReturn>(plan, 0, conf.n_traces, true);
+  plan_loader<TypeTrace>(conf, plan);
+  plan.fixed += guess_bytes<TypeGuess>(conf);
+  plan_matrix<TypeReturn>(plan, n_keys, 2, false);
+  plan_attack<TypeReturn>(conf, plan);
+  return plan_ncol(conf, plan, conf.n_samples, "second order");
+}
+
 /* Implements second order CPA in a faster and multithreaded way on big files.
  *
  * TODO:
@@ -42,30 +66,24 @@ int second_order(Config & conf)
   int res,
       n_keys = conf.total_n_keys,
       n_samples = conf.n_samples,
-      nmat = conf.n_file_trace,
-      nrows = conf.total_n_traces,
+      nrows = conf.n_traces,
       window = conf.window,
-      ncol = min(\
-        get_ncol<TypeReturn>(conf.memory -(nrows*n_keys*sizeof(TypeGuess)), nrows),\
-        n_samples),
+      ncol = second_order_ncol<TypeTrace, TypeReturn, TypeGuess>(conf),
       col_incr = ncol - window + 1,
-      col_offset = 0,
       row_offset = 0,
       sample_offset = 0,
-      cur_n_rows, cur_n_cols,
       samples_loaded = 0,
       to_load = ncol;
 
   uint8_t is_last_iter = 0;
-  unsigned int max_n_rows = 0;
 
 
   /* As we'll have to subtract the mean (TypeReturn) from the traces, we
    * need to have the traces in the correct type as well.
    */
   TypeReturn ** traces = NULL;
-  TypeTrace ** tmp = NULL;
   TypeGuess ** guesses = NULL;
+  GuessModel<TypeGuess> model;
   TypeReturn ** precomp_k;
 
   /* Some checks before actually running the attack
@@ -83,33 +101,32 @@ int second_order(Config & conf)
  /* printf("Memory allows to load %i samples at a time out of %i total samples.\n",\
       ncol, n_samples);
 */
-  /* We determine the size of the file having the largest number of rows, to
-   * allocate memory for tmp.
-   */
-  for (int i = 0; i < nmat; i++){
-    if(conf.traces[i].n_rows > max_n_rows)
-      max_n_rows = conf.traces[i].n_rows;
-  }
-
   /* We allocate the different arrays that we use during the computations
    */
-  res = allocate_matrix(&tmp, max_n_rows, ncol);
+  TraceLoader<TypeTrace> loader(conf, ncol);
+  res = loader.init();
   if (res != 0) {
-    fprintf (stderr, "[ERROR] allocating matrix in test.\n");
+    fprintf (stderr, "[ERROR] Initializing the trace loader in test.\n");
     return -1;
   }
 
-  res = allocate_matrix(&traces, ncol, nrows);
+  res = allocate_matrix(&traces, ncol, nrows, MEM_TRACES);
   if (res != 0) {
     fprintf (stderr, "[ERROR] allocating matrix in test.\n");
     return -1;
   }
+  affinity_place(traces, ncol, nrows * sizeof(TypeReturn), false);
 
-  res = allocate_matrix(&precomp_k, n_keys, 2);
+  res = allocate_matrix(&precomp_k, n_keys, 2, MEM_GUESSES);
   if (res != 0){
     fprintf(stderr, "[ERROR] Memory allocation failed in CPA_v_5 function\n");
     return -1;
   }
+  /* The sums of the guesses are accumulated from zero, the matrix can reuse
+   * the memory of a previous run (the coarse pass of the POI).
+   */
+  for (int k = 0; k < n_keys; k++)
+    precomp_k[k][0] = precomp_k[k][1] = 0;
 
   /* We initialize the priority queues to store the highest correlations.
    */
@@ -131,6 +148,9 @@ int second_order(Config & conf)
    * variables used during the computations
    */
   MatArgs<TypeReturn, TypeReturn, TypeGuess> mat_args = MatArgs<TypeReturn, TypeReturn, TypeGuess> (traces, guesses, NULL);
+  vector<int> weight;
+  mat_args.n_weight = selected_weights(conf, weight);
+  mat_args.weight = weight.empty() ? NULL : &weight[0];
 
   SecondOrderQueues<TypeReturn>* queues = new SecondOrderQueues<TypeReturn>(pqueue, top_r_by_key);
   if(queues == NULL){
@@ -138,7 +158,11 @@ int second_order(Config & conf)
     return -1;
   }
 
-  FinalConfig<TypeReturn, TypeReturn, TypeGuess> fin_conf = FinalConfig<TypeReturn, TypeReturn, TypeGuess>(&mat_args, &conf, (void*)queues);
+  SampleGroups * groups = NULL;
+  if (conf.dedup_samples)
+    groups = new SampleGroups(ncol);
+
+  FinalConfig<TypeReturn, TypeReturn, TypeGuess> fin_conf = FinalConfig<TypeReturn, TypeReturn, TypeGuess>(&mat_args, &conf, (void*)queues, (void*)groups);
   pthread_mutex_init(&pt_lock, NULL);
 
 
@@ -161,18 +185,13 @@ int second_order(Config & conf)
     /* Constructs the hypothetical power consumption values for the current
      * key bytes attacked.
      */
-    res = construct_guess (&fin_conf.mat_args->guess, conf.algo, conf.guesses, conf.n_file_guess, bn, conf.round, conf.des_switch, conf.sbox, conf.total_n_keys, -1);
-    if (res < 0) {
-      fprintf (stderr, "[ERROR] Constructing guess.\n");
+    res = prepare_guesses(fin_conf, &guesses, model, bn, -1, precomp_k);
+    if (res != 0)
       return -1;
-    }
 
-    /* Multithreaded precomputations for the guesses
-     */
-    res = split_work(fin_conf, precomp_guesses<TypeReturn, TypeReturn, TypeGuess>, precomp_k, n_keys);
-    if (res != 0) {
-      fprintf(stderr, "[ERROR] Precomputing sum and sum of square for the guesses.\n");
-      return -1;
+    if (groups != NULL) {
+      groups->members.clear();
+      groups->n_skipped = 0;
     }
 
     /* We iterate over the all the files, loading ncol columns to memory at a
@@ -188,36 +207,30 @@ int second_order(Config & conf)
         to_load = n_samples - samples_loaded;
       }
 
-      /* We iterate over all the files, loading to_load samples at a time and
-       * starting at offset 'conf.index_sample + sample_offset + row_offset'
-       * in the files. This offset depends on the iteration and the variable
-       * to_load depends on whether it is the first iteration or not
-       * (we have to load more in the first iteration)
+      /* We load to_load samples at a time, starting at the logical sample
+       * 'sample_offset + row_offset'. This offset depends on the iteration
+       * and the variable to_load depends on whether it is the first iteration
+       * or not (we have to load more in the first iteration). The samples are
+       * typecast to TypeReturn at the same time.
        */
-      for (int i = 0; i < nmat; i++){
-        cur_n_rows = conf.traces[i].n_rows;
-        cur_n_cols = conf.traces[i].n_columns;
+      res = loader.load(fin_conf.mat_args->trace, row_offset, sample_offset + row_offset, to_load);
+      if (res != 0) {
+        fprintf (stderr, "[ERROR] loading file.\n");
+        return -1;
+      }
 
-        res = load_file_v_1(conf.traces[i].filename, &tmp, cur_n_rows, to_load, conf.index_sample + sample_offset + row_offset, cur_n_cols);
+      /* The samples are grouped before subtracting the mean, the window - 1
+       * columns kept from the previous iteration are left ungrouped.
+       */
+      if (groups != NULL) {
+        groups->reset(0, row_offset);
+        res = p_group_samples(fin_conf.mat_args->trace, row_offset, to_load, conf.n_traces, conf.n_threads, groups, conf, sample_offset + row_offset);
         if (res != 0) {
-          fprintf (stderr, "[ERROR] loading file.\n");
+          fprintf(stderr, "[ERROR] Grouping identical samples.\n");
           return -1;
         }
-
-        /* We copy the array tmp in the array traces at the good offset, and we
-         * transpose it AND typecast to TypeReturn at the same time.
-         * row_offset is used to make the distinction between the first iteration
-         * and the following.
-         */
-        for (int j = 0; j < cur_n_rows; j++){
-          for (int k = 0; k < to_load; k++){
-            fin_conf.mat_args->trace[k + row_offset][j + col_offset] = (TypeReturn) tmp[j][k];
-          }
-        }
-        col_offset += conf.traces[i].n_rows;
       }
 
-
       samples_loaded += to_load;
 
       /* We set to_load to col_incr. So that only in the very first iteration
@@ -229,24 +242,23 @@ int second_order(Config & conf)
        */
       row_offset = window - 1;
 
-      /* We compute the difference from the mean.
+      /* We compute the difference from the mean of the rows just loaded, the
+       * row 0 holding the logical sample sample_offset.
        * WARNING: Unnecessary work is done at the last iteration.
        * To avoid that, should introduce a variable n_work in
        * p_precomp_traces in order to only treat the n_work rows after offset.
        */
-      res = p_precomp_traces<TypeReturn, TypeReturn>(fin_conf.mat_args->trace, sample_offset ? col_incr : ncol, nrows, conf.n_threads, sample_offset ? window - 1 : 0);
+      res = p_precomp_traces<TypeReturn, TypeReturn>(fin_conf.mat_args->trace, ncol, nrows, conf.n_threads, sample_offset ? window - 1 : 0, conf.stats, sample_offset, mat_args.weight, mat_args.n_weight);
       if (res != 0) {
         fprintf(stderr, "[ERROR] Precomputing distance from mean for the traces.\n");
         return -1;
       }
-      col_offset = 0;
-
       /* If the order of the attack is larger than 2, we compute the attack_order-th moment
        */
       if (conf.attack_order > 2){
         res = split_work(fin_conf, higher_moments_correlation<TypeReturn, TypeReturn, TypeGuess>, precomp_k, is_last_iter ? (n_samples - sample_offset) : col_incr, sample_offset);
       }else{
-        res = split_work(fin_conf, second_order_correlation<TypeReturn, TypeReturn, TypeGuess>, precomp_k, is_last_iter ? (n_samples - sample_offset) : col_incr, sample_offset);
+        res = split_work(fin_conf, second_order_correlation<TypeReturn, TypeReturn, TypeGuess>, precomp_k, is_last_iter ? (n_samples - sample_offset) : col_incr, sample_offset, window);
       }if (res != 0) {
         fprintf(stderr, "[ERROR] Computing correlations.\n");
         return -1;
@@ -288,6 +300,16 @@ int second_order(Config & conf)
       print_top_r(top_r_by_key, n_keys, correct_key, conf.sep);
     }
 
+    if (groups != NULL && conf.sep == "") {
+      vector<int> times;
+      for (int k = n_keys - 1; k >= 0 && k >= n_keys - 20; k--) {
+        times.push_back(top_r_by_key[k].time1);
+        times.push_back(top_r_by_key[k].time2);
+      }
+      print_sample_groups(groups, times);
+      printf("[INFO] %li duplicated samples found.\n", groups->n_skipped);
+    }
+
     /* We reset the variables and arrays.
      */
     for (int k = 0; k < n_keys; k++){
@@ -302,7 +324,6 @@ int second_order(Config & conf)
         fflush(stdout);
     }
     is_last_iter = 0;
-    col_offset = 0;
     row_offset = 0;
     sample_offset = 0;
     samples_loaded = 0;
@@ -310,12 +331,13 @@ int second_order(Config & conf)
   }
 
   delete[] top_r_by_key;
+  pqueue->release();
   delete pqueue;
   delete queues;
+  delete groups;
   free_matrix(&precomp_k, n_keys);
   free_matrix(&traces, ncol);
-  free_matrix(&tmp, max_n_rows);
-  free_matrix(&fin_conf.mat_args->guess, n_keys);
+  free_matrix(&guesses, n_keys);
   pthread_mutex_destroy(&pt_lock);
   return 0;
 }
@@ -323,12 +345,13 @@ int second_order(Config & conf)
 /* This functions simply splits the total work (n_rows) into an equal number of
  * threads, creates this amount of threads and starts them to precompute the
  * distance of means for each row of the matrix trace. If the offset value is
- * specified, we start splitting the work starting at offset.
+ * specified, we start splitting the work starting at offset. The means of
+ * the samples already known in stats are not recomputed.
  *
- * ! We expect a matrix where the number of traces is n_rows
+ * ! We expect a matrix where the number of traces is n_columns
  */
   template <class TypeTrace, class TypeReturn>
-int p_precomp_traces(TypeTrace ** trace, int n_rows, int n_columns, int n_threads, int offset/*, int n_traces_from_offset*/)
+int p_precomp_traces(TypeTrace ** trace, int n_rows, int n_columns, int n_threads, int offset, SampleStats * stats, int first, const int * weight, int n_weight)
 {
   int n, rc,
       workload = 0,
@@ -346,10 +369,9 @@ int p_precomp_traces(TypeTrace ** trace, int n_rows, int n_columns, int n_thread
     workload = ((n_rows-offset)/n_threads);
   }
 
-  pthread_t threads[n_threads];
-  PrecompTraces<TypeTrace> *ta = NULL;
+  size_t mark = scratch_mark();
+  PrecompTraces<TypeTrace> *ta = scratch_array<PrecompTraces<TypeTrace> >(n_threads);
 
-  ta = (PrecompTraces<TypeTrace>*) malloc(n_threads * sizeof(PrecompTraces<TypeTrace>));
   if (ta == NULL) {
     fprintf (stderr, "[ERROR] Memory alloc failed.\n");
     return -1;
@@ -357,86 +379,100 @@ int p_precomp_traces(TypeTrace ** trace, int n_rows, int n_columns, int n_thread
 
   for (n = 0; n < n_threads; n++) {
     //printf(" Thread_%i [%i-%i]\n",n , offset+ n*workload, offset+n*workload + workload + ((n + 1) / n_threads)*(n_rows % n_threads));
-    ta[n] = PrecompTraces<TypeTrace>(offset + n*workload, workload + ((n + 1) / n_threads) * (n_rows % n_threads), n_traces, trace);
-    rc = pthread_create(&threads[n], NULL, precomp_traces_v_2<TypeTrace, TypeReturn>, (void *) &ta[n]);
-    if (rc != 0) {
-      fprintf(stderr, "[ERROR] Creating thread.\n");
-      free (ta);
-      return -1;
-    }
+    ta[n] = PrecompTraces<TypeTrace>(offset + n*workload, workload + ((n + 1) / n_threads) * ((n_rows - offset) % n_threads), n_traces, trace, stats, first, weight, weight != NULL ? n_weight : n_traces);
   }
 
-  for (n = 0; n < n_threads; n++) {
-    rc = pthread_join(threads[n], NULL);
-    if (rc != 0) {
-      fprintf(stderr, "[ERROR] Joining thread.\n");
-      free (ta);
-      return -1;
+  rc = workers_run(precomp_traces_v_2<TypeTrace, TypeReturn>, ta, sizeof(*ta), n_threads);
+  scratch_release(mark);
+  return rc;
+}
+
+/* Number of pairs of the row i of the chunk starting at the logical sample
+ * offset, fewer for the last rows of a chunk or of a range of the samples.
+ */
+static inline int row_pairs(const Config & conf, int i, int offset, int window)
+{
+  return max(1, min(min(conf.n_samples - offset, range_end(conf, i + offset) - offset), i + window) - i);
+}
+
+/* Cuts the rows 0 to total_work into tasks of about target pairs: blocks of
+ * rows ending where the pairs so far reach a multiple of target, and the rows
+ * of more pairs than target alone, their pairs cut in ranges. Fills ta if not
+ * NULL and returns the number of tasks.
+ */
+  template <class TypeTrace, class TypeReturn, class TypeGuess>
+static int cut_work(FinalConfig<TypeTrace, TypeReturn, TypeGuess> & fin_conf, TypeReturn ** precomp_k, int total_work, int offset, int window, double target, General<TypeTrace, TypeReturn, TypeGuess> * ta)
+{
+  int n = 0, i, p, pairs, pieces, per_piece,
+      start = 0,
+      n_traces = fin_conf.conf->n_traces;
+  double cost = 0, next = target;
+
+  for (i = 0; i < total_work; i++) {
+    pairs = row_pairs(*fin_conf.conf, i, offset, window);
+    cost += pairs;
+    if (pairs > target && pairs > 1) {
+      if (start < i) {
+        if (ta != NULL)
+          ta[n] = General<TypeTrace, TypeReturn, TypeGuess>(start, i - start, n_traces, offset, total_work, precomp_k, &fin_conf);
+        n++;
+      }
+      pieces = (int) ceil(pairs / target);
+      per_piece = (pairs + pieces - 1) / pieces;
+      for (p = 0; p < pairs; p += per_piece) {
+        if (ta != NULL)
+          ta[n] = General<TypeTrace, TypeReturn, TypeGuess>(i, 1, n_traces, offset, total_work, precomp_k, &fin_conf, p, per_piece);
+        n++;
+      }
+      start = i + 1;
+      next = (floor(cost / target) + 1) * target;
+      continue;
+    }
+    if (cost >= next || i == total_work - 1) {
+      if (ta != NULL)
+        ta[n] = General<TypeTrace, TypeReturn, TypeGuess>(start, i + 1 - start, n_traces, offset, total_work, precomp_k, &fin_conf);
+      n++;
+      start = i + 1;
+      next = (floor(cost / target) + 1) * target;
     }
   }
-  free (ta);
-  return 0;
+  return n;
 }
 
-/* This functions simply splits the total_work (usually represents the number
- * of columns of the matrix we're processing) into an equal number of threads,
- * creates this amount of threads and starts them with the function fct.
+/* This functions splits the total_work (usually represents the number of
+ * columns of the matrix we're processing) into tasks of about the same cost,
+ * more than threads, and runs fct on them with the workers.
  */
   template <class TypeTrace, class TypeReturn, class TypeGuess>
-int split_work(FinalConfig<TypeTrace, TypeReturn, TypeGuess> & fin_conf, void * (*fct)(void *), TypeReturn ** precomp_k, int total_work, int offset)
+int split_work(FinalConfig<TypeTrace, TypeReturn, TypeGuess> & fin_conf, void * (*fct)(void *), TypeReturn ** precomp_k, int total_work, int offset, int window)
 {
-  int n, rc,
-      workload = 0,
-      n_threads = fin_conf.conf->n_threads,
-      /* Can be changed later in order to compute on less traces.
-       */
-      n_traces = fin_conf.conf->total_n_traces;
+  int n, rc, i,
+      n_tasks = min(total_work, fin_conf.conf->n_threads * SPLIT_TASKS_PER_THREAD);
+  double total_cost = 0;
 
+  if (total_work <= 0)
+    return 0;
 
-  /* If the total work by thread is smaller than 1, only the last thread would
-   * work, which is against the sole principle of multithreading. Thus, we
-   * reduce the number of threads until the workload is larger than 1.
-   *
-   * This is quite a naive approach, and it would be better to look into more
-   * efficient load balancing algorithms.
-   *
+  /* The work is cut into about n_tasks tasks of the same number of pairs,
+   * which the workers take as soon as they are idle. A single row of many
+   * pairs is cut too, so that it does not keep one thread busy alone.
    */
-  workload = (total_work/n_threads);
-  while (workload < 1) {
-    n_threads -= 1;
-    workload = (total_work/n_threads);
-  }
+  for (i = 0; i < total_work; i++)
+    total_cost += row_pairs(*fin_conf.conf, i, offset, window);
 
-  pthread_t threads[n_threads];
-  General<TypeTrace, TypeReturn, TypeGuess> *ta = NULL;
+  n = cut_work(fin_conf, precomp_k, total_work, offset, window, total_cost / n_tasks, (General<TypeTrace, TypeReturn, TypeGuess> *) NULL);
+  size_t mark = scratch_mark();
+  General<TypeTrace, TypeReturn, TypeGuess> *ta = scratch_array<General<TypeTrace, TypeReturn, TypeGuess> >(n);
 
-  ta = (General<TypeTrace, TypeReturn, TypeGuess> *) malloc(n_threads * sizeof(General<TypeTrace, TypeReturn, TypeGuess>));
   if (ta == NULL) {
     fprintf (stderr, "[ERROR] Memory alloc failed.\n");
     return -1;
   }
+  cut_work(fin_conf, precomp_k, total_work, offset, window, total_cost / n_tasks, ta);
 
-  for (n = 0; n < n_threads; n++) {
-    //printf(" Thread_%i [%i-%i]\n", n, n*workload + offset, offset + n*workload + workload + ((n + 1) / n_threads)*(total_work % n_threads));
-    ta[n] = General<TypeTrace, TypeReturn, TypeGuess>(n*workload, workload + ((n + 1) / n_threads) * (total_work % n_threads), n_traces, offset, total_work, precomp_k, &fin_conf);
-    rc = pthread_create(&threads[n], NULL, (*fct), (void *) &ta[n]);
-    if (rc != 0) {
-      fprintf(stderr, "[ERROR] Creating thread.\n");
-      free (ta);
-      return -1;
-    }
-  }
-
-  for (n = 0; n < n_threads; n++) {
-    rc = pthread_join(threads[n], NULL);
-    if (rc != 0) {
-      fprintf(stderr, "[ERROR] Joining thread.\n");
-      free (ta);
-      return -1;
-    }
-  }
-  free (ta);
-  return 0;
+  rc = workers_run(fct, ta, sizeof(*ta), n);
+  scratch_release(mark);
+  return rc;
 }
 
 /* This function computes the second order correlation between a subset
@@ -453,60 +489,80 @@ void * second_order_correlation(void * args_in)
       n_keys = G->fin_conf->conf->total_n_keys,
       n_traces = G->fin_conf->conf->n_traces,
       n_samples = G->fin_conf->conf->n_samples,
-      first_sample = G->fin_conf->conf->index_sample,
       offset = G->global_offset,
       window = G->fin_conf->conf->window ? G->fin_conf->conf->window : n_samples,
-      up_bound;
+      up_bound, time1, time2;
 
 
   TypeReturn corr, s_t, ss_t, tmp, std_dev_t;
-  TypeReturn * t = (TypeReturn *) malloc(n_traces * sizeof(TypeReturn));
-  if (t == NULL){
-    fprintf (stderr, "[ERROR] Allocating memory for t in correlation\n");
+  TypeReturn * t = scratch_array<TypeReturn>(n_traces);
+
+  SampleGroups * groups = (SampleGroups *) G->fin_conf->groups;
+  MatArgs<TypeTrace, TypeReturn, TypeGuess> * mat_args = G->fin_conf->mat_args;
+  const int * weight = mat_args->weight;
+  int n_weight = mat_args->n_weight;
+  CorrSecondOrder<TypeReturn> * q = scratch_array<CorrSecondOrder<TypeReturn> >(n_keys);
+  TypeReturn * sum_prod = scratch_array<TypeReturn>(n_keys);
+  if (t == NULL || q == NULL || sum_prod == NULL){
+    fprintf (stderr, "[ERROR] Allocating memory for t and q in correlation\n");
+    return NULL;
   }
 
-  CorrSecondOrder<TypeReturn> * q = (CorrSecondOrder<TypeReturn> *) malloc(n_keys * sizeof(CorrSecondOrder<TypeReturn>));
-  if (q == NULL){
-    fprintf (stderr, "[ERROR] Allocating memory for q in correlation\n");
-  }
 
+  LocalTop<CorrSecondOrder<TypeReturn> > local(G->fin_conf->conf->top, n_keys, G->fin_conf->conf->key_size == 1,
+      G->start + offset, min(G->length + window - 1, n_samples - offset - G->start));
 
   for (i = G->start; i < G->start + G->length; i++) {
-    up_bound = min(n_samples - offset, i+window);
-    for (j = i; j < up_bound; j++) {
+    up_bound = min(min(n_samples, range_end(*G->fin_conf->conf, i + offset)) - offset, i+window);
+    if (G->n_pairs > 0)
+      up_bound = min(up_bound, i + G->first_pair + G->n_pairs);
+    time1 = sample_index(*G->fin_conf->conf, i + offset);
+    for (j = i + G->first_pair; j < up_bound; j++) {
+      if (groups != NULL && groups->is_redundant_pair(i, j, window))
+        continue;
+
       s_t = 0.0;
       ss_t = 0.0;
-      for (k = 0; k < n_traces; k++) {
-        tmp = G->fin_conf->mat_args->trace[i][k] * G->fin_conf->mat_args->trace[j][k];
-        t[k] = tmp;
-        s_t += tmp;
-        ss_t += tmp*tmp;
+      if (weight != NULL) {
+        for (k = 0; k < n_traces; k++) {
+          tmp = G->fin_conf->mat_args->trace[i][k] * G->fin_conf->mat_args->trace[j][k];
+          t[k] = weight[k] * tmp;
+          s_t += t[k];
+          ss_t += t[k]*tmp;
+        }
+      } else {
+        for (k = 0; k < n_traces; k++) {
+          tmp = G->fin_conf->mat_args->trace[i][k] * G->fin_conf->mat_args->trace[j][k];
+          t[k] = tmp;
+          s_t += tmp;
+          ss_t += tmp*tmp;
+        }
       }
-      std_dev_t = sqrt(n_traces*ss_t - s_t*s_t);
+      std_dev_t = sqrt(n_weight*ss_t - s_t*s_t);
+      time2 = sample_index(*G->fin_conf->conf, j + offset);
+      dot_products(mat_args->guess, mat_args->inputs, mat_args->table, t, n_traces, n_keys, sum_prod);
       for (k = 0; k < n_keys; k++) {
-        corr = pearson_v_2_2<TypeReturn, TypeReturn, TypeGuess>(G->fin_conf->mat_args->guess[k], G->precomp_guesses[k][0], sqrt(n_traces * G->precomp_guesses[k][1] - G->precomp_guesses[k][0] * G->precomp_guesses[k][0]), t, s_t, std_dev_t, n_traces);
+        tmp = sqrt(n_weight * G->precomp_guesses[k][1] - G->precomp_guesses[k][0] * G->precomp_guesses[k][0]);
+        corr = pearson_sums(sum_prod[k], G->precomp_guesses[k][0], tmp, s_t, std_dev_t, n_weight);
 
         if (!isnormal(corr)) corr = (TypeReturn) 0;
 
         q[k].corr  = corr;
-        q[k].time1 = i + first_sample + offset;
-        q[k].time2 = j + first_sample + offset;
+        q[k].time1 = time1;
+        q[k].time2 = time2;
         q[k].key   = k;
       }
-      pthread_mutex_lock(&pt_lock);
-      for (int key=0; key < n_keys; key++) {
-        if (G->fin_conf->conf->key_size == 1)
-          queues->pqueue->insert(q[key]);
-        if (queues->top_corr[key] < q[key]){
-          queues->top_corr[key] = q[key];
-        }
+      local.insert(q, n_keys);
+      if (G->fin_conf->conf->sample_score != NULL) {
+        local.update_score(i + offset, q, n_keys);
+        local.update_score(j + offset, q, n_keys);
       }
-      pthread_mutex_unlock(&pt_lock);
-
     }
   }
-  free (t);
-  free (q);
+
+  pthread_mutex_lock(&pt_lock);
+  local.merge(queues->pqueue, queues->top_corr, G->fin_conf->conf->sample_score);
+  pthread_mutex_unlock(&pt_lock);
   return NULL;
 }
 
@@ -523,66 +579,74 @@ void * higher_moments_correlation(void * args_in)
   int i, k,
       n_keys = G->fin_conf->conf->total_n_keys,
       n_traces = G->fin_conf->conf->n_traces,
-      first_sample = G->fin_conf->conf->index_sample,
       offset = G->global_offset,
-      exponent = G->fin_conf->conf->attack_order;
-
-
-  TypeReturn corr, s_t, ss_t, tmp, std_dev_t, mean_t, sigma_n;
-  TypeReturn * t = (TypeReturn *) malloc(n_traces * sizeof(TypeReturn));
-  if (t == NULL){
-    fprintf (stderr, "[ERROR] Allocating memory for t in correlation\n");
+      exponent = G->fin_conf->conf->attack_order,
+      time;
+
+
+  TypeReturn corr, s_t, ss_t, tmp, std_dev_t, mean_t, sigma_n, w;
+  TypeReturn * t = scratch_array<TypeReturn>(n_traces);
+
+  SampleGroups * groups = (SampleGroups *) G->fin_conf->groups;
+  MatArgs<TypeTrace, TypeReturn, TypeGuess> * mat_args = G->fin_conf->mat_args;
+  const int * weight = mat_args->weight;
+  int n_weight = mat_args->n_weight;
+  CorrSecondOrder<TypeReturn> * q = scratch_array<CorrSecondOrder<TypeReturn> >(n_keys);
+  TypeReturn * sum_prod = scratch_array<TypeReturn>(n_keys);
+  if (t == NULL || q == NULL || sum_prod == NULL){
+    fprintf (stderr, "[ERROR] Allocating memory for t and q in correlation\n");
+    return NULL;
   }
 
-  CorrSecondOrder<TypeReturn> * q = (CorrSecondOrder<TypeReturn> *) malloc(n_keys * sizeof(CorrSecondOrder<TypeReturn>));
-  if (q == NULL){
-    fprintf (stderr, "[ERROR] Allocating memory for q in correlation\n");
-  }
 
+  LocalTop<CorrSecondOrder<TypeReturn> > local(G->fin_conf->conf->top, n_keys, G->fin_conf->conf->key_size == 1,
+      G->start + offset, G->length);
 
   for (i = G->start; i < G->start + G->length; i++) {
+      if (groups != NULL && !groups->is_rep(i))
+        continue;
+
       s_t = 0.0;
       ss_t = 0.0;
       mean_t = 0.0;
       sigma_n = 0.0;
       for (k = 0; k < n_traces; k++) {
         tmp = G->fin_conf->mat_args->trace[i][k];
-        mean_t += tmp;
-        sigma_n += tmp*tmp;
+        w = weight != NULL ? weight[k] : 1;
+        mean_t += w * tmp;
+        sigma_n += w * tmp*tmp;
       }
-      mean_t /= n_traces;
-      sigma_n = pow(sqrt(sigma_n/n_traces - mean_t*mean_t), exponent);
+      mean_t /= n_weight;
+      sigma_n = pow(sqrt(sigma_n/n_weight - mean_t*mean_t), exponent);
       for (k = 0; k < n_traces; k++) {
         tmp = pow((G->fin_conf->mat_args->trace[i][k] - mean_t), exponent)/sigma_n;
-        t[k] = tmp;
-        s_t += tmp;
-        ss_t += tmp*tmp;
+        w = weight != NULL ? weight[k] : 1;
+        t[k] = w * tmp;
+        s_t += t[k];
+        ss_t += t[k]*tmp;
       }
-      std_dev_t = sqrt(n_traces*ss_t - s_t*s_t);
+      std_dev_t = sqrt(n_weight*ss_t - s_t*s_t);
+      time = sample_index(*G->fin_conf->conf, i + offset);
+      dot_products(mat_args->guess, mat_args->inputs, mat_args->table, t, n_traces, n_keys, sum_prod);
       for (k = 0; k < n_keys; k++) {
-        corr = pearson_v_2_2<TypeReturn, TypeReturn, TypeGuess>(G->fin_conf->mat_args->guess[k], G->precomp_guesses[k][0], sqrt(n_traces * G->precomp_guesses[k][1] - G->precomp_guesses[k][0] * G->precomp_guesses[k][0]), t, s_t, std_dev_t, n_traces);
+        tmp = sqrt(n_weight * G->precomp_guesses[k][1] - G->precomp_guesses[k][0] * G->precomp_guesses[k][0]);
+        corr = pearson_sums(sum_prod[k], G->precomp_guesses[k][0], tmp, s_t, std_dev_t, n_weight);
 
         if (!isnormal(corr)) corr = (TypeReturn) 0;
 
         q[k].corr  = corr;
-        q[k].time1 = i + first_sample + offset;
-        q[k].time2 = i + first_sample + offset;
+        q[k].time1 = time;
+        q[k].time2 = time;
         q[k].key   = k;
       }
-      pthread_mutex_lock(&pt_lock);
-      for (int key=0; key < n_keys; key++) {
-        if (G->fin_conf->conf->key_size == 1)
-          queues->pqueue->insert(q[key]);
-        if (queues->top_corr[key] < q[key]){
-          queues->top_corr[key] = q[key];
-        }
-      }
-      pthread_mutex_unlock(&pt_lock);
-
-
+      local.insert(q, n_keys);
+      if (G->fin_conf->conf->sample_score != NULL)
+        local.update_score(i + offset, q, n_keys);
   }
-  free (t);
-  free (q);
+
+  pthread_mutex_lock(&pt_lock);
+  local.merge(queues->pqueue, queues->top_corr, G->fin_conf->conf->sample_score);
+  pthread_mutex_unlock(&pt_lock);
   return NULL;
 }
 
@@ -595,15 +659,21 @@ void * precomp_traces_v_2(void * args_in)
 {
 
   int i, j;
-  TypeReturn mean = 0.0;
+  TypeReturn mean;
 
   PrecompTraces<TypeTrace> * G = (PrecompTraces<TypeTrace> *) args_in;
 
   for (i = G->start; i < G->start + G->end; i++) {
-    for (j = 0; j < G->length; j++) {
-      mean += G->trace[i][j];
+    if (stats_get(G->stats, G->first + i, STATS_SUM)) {
+      mean = G->stats->sum[G->first + i];
+    } else {
+      mean = 0.0;
+      for (j = 0; j < G->length; j++) {
+        mean += G->weight != NULL ? G->weight[j] * G->trace[i][j] : G->trace[i][j];
+      }
+      stats_put(G->stats, G->first + i, STATS_SUM, mean, 0);
     }
-    mean /= G->length;
+    mean /= G->n_weight;
     for (j = 0; j < G->length; j++) {
       G->trace[i][j] -= mean;
     }
@@ -622,9 +692,16 @@ void * precomp_guesses(void * args_in)
   TypeReturn tmp;
   General<TypeTrace, TypeReturn, TypeGuess> * G = (General<TypeTrace, TypeReturn, TypeGuess> *) args_in;
 
+  const int * weight = G->fin_conf->mat_args->weight;
+
   for (i = G->start; i < G->start + G->length; i++) {
     for (j = 0; j < G->n_traces; j++) {
       tmp = G->fin_conf->mat_args->guess[i][j];
+      if (weight != NULL) {
+        G->precomp_guesses[i][0] += weight[j] * tmp;
+        G->precomp_guesses[i][1] += weight[j] * tmp*tmp;
+        continue;
+      }
       G->precomp_guesses[i][0] += tmp;
       G->precomp_guesses[i][1] += tmp*tmp;
     }
@@ -632,11 +709,54 @@ void * precomp_guesses(void * args_in)
   return NULL;
 }
 
+  template <class TypeTrace, class TypeReturn, class TypeGuess>
+int prepare_guesses(FinalConfig<TypeTrace, TypeReturn, TypeGuess> & fin_conf, TypeGuess *** guess, GuessModel<TypeGuess> & model, int bn, int bit, TypeReturn ** precomp_k)
+{
+  Config & conf = *fin_conf.conf;
+  int res,
+      n_keys = conf.total_n_keys;
+
+  /* Only the inputs of the traces and the table of the model are kept, the
+   * sums of the guesses being found from the number of traces by input.
+   */
+  if (conf.onthefly_guesses) {
+    res = construct_guess_model (&model, conf.algo, conf.guesses, conf.n_file_guess, bn, conf.round, conf.des_switch, conf.sbox, n_keys, bit, conf.trace_index);
+    if (res < 0) {
+      fprintf (stderr, "[ERROR] Constructing guess.\n");
+      return -1;
+    }
+    fin_conf.mat_args->guess = NULL;
+    fin_conf.mat_args->inputs = &model.x[0];
+    fin_conf.mat_args->table = &model.table[0];
+    model_sums(model, n_keys, conf.n_traces, fin_conf.mat_args->weight, precomp_k);
+    return 0;
+  }
+
+  res = construct_guess (guess, conf.algo, conf.guesses, conf.n_file_guess, bn, conf.round, conf.des_switch, conf.sbox, n_keys, bit, conf.trace_index);
+  if (res < 0) {
+    fprintf (stderr, "[ERROR] Constructing guess.\n");
+    return -1;
+  }
+  affinity_place(*guess, n_keys, conf.n_traces * sizeof(TypeGuess), true);
+  fin_conf.mat_args->guess = *guess;
+  fin_conf.mat_args->inputs = NULL;
+  fin_conf.mat_args->table = NULL;
+
+  /* Multithreaded precomputations for the guesses
+   */
+  res = split_work(fin_conf, precomp_guesses<TypeTrace, TypeReturn, TypeGuess>, precomp_k, n_keys);
+  if (res != 0) {
+    fprintf(stderr, "[ERROR] Precomputing sum and sum of square for the guesses.\n");
+    return -1;
+  }
+  return 0;
+}
 
 template int second_order<float, double, uint8_t>(Config & conf);
 template int second_order<double, double, uint8_t>(Config & conf);
 template int second_order<int8_t, double, uint8_t>(Config & conf);
 template int second_order<int8_t, float, uint8_t>(Config & conf);
+template int second_order<BitWord, double, uint8_t>(Config & conf);
 
 template void * second_order_correlation<int8_t, double, uint8_t>(void * args_in);
 template void * second_order_correlation<double, double, uint8_t>(void * args_in);
@@ -648,11 +768,26 @@ template void * precomp_guesses<int8_t, double, uint8_t>(void * args_in);
 template void * precomp_guesses<float, double, uint8_t>(void * args_in);
 template void * precomp_guesses<int8_t, float, uint8_t>(void * args_in);
 template void * precomp_guesses<float, float, uint8_t>(void * args_in);
-
-template int p_precomp_traces<int8_t, double>(int8_t ** trace, int n_rows, int n_columns, int n_threads, int offset);
-template int p_precomp_traces<double, double>(double ** trace, int n_rows, int n_columns, int n_threads, int offset);
-
-template int split_work<float, double, uint8_t>(FinalConfig<float, double, uint8_t> & fin_conf, void * (*fct)(void *), double ** precomp_k, int total_work, int offset);
-template int split_work<int8_t, double, uint8_t>(FinalConfig<int8_t, double, uint8_t> & fin_conf, void * (*fct)(void *), double ** precomp_k, int total_work, int offset);
-template int split_work<float, float, uint8_t>(FinalConfig<float, float, uint8_t> & fin_conf, void * (*fct)(void *), float ** precomp_k, int total_work, int offset);
-template int split_work<int8_t, float, uint8_t>(FinalConfig<int8_t, float, uint8_t> & fin_conf, void * (*fct)(void *), float ** precomp_k, int total_work, int offset);
+template void * precomp_guesses<int16_t, double, uint8_t>(void * args_in);
+template void * precomp_guesses<int16_t, float, uint8_t>(void * args_in);
+template void * precomp_guesses<BitWord, double, uint8_t>(void * args_in);
+
+template int p_precomp_traces<int8_t, double>(int8_t ** trace, int n_rows, int n_columns, int n_threads, int offset, SampleStats * stats, int first, const int * weight, int n_weight);
+template int p_precomp_traces<double, double>(double ** trace, int n_rows, int n_columns, int n_threads, int offset, SampleStats * stats, int first, const int * weight, int n_weight);
+
+template int prepare_guesses<float, double, uint8_t>(FinalConfig<float, double, uint8_t> & fin_conf, uint8_t *** guess, GuessModel<uint8_t> & model, int bn, int bit, double ** precomp_k);
+template int prepare_guesses<double, double, uint8_t>(FinalConfig<double, double, uint8_t> & fin_conf, uint8_t *** guess, GuessModel<uint8_t> & model, int bn, int bit, double ** precomp_k);
+template int prepare_guesses<int8_t, double, uint8_t>(FinalConfig<int8_t, double, uint8_t> & fin_conf, uint8_t *** guess, GuessModel<uint8_t> & model, int bn, int bit, double ** precomp_k);
+template int prepare_guesses<float, float, uint8_t>(FinalConfig<float, float, uint8_t> & fin_conf, uint8_t *** guess, GuessModel<uint8_t> & model, int bn, int bit, float ** precomp_k);
+template int prepare_guesses<int8_t, float, uint8_t>(FinalConfig<int8_t, float, uint8_t> & fin_conf, uint8_t *** guess, GuessModel<uint8_t> & model, int bn, int bit, float ** precomp_k);
+template int prepare_guesses<int16_t, double, uint8_t>(FinalConfig<int16_t, double, uint8_t> & fin_conf, uint8_t *** guess, GuessModel<uint8_t> & model, int bn, int bit, double ** precomp_k);
+template int prepare_guesses<int16_t, float, uint8_t>(FinalConfig<int16_t, float, uint8_t> & fin_conf, uint8_t *** guess, GuessModel<uint8_t> & model, int bn, int bit, float ** precomp_k);
+template int prepare_guesses<BitWord, double, uint8_t>(FinalConfig<BitWord, double, uint8_t> & fin_conf, uint8_t *** guess, GuessModel<uint8_t> & model, int bn, int bit, double ** precomp_k);
+
+template int split_work<float, double, uint8_t>(FinalConfig<float, double, uint8_t> & fin_conf, void * (*fct)(void *), double ** precomp_k, int total_work, int offset, int window);
+template int split_work<int8_t, double, uint8_t>(FinalConfig<int8_t, double, uint8_t> & fin_conf, void * (*fct)(void *), double ** precomp_k, int total_work, int offset, int window);
+template int split_work<float, float, uint8_t>(FinalConfig<float, float, uint8_t> & fin_conf, void * (*fct)(void *), float ** precomp_k, int total_work, int offset, int window);
+template int split_work<int8_t, float, uint8_t>(FinalConfig<int8_t, float, uint8_t> & fin_conf, void * (*fct)(void *), float ** precomp_k, int total_work, int offset, int window);
+template int split_work<int16_t, double, uint8_t>(FinalConfig<int16_t, double, uint8_t> & fin_conf, void * (*fct)(void *), double ** precomp_k, int total_work, int offset, int window);
+template int split_work<int16_t, float, uint8_t>(FinalConfig<int16_t, float, uint8_t> & fin_conf, void * (*fct)(void *), float ** precomp_k, int total_work, int offset, int window);
+template int split_work<BitWord, double, uint8_t>(FinalConfig<BitWord, double, uint8_t> & fin_conf, void * (*fct)(void *), double ** precomp_k, int total_work, int offset, int window);
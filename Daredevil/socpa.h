@@ -28,6 +28,8 @@
 #include <omp.h>
 #include "utils.h"
 #include "pearson.h"
+#include "stats.h"
+#include "guess.h"
 
 template <typename TypeTrace, typename TypeReturn, typename TypeGuess>
 struct General {
@@ -42,9 +44,14 @@ struct General {
   int n_samples;
   TypeReturn ** precomp_guesses;
   FinalConfig<TypeTrace, TypeReturn, TypeGuess> * fin_conf;
+  /* The second order pairs (i, j) of the rows i taken, j going from
+   * i + first_pair, n_pairs of them at most (0 for all of them).
+   */
+  int first_pair;
+  int n_pairs;
 
-  General(int st, int len, int nt, int go, int nc, TypeReturn ** pg, FinalConfig<TypeTrace, TypeReturn, TypeGuess> * s):
-    start(st), length(len), n_traces(nt), global_offset(go), n_samples(nc), precomp_guesses(pg), fin_conf(s){
+  General(int st, int len, int nt, int go, int nc, TypeReturn ** pg, FinalConfig<TypeTrace, TypeReturn, TypeGuess> * s, int fp=0, int np=0):
+    start(st), length(len), n_traces(nt), global_offset(go), n_samples(nc), precomp_guesses(pg), fin_conf(s), first_pair(fp), n_pairs(np){
   }
 };
 
@@ -56,9 +63,18 @@ struct PrecompTraces {
   int end;
   int length;
   TypeTrace ** trace;
+  /* The statistics of the samples, and the logical sample of the row 0.
+   */
+  SampleStats * stats;
+  int first;
+  /* The weights of the traces (NULL if they all count once) and the number
+   * of traces they stand for.
+   */
+  const int * weight;
+  int n_weight;
 
-  PrecompTraces(int st, int en, int nt, TypeTrace ** tr):
-    start(st), end(en), length(nt), trace(tr) {
+  PrecompTraces(int st, int en, int nt, TypeTrace ** tr, SampleStats * ss, int fi, const int * w, int nw):
+    start(st), end(en), length(nt), trace(tr), stats(ss), first(fi), weight(w), n_weight(nw) {
   }
 };
 
@@ -100,16 +116,37 @@ void * precomp_traces_v_2(void * args_in);
 template <class TypeTrace, class TypeReturn, class TypeGuess>
 void * precomp_guesses(void * args_in);
 
-/* This functions simply splits the total work (n_rows) into an equal number of
- * threads, creates this amount of threads and starts them to precompute the
- * distance of means for each row of the matrix trace.
- * ! We expect a matrix where the number of traces is n_rows
+/* This functions simply splits the total work (the rows offset to n_rows)
+ * into an equal number of threads, creates this amount of threads and starts
+ * them to precompute the distance of means for each row of the matrix trace.
+ * The means are read from and recorded in stats if not NULL, the row 0
+ * holding the logical sample first. The means are weighted by weight if not
+ * NULL.
+ * ! We expect a matrix where the number of traces is n_columns
  */
   template <class TypeTrace, class TypeReturn>
-int p_precomp_traces(TypeTrace ** trace, int n_rows, int n_columns, int n_threads, int offset=0);
+int p_precomp_traces(TypeTrace ** trace, int n_rows, int n_columns, int n_threads, int offset=0, SampleStats * stats=NULL, int first=0, const int * weight=NULL, int n_weight=0);
 
 
+/* Builds the guesses of the key byte bn (and bit) in *guess, allocated if
+ * NULL, or in model with onthefly_guesses, sets the guesses of
+ * fin_conf.mat_args to them and the sums of the guesses of every key in
+ * precomp_k (zero before). Returns -1 on failure.
+ */
+template <class TypeTrace, class TypeReturn, class TypeGuess>
+int prepare_guesses(FinalConfig<TypeTrace, TypeReturn, TypeGuess> & fin_conf, TypeGuess *** guess, GuessModel<TypeGuess> & model, int bn, int bit, TypeReturn ** precomp_k);
+
+/* Number of tasks per thread split_work cuts the work into, so that the
+ * threads done first take the remaining ones.
+ */
+#define SPLIT_TASKS_PER_THREAD 8
+
+/* Runs fct on the rows 0 to total_work of the chunk starting at the logical
+ * sample offset, cut into blocks of rows of about the same number of pairs
+ * of samples (window samples paired with every row, 1 for single samples).
+ * The rows with more pairs than a block are cut into ranges of pairs.
+ */
 template <class TypeTrace, class TypeReturn, class TypeGuess>
-int split_work(FinalConfig<TypeTrace, TypeReturn, TypeGuess> & fin_conf, void * (*fct)(void *), TypeReturn ** precomp_k, int total_work, int offset=0);
+int split_work(FinalConfig<TypeTrace, TypeReturn, TypeGuess> & fin_conf, void * (*fct)(void *), TypeReturn ** precomp_k, int total_work, int offset=0, int window=1);
 
 #endif
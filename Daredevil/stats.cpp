@@ -0,0 +1,243 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "stats.h"
+
+#define STATS_MAGIC 0x54534444
+#define FNV_OFFSET  14695981039346656037ULL
+#define FNV_PRIME   1099511628211ULL
+
+/* Size of the beginning and of the end of every trace file that is hashed.
+ */
+#define STATS_PEEK 4096
+
+static inline void hash_bytes(uint64_t * h, const void * data, size_t size)
+{
+  const uint8_t * bytes = (const uint8_t *) data;
+  for (size_t i = 0; i < size; i++)
+    *h = (*h ^ bytes[i]) * FNV_PRIME;
+}
+
+  template <class Type>
+static inline void hash_value(uint64_t * h, Type value)
+{
+  hash_bytes(h, &value, sizeof(value));
+}
+
+/* Hashes the name, size, modification time, and the first and last
+ * STATS_PEEK bytes of every trace file, rather than their whole content
+ * which the attack reads anyway, then the selection of the traces.
+ */
+uint64_t traces_key(const Config & conf)
+{
+  uint64_t h = FNV_OFFSET;
+  uint8_t buf[STATS_PEEK];
+  struct stat st;
+  size_t n;
+  FILE * f;
+
+  for (int i = 0; i < conf.n_file_trace; i++) {
+    hash_bytes(&h, conf.traces[i].filename, strlen(conf.traces[i].filename));
+    hash_value(&h, conf.traces[i].n_rows);
+    hash_value(&h, conf.traces[i].n_columns);
+    if (stat(conf.traces[i].filename, &st) == 0) {
+      hash_value(&h, (int64_t) st.st_size);
+      hash_value(&h, (int64_t) st.st_mtime);
+    }
+    f = fopen(conf.traces[i].filename, "rb");
+    if (f == NULL)
+      continue;
+    n = fread(buf, 1, STATS_PEEK, f);
+    hash_bytes(&h, buf, n);
+    if (fseek(f, -STATS_PEEK, SEEK_END) == 0) {
+      n = fread(buf, 1, STATS_PEEK, f);
+      hash_bytes(&h, buf, n);
+    }
+    fclose(f);
+  }
+
+  hash_value(&h, conf.n_traces);
+  for (size_t j = 0; j < conf.trace_index.size(); j++)
+    hash_value(&h, conf.trace_index[j]);
+  return h;
+}
+
+/* Hashes the traces, then every parameter changing the samples, quantization
+ * included.
+ * The first order engine keeps the samples in TypeTrace, the others in
+ * TypeReturn, which may round pooled or projected samples differently.
+ */
+  template <class TypeReturn>
+static uint64_t stats_key(const Config & conf)
+{
+  uint64_t h = traces_key(conf);
+
+  for (size_t j = 0; j < conf.trace_weight.size(); j++)
+    hash_value(&h, conf.trace_weight[j]);
+  hash_value(&h, conf.n_samples);
+  hash_value(&h, conf.index_sample);
+  for (size_t r = 0; r < conf.sample_ranges.size(); r++) {
+    hash_value(&h, conf.sample_ranges[r].first);
+    hash_value(&h, conf.sample_ranges[r].second);
+  }
+  hash_value(&h, conf.pool);
+  hash_value(&h, conf.pool_window);
+  hash_value(&h, conf.pool_stride);
+  for (size_t j = 0; j < conf.trace_shift.size(); j++)
+    hash_value(&h, conf.trace_shift[j]);
+  hash_value(&h, conf.pca_components);
+  hash_value(&h, conf.pca_train);
+  hash_value(&h, conf.quant_bits);
+  for (size_t s = 0; s < conf.quant_gain.size(); s++) {
+    hash_value(&h, conf.quant_gain[s]);
+    hash_value(&h, conf.quant_offset[s]);
+  }
+  hash_value(&h, conf.type_trace);
+  hash_value(&h, (char) (conf.attack_order == 1));
+  hash_value(&h, (int) sizeof(TypeReturn));
+  return h;
+}
+
+static long int count_known(const SampleStats * stats)
+{
+  long int n = 0;
+  for (int s = 0; s < stats->n_samples; s++)
+    n += (stats->known[s] & STATS_SUM) + ((stats->known[s] & STATS_SUM_SQ) >> 1);
+  return n;
+}
+
+/* Reads the record of the cache starting at the current position of f.
+ * Returns false at the end of the file or if the record is truncated.
+ */
+static bool read_record(FILE * f, SampleStats * stats)
+{
+  int magic;
+  size_t n;
+
+  if (fread(&magic, sizeof(int), 1, f) != 1 || magic != STATS_MAGIC)
+    return false;
+  if (fread(&stats->key, sizeof(uint64_t), 1, f) != 1
+      || fread(&stats->n_samples, sizeof(int), 1, f) != 1
+      || stats->n_samples < 0)
+    return false;
+  n = stats->n_samples;
+  stats->known.resize(n);
+  stats->sum.resize(n);
+  stats->sum_sq.resize(n);
+  return fread(&stats->known[0], sizeof(char), n, f) == n
+    && fread(&stats->sum[0], sizeof(double), n, f) == n
+    && fread(&stats->sum_sq[0], sizeof(double), n, f) == n;
+}
+
+static bool write_record(FILE * f, const SampleStats * stats)
+{
+  int magic = STATS_MAGIC;
+  size_t n = stats->n_samples;
+
+  return fwrite(&magic, sizeof(int), 1, f) == 1
+    && fwrite(&stats->key, sizeof(uint64_t), 1, f) == 1
+    && fwrite(&stats->n_samples, sizeof(int), 1, f) == 1
+    && fwrite(&stats->known[0], sizeof(char), n, f) == n
+    && fwrite(&stats->sum[0], sizeof(double), n, f) == n
+    && fwrite(&stats->sum_sq[0], sizeof(double), n, f) == n;
+}
+
+  template <class TypeReturn>
+int stats_open(Config & conf)
+{
+  uint64_t key = stats_key<TypeReturn>(conf);
+  SampleStats record;
+  FILE * f;
+
+  if (conf.stats != NULL && conf.stats->key == key && conf.stats->n_samples == conf.n_samples)
+    return 0;
+  if (conf.stats == NULL)
+    conf.stats = new SampleStats;
+
+  conf.stats->key = key;
+  conf.stats->n_samples = conf.n_samples;
+  conf.stats->known.assign(conf.n_samples, 0);
+  conf.stats->sum.assign(conf.n_samples, 0);
+  conf.stats->sum_sq.assign(conf.n_samples, 0);
+  conf.stats->n_read = 0;
+
+  if (conf.stats_cache == "")
+    return 0;
+  f = fopen(conf.stats_cache.c_str(), "rb");
+  if (f == NULL)
+    return 0;
+  while (read_record(f, &record)) {
+    if (record.key == key && record.n_samples == conf.n_samples) {
+      record.n_read = count_known(&record);
+      *conf.stats = record;
+      if (conf.sep == "")
+        printf("[INFO] Statistics of the samples read from %s.\n", conf.stats_cache.c_str());
+      break;
+    }
+  }
+  fclose(f);
+  return 0;
+}
+
+/* The other records are read back and rewritten, so that the cache holds the
+ * statistics of every set of samples attacked with these traces.
+ */
+int stats_save(Config & conf)
+{
+  vector<SampleStats> records;
+  SampleStats record;
+  string tmp_name = conf.stats_cache + ".tmp";
+  bool ok = true;
+  FILE * f;
+
+  if (conf.stats == NULL || conf.stats_cache == "" || count_known(conf.stats) == conf.stats->n_read)
+    return 0;
+
+  f = fopen(conf.stats_cache.c_str(), "rb");
+  if (f != NULL) {
+    while (read_record(f, &record)) {
+      if (record.key != conf.stats->key)
+        records.push_back(record);
+    }
+    fclose(f);
+  }
+  records.push_back(*conf.stats);
+
+  f = fopen(tmp_name.c_str(), "wb");
+  if (f == NULL) {
+    fprintf(stderr, "[WARNING] Cannot write the cache %s.\n", conf.stats_cache.c_str());
+    return 0;
+  }
+  for (size_t r = 0; r < records.size() && ok; r++)
+    ok = write_record(f, &records[r]);
+  if (fclose(f) != 0 || !ok || rename(tmp_name.c_str(), conf.stats_cache.c_str()) != 0) {
+    fprintf(stderr, "[WARNING] Cannot write the cache %s.\n", conf.stats_cache.c_str());
+    remove(tmp_name.c_str());
+    return 0;
+  }
+  conf.stats->n_read = count_known(conf.stats);
+  return 0;
+}
+
+template int stats_open<double>(Config & conf);
+template int stats_open<float>(Config & conf);
@@ -0,0 +1,94 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <vector>
+#include "utils.h"
+
+/* Per sample statistics of the traces attacked, reused by the following key
+ * bytes and persisted in the file stats_cache between the runs. The sums are
+ * the ones of the samples typecast to TypeReturn, over the selected traces,
+ * so that the cached values are the ones the engines would compute.
+ */
+struct SampleStats {
+
+  /* Identifies the traces, the selection and the transformations of the
+   * samples the statistics are valid for.
+   */
+  uint64_t key;
+  int n_samples;
+
+  /* known[s] tells which of sum[s] (STATS_SUM) and sum_sq[s] (STATS_SUM_SQ)
+   * are already computed for the logical sample s.
+   */
+  vector<char> known;
+  vector<double> sum;
+  vector<double> sum_sq;
+
+  /* Number of statistics known when the cache was read, to tell whether
+   * new ones were computed since.
+   */
+  long int n_read;
+};
+
+#define STATS_SUM    1
+#define STATS_SUM_SQ 2
+
+/* Identifies the content of the trace files and the selection of the traces,
+ * for the caches of the values computed from them.
+ */
+uint64_t traces_key(const Config & conf);
+
+/* Sets conf.stats to the statistics of the samples currently attacked, read
+ * from stats_cache when the traces and the parameters did not change. The
+ * statistics are kept across the calls as long as the key does not change.
+ */
+template <class TypeReturn>
+int stats_open(Config & conf);
+
+/* Writes the statistics computed since stats_open to stats_cache, replacing
+ * any previous record with the same key.
+ */
+int stats_save(Config & conf);
+
+/* Returns true if the statistics flag of the logical sample s are known.
+ */
+static inline bool stats_get(const SampleStats * stats, int s, char flag)
+{
+  return stats != NULL && s < stats->n_samples && (stats->known[s] & flag) == flag;
+}
+
+/* Records the statistics of the logical sample s. Every thread writes its own
+ * samples, so that no lock is needed.
+ */
+static inline void stats_put(SampleStats * stats, int s, char flag, double sum, double sum_sq)
+{
+  if (stats == NULL || s >= stats->n_samples)
+    return;
+  stats->sum[s] = sum;
+  if (flag & STATS_SUM_SQ)
+    stats->sum_sq[s] = sum_sq;
+  stats->known[s] |= flag;
+}
+
+#endif
@@ -0,0 +1,319 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "ttest.h"
+#include "loader.h"
+#include "workers.h"
+
+/* Number of traces of a block, whose moments are computed directly before
+ * being merged.
+ */
+#define TTEST_BLOCK 4096
+
+void Moments::merge(const Moments & b)
+{
+  double na = n, nb = b.n, nt = na + nb, d, d2;
+
+  if (nb == 0)
+    return;
+  if (na == 0) {
+    *this = b;
+    return;
+  }
+  d = b.mean - mean;
+  d2 = d * d;
+  m4 += b.m4 + d2 * d2 * na * nb * (na * na - na * nb + nb * nb) / (nt * nt * nt)
+    + 6 * d2 * (na * na * b.m2 + nb * nb * m2) / (nt * nt)
+    + 4 * d * (na * b.m3 - nb * m3) / nt;
+  m3 += b.m3 + d2 * d * na * nb * (na - nb) / (nt * nt)
+    + 3 * d * (na * b.m2 - nb * m2) / nt;
+  m2 += b.m2 + d2 * na * nb / nt;
+  mean += d * nb / nt;
+  n = nt;
+}
+
+/* Structure used by the threads testing a slice of the samples of a chunk.
+ */
+template <class TypeTrace>
+struct TtestSamples {
+
+  TypeTrace ** trace;
+  const double * label;
+  int n_traces;
+  int start;
+  int length;
+  double * t1;
+  double * t2;
+
+  TtestSamples(TypeTrace ** tr, const double * l, int nt, int st, int len, double * a, double * b):
+    trace(tr), label(l), n_traces(nt), start(st), length(len), t1(a), t2(b) {
+  }
+};
+
+/* Moments of the two populations of a block. The label is used as a weight
+ * (0 or 1) rather than as an index, so that the loops are vectorized.
+ */
+  template <class TypeTrace>
+static void block_moments(const TypeTrace * x, const double * l, int n, Moments pop[2])
+{
+  double s = 0, s1 = 0, c1 = 0, m0, m1, d, d2,
+         a[3] = {0, 0, 0}, a1[3] = {0, 0, 0};
+  int t;
+
+  for (t = 0; t < n; t++) {
+    s += x[t];
+    s1 += l[t] * x[t];
+    c1 += l[t];
+  }
+  m1 = c1 > 0 ? s1 / c1 : 0;
+  m0 = c1 < n ? (s - s1) / (n - c1) : 0;
+
+  for (t = 0; t < n; t++) {
+    d = x[t] - (m0 + l[t] * (m1 - m0));
+    d2 = d * d;
+    a[0] += d2;
+    a[1] += d2 * d;
+    a[2] += d2 * d2;
+    a1[0] += l[t] * d2;
+    a1[1] += l[t] * d2 * d;
+    a1[2] += l[t] * d2 * d2;
+  }
+
+  pop[0].n = n - c1;
+  pop[0].mean = m0;
+  pop[0].m2 = a[0] - a1[0];
+  pop[0].m3 = a[1] - a1[1];
+  pop[0].m4 = a[2] - a1[2];
+  pop[1].n = c1;
+  pop[1].mean = m1;
+  pop[1].m2 = a1[0];
+  pop[1].m3 = a1[1];
+  pop[1].m4 = a1[2];
+}
+
+static double welch(double mean0, double var0, double n0, double mean1, double var1, double n1)
+{
+  double den = sqrt(var0 / n0 + var1 / n1);
+  return den > 0 ? (mean0 - mean1) / den : 0;
+}
+
+  template <class TypeTrace>
+static void * ttest_samples(void * args_in)
+{
+  TtestSamples<TypeTrace> * T = (TtestSamples<TypeTrace> *) args_in;
+  Moments pop[2], block[2];
+  double v0, v1;
+  int i, t;
+
+  for (i = T->start; i < T->start + T->length; i++) {
+    pop[0] = pop[1] = Moments();
+    for (t = 0; t < T->n_traces; t += TTEST_BLOCK) {
+      block_moments(T->trace[i] + t, T->label + t, min(TTEST_BLOCK, T->n_traces - t), block);
+      pop[0].merge(block[0]);
+      pop[1].merge(block[1]);
+    }
+
+    /* First order: the means, second order: the centered squares.
+     */
+    T->t1[i] = welch(pop[0].mean, pop[0].m2 / (pop[0].n - 1), pop[0].n,
+        pop[1].mean, pop[1].m2 / (pop[1].n - 1), pop[1].n);
+    if (T->t2 != NULL) {
+      v0 = pop[0].m2 / pop[0].n;
+      v1 = pop[1].m2 / pop[1].n;
+      T->t2[i] = welch(v0, pop[0].m4 / pop[0].n - v0 * v0, pop[0].n,
+          v1, pop[1].m4 / pop[1].n - v1 * v1, pop[1].n);
+    }
+  }
+  return NULL;
+}
+
+/* Computes the population (0 or 1) of every selected trace, returns -1 on
+ * failure.
+ */
+static int ttest_labels(Config & conf, vector<double> & label)
+{
+  uint8_t ** mem = NULL;
+  int n_rows = 0;
+
+  label.resize(conf.n_traces);
+
+  if (conf.ttest == 'l') {
+    vector<uint8_t> all(conf.total_n_traces);
+    FILE * f = fopen(conf.ttest_labels.c_str(), "rb");
+    if (f == NULL) {
+      fprintf(stderr, "[ERROR] Opening %s.\n", conf.ttest_labels.c_str());
+      return -1;
+    }
+    size_t n = fread(&all[0], 1, conf.total_n_traces, f);
+    fclose(f);
+    if ((int) n != conf.total_n_traces) {
+      fprintf(stderr, "[ERROR] %lu labels in %s, %i expected.\n", n, conf.ttest_labels.c_str(), conf.total_n_traces);
+      return -1;
+    }
+    for (int j = 0; j < conf.n_traces; j++)
+      label[j] = all[conf.trace_index.empty() ? j : conf.trace_index[j]] != 0;
+    return 0;
+  }
+
+  /* Population 0 holds the traces of the fixed plaintext.
+   */
+  for (int i = 0; i < conf.n_file_guess; i++) {
+    if (conf.guesses[i].n_columns < conf.ttest_fixed.size()) {
+      fprintf(stderr, "[ERROR] The fixed plaintext is longer than the guess files.\n");
+      return -1;
+    }
+    n_rows += conf.guesses[i].n_rows;
+  }
+  if (import_matrices(&mem, conf.guesses, conf.n_file_guess, 0) < 0) {
+    fprintf(stderr, "[ERROR] Importing the plaintexts.\n");
+    return -1;
+  }
+  for (int j = 0; j < conf.n_traces; j++) {
+    uint8_t * p = mem[conf.trace_index.empty() ? j : conf.trace_index[j]];
+    label[j] = memcmp(p, &conf.ttest_fixed[0], conf.ttest_fixed.size()) != 0;
+  }
+  free_matrix(&mem, n_rows);
+  return 0;
+}
+
+/* Prints the number of samples exceeding the threshold and the strongest
+ * ones.
+ */
+static void print_ttest(Config & conf, double * t, int order)
+{
+  vector<pair<double, int> > best;
+  int n_top, n_exceeding = 0;
+
+  for (int s = 0; s < conf.n_samples; s++) {
+    if (fabs(t[s]) > conf.ttest_threshold)
+      n_exceeding++;
+    best.push_back(make_pair(fabs(t[s]), s));
+  }
+  n_top = min(conf.top, n_exceeding);
+  partial_sort(best.begin(), best.begin() + n_top, best.end(), greater<pair<double, int> >());
+
+  if (conf.sep != "") {
+    printf("%i%s%i\n", order, conf.sep.c_str(), n_exceeding);
+    return;
+  }
+  printf("[T-TEST] Order %i: %i samples with |t| > %g.\n", order, n_exceeding, conf.ttest_threshold);
+  for (int i = 0; i < n_top; i++)
+    printf("%2i: %8i  t: %g\n", i + 1, sample_index(conf, best[i].second), t[best[i].second]);
+  printf("\n");
+}
+
+  template <class TypeTrace>
+int ttest(Config & conf)
+{
+  int res, n, n_threads, workload,
+      n_samples = conf.n_samples,
+      ncol = min(get_ncol<TypeTrace>(conf.memory, conf.n_traces), n_samples);
+  TypeTrace ** traces = NULL;
+  double * t1 = NULL, * t2 = NULL, start, end;
+  vector<double> label;
+  int n0 = 0;
+
+  if (ncol <= 0) {
+    fprintf(stderr, "[ERROR] Invalid parameters ncol(=%i).\n", ncol);
+    return -1;
+  }
+
+  res = ttest_labels(conf, label);
+  if (res != 0)
+    return -1;
+  for (int j = 0; j < conf.n_traces; j++)
+    n0 += label[j] == 0;
+  if (n0 < 2 || conf.n_traces - n0 < 2) {
+    fprintf(stderr, "[ERROR] Populations of %i and %i traces.\n", n0, conf.n_traces - n0);
+    return -1;
+  }
+  if (conf.sep == "")
+    printf("[T-TEST] Populations of %i and %i traces.\n\n", n0, conf.n_traces - n0);
+
+  TraceLoader<TypeTrace> loader(conf, ncol);
+  res = loader.init();
+  if (res != 0) {
+    fprintf(stderr, "[ERROR] Initializing the trace loader in ttest.\n");
+    return -1;
+  }
+  res = allocate_matrix(&traces, ncol, conf.n_traces, MEM_TRACES);
+  t1 = (double *) malloc(n_samples * sizeof(double));
+  if (conf.attack_order >= 2)
+    t2 = (double *) malloc(n_samples * sizeof(double));
+  if (res != 0 || t1 == NULL || (conf.attack_order >= 2 && t2 == NULL)) {
+    fprintf(stderr, "[ERROR] Allocating memory in ttest.\n");
+    return -1;
+  }
+
+  start = omp_get_wtime();
+  for (int s = 0; s < n_samples; s += ncol) {
+    int to_load = min(ncol, n_samples - s);
+    res = loader.load(traces, 0, s, to_load);
+    if (res != 0) {
+      fprintf(stderr, "[ERROR] Loading file.\n");
+      return -1;
+    }
+
+    n_threads = min(conf.n_threads, to_load);
+    workload = to_load / n_threads;
+    vector<TtestSamples<TypeTrace> > ta;
+    ta.reserve(n_threads);
+    for (n = 0; n < n_threads; n++) {
+      ta.push_back(TtestSamples<TypeTrace>(traces, &label[0], conf.n_traces, n*workload, workload + ((n + 1) / n_threads) * (to_load % n_threads), t1 + s, t2 == NULL ? NULL : t2 + s));
+    }
+    res = workers_run(ttest_samples<TypeTrace>, ta);
+    if (res != 0)
+      return -1;
+  }
+  end = omp_get_wtime();
+
+  print_ttest(conf, t1, 1);
+  if (t2 != NULL)
+    print_ttest(conf, t2, 2);
+
+  if (conf.ttest_file != "") {
+    FILE * out = fopen(conf.ttest_file.c_str(), "w");
+    if (out == NULL) {
+      fprintf(stderr, "[ERROR] Opening %s.\n", conf.ttest_file.c_str());
+      return -1;
+    }
+    for (int s = 0; s < n_samples; s++) {
+      if (t2 != NULL)
+        fprintf(out, "%i %g %g\n", sample_index(conf, s), t1[s], t2[s]);
+      else
+        fprintf(out, "%i %g\n", sample_index(conf, s), t1[s]);
+    }
+    fclose(out);
+  }
+  if (conf.sep == "")
+    printf("[INFO] T-test done in %lf seconds.\n\n", end - start);
+
+  free(t1);
+  free(t2);
+  free_matrix(&traces, ncol);
+  return 0;
+}
+
+template int ttest<float>(Config & conf);
+template int ttest<double>(Config & conf);
+template int ttest<int8_t>(Config & conf);
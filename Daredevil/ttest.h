@@ -0,0 +1,47 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#ifndef TTEST_H
+#define TTEST_H
+
+#include "utils.h"
+
+/* Central moments of a set of values, which can be merged with the moments
+ * of another set (Pebay's formulas), so that the sets can be processed block
+ * by block.
+ */
+struct Moments {
+
+  double n, mean, m2, m3, m4;
+
+  Moments(): n(0), mean(0), m2(0), m3(0), m4(0) {
+  }
+
+  void merge(const Moments & b);
+};
+
+/* Welch's t-test between the two populations of traces given by the labels
+ * file or the fixed plaintext, at the first and, with order=2, second order.
+ * The samples of which |t| exceeds the threshold are reported.
+ */
+template <class TypeTrace>
+int ttest(Config & conf);
+
+#endif
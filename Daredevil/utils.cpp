@@ -32,10 +32,12 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
 #include "utils.h"
 #include "aes.h"
 #include "des.h"
 #include "cpa.h"
+#include "affinity.h"
 
 // TODO: fix trailing spaces problem in parsing config file
 
@@ -43,7 +45,7 @@
   template <class Type>
 int import_matrices(Type *** mem, Matrix * matrices,
     unsigned int n_matrices, bool transpose,
-    int first_sample, int n_samples)
+    int first_sample, int n_samples, MemTag tag)
 {
 
   unsigned int i, j, k, res,
@@ -80,9 +82,9 @@ int import_matrices(Type *** mem, Matrix * matrices,
     else
       total_n_rows = matrices[0].n_rows;
     if(transpose)
-      res = allocate_matrix(mem, total_n_columns, total_n_rows);
+      res = allocate_matrix(mem, total_n_columns, total_n_rows, tag);
     else
-      res = allocate_matrix(mem, total_n_rows, total_n_columns);
+      res = allocate_matrix(mem, total_n_rows, total_n_columns, tag);
     if(res != 0)
       return -1;
   }
@@ -393,8 +395,7 @@ int load_file(const char str[], Type *** mem, int n_rows, int n_columns, long in
     return -1;
   }
 
-  *mem = (Type **) malloc (n_rows * sizeof(Type *));
-  if (*mem == NULL) {
+  if (allocate_matrix(mem, n_rows, n_columns) != 0) {
     fprintf (stderr, "Error: allocating memory failed.\n");
     return -1;
   }
@@ -406,12 +407,6 @@ int load_file(const char str[], Type *** mem, int n_rows, int n_columns, long in
   }
 
   for (i=0; i < n_rows; i++) {
-    (*mem)[i] = (Type *) malloc (n_columns * sizeof(Type));
-    if ((*mem)[i] == NULL) {
-      fprintf (stderr, "Error: allocating memory failed.\n");
-      return -1;
-    }
-
     res = fread ((*mem)[i], sizeof(Type), n_columns, file);
     if (res < n_columns) {
       fprintf (stderr, "Error: fread < 0 when reading file %s\n", str);
@@ -439,33 +434,163 @@ int load_file(const char str[], Type *** mem, int n_rows, int n_columns, long in
 int get_ncol(long int memsize, int ntraces)
 {
   // We use 60% of the available memory. We never know what can happen :)
-  return (0.6*memsize)/(sizeof(Type)*ntraces);
+  return (0.6*memsize)/(sizeof(Type)*row_length<Type>(ntraces));
 }
 
+/* Returns the value of the first line of path, -1 if it cannot be read or
+ * is not a number (e.g. "max").
+ */
+static long int read_value(const string & path)
+{
+  ifstream fin(path.c_str());
+  string line;
 
+  if (!getline(fin, line) || line.empty() || line[0] < '0' || line[0] > '9')
+    return -1;
+  return atol(line.c_str());
+}
+
+/* Returns the smallest of res and of the room left by the limits of the
+ * cgroup dir and of its parents, mounted at root.
+ */
+static long int cgroup_room(long int res, const string & root, string dir, const char * limit_file, const char * usage_file)
+{
+  long int limit, used;
+
+  while (true) {
+    limit = read_value(root + dir + "/" + limit_file);
+    used = read_value(root + dir + "/" + usage_file);
+    if (limit >= 0 && used >= 0 && (res < 0 || limit - used < res))
+      res = max(0L, limit - used);
+    if (dir.empty() || dir == "/")
+      return res;
+    dir = dir.substr(0, dir.rfind('/'));
+  }
+}
+
+long int available_memory()
+{
+  long int res = -1;
+  ifstream fin;
+  string line;
+
+  fin.open("/proc/meminfo");
+  while (getline(fin, line)) {
+    if (line.compare(0, 13, "MemAvailable:") == 0) {
+      res = atol(line.substr(13).c_str()) * 1024;
+      break;
+    }
+  }
+  fin.close();
+
+  /* The cgroup of the unified hierarchy (v2) is given by the line "0::path"
+   * of /proc/self/cgroup, the one of the memory controller of v1 by
+   * "n:memory:path".
+   */
+  fin.open("/proc/self/cgroup");
+  while (getline(fin, line)) {
+    size_t colon = line.find(':');
+    if (colon == string::npos)
+      continue;
+    string controllers = line.substr(colon + 1, line.find(':', colon + 1) - colon - 1),
+        dir = line.substr(line.find(':', colon + 1) + 1);
+    if (line.compare(0, 3, "0::") == 0)
+      res = cgroup_room(res, "/sys/fs/cgroup", dir, "memory.max", "memory.current");
+    else if (controllers == "memory")
+      res = cgroup_room(res, "/sys/fs/cgroup/memory", dir, "memory.limit_in_bytes", "memory.usage_in_bytes");
+  }
+  fin.close();
+  return res;
+}
+
+  template <class TypeReturn>
+void plan_attack(const Config & conf, MemoryPlan & plan)
+{
+  long int n_threads = conf.n_threads;
+
+  for (int i = 0; i < conf.n_file_guess; i++)
+    plan.fixed += (long int) conf.guesses[i].n_rows * conf.guesses[i].n_columns + MATRIX_ALIGN;
+  plan.fixed += conf.total_n_traces * sizeof(uint16_t);
+  plan.fixed += conf.n_samples * (sizeof(char) + 2 * sizeof(double));
+  plan.fixed += n_threads * (conf.total_n_keys * sizeof(CorrSecondOrder<TypeReturn>) + conf.n_traces * sizeof(TypeReturn) + 4 * MATRIX_ALIGN);
+  plan.fixed += (n_threads + 1) * conf.top * conf.total_n_keys * sizeof(CorrSecondOrder<TypeReturn>);
+
+  /* The representative and sign of every sample, its hash and sign while
+   * grouping and about 64 bytes of hash table.
+   */
+  if (conf.dedup_samples)
+    plan.per_col += sizeof(int) + sizeof(uint64_t) + 2 * sizeof(int8_t) + 64;
+}
+
+int plan_ncol(const Config & conf, const MemoryPlan & plan, int n_samples, const char * engine)
+{
+  /* 5% of the memory, and at least 64MB, are left to the system, the
+   * allocator and the small buffers not accounted for.
+   */
+  long int budget = conf.memory - max(conf.memory / 20, (long int) (64 * MEGA)),
+      ncol = 0;
+
+  if (plan.per_col > 0 && budget > plan.fixed)
+    ncol = min((long int) n_samples, (budget - plan.fixed) / plan.per_col);
+
+  if (conf.sep == "")
+    printf("[INFO] Memory plan (%s): %.2fGB available, %.2fMB fixed, %.2fKB by sample, %li of %i samples at a time.\n",
+        engine, conf.memory / GIGA, plan.fixed / MEGA, plan.per_col / 1024.0, ncol, n_samples);
+  return (int) ncol;
+}
+
+
+/* Whether the large matrices are advised to be backed by huge pages.
+ */
+static bool huge_pages = false;
+
+void set_huge_pages(bool enable)
+{
+  huge_pages = enable;
+}
+
+/* The rows of a matrix are in a single block, the first row at its start.
+ */
   template <class Type>
 void free_matrix(Type *** matrix, int n_rows)
 {
-  for (int i=0; i < n_rows; i++) {
-    free((*matrix)[i]);
-  }
-  free(*matrix);
+  if (*matrix == NULL)
+    return;
+  if (n_rows > 0)
+    mem_free((*matrix)[0]);
+  mem_free(*matrix);
 }
 
-/* Allocates the array matrix
+/* Allocates the array matrix as a single block aligned on MATRIX_ALIGN bytes,
+ * the rows following each other every matrix_stride<Type>(n_columns)
+ * elements. Blocks of at least a huge page are aligned on the huge pages and
+ * advised to be backed by them if enabled.
  */
   template <class Type>
-int allocate_matrix(Type *** matrix, int n_rows, int n_columns)
+int allocate_matrix(Type *** matrix, int n_rows, int n_columns, MemTag tag)
 {
-  *matrix = (Type **)malloc(n_rows * sizeof(Type *));
+  size_t stride = matrix_stride<Type>(n_columns),
+         size = max((size_t) n_rows * stride * sizeof(Type), (size_t) MATRIX_ALIGN),
+         align = (size >= HUGE_PAGE_SIZE) ? HUGE_PAGE_SIZE : MATRIX_ALIGN;
+  void * block = NULL;
+
+  *matrix = (Type **) mem_alloc(max(n_rows, 1) * sizeof(Type *), tag);
   if(*matrix == NULL)
     return -1;
 
-  for (int i=0; i < n_rows; i++) {
-    (*matrix)[i] = (Type *) malloc (n_columns * sizeof(Type));
-    if((*matrix)[i] == NULL)
-      return -1;
+  block = mem_alloc(size, tag, align);
+  if (block == NULL) {
+    mem_free(*matrix);
+    *matrix = NULL;
+    return -1;
   }
+#ifdef MADV_HUGEPAGE
+  if (huge_pages && size >= HUGE_PAGE_SIZE)
+    madvise(block, size, MADV_HUGEPAGE);
+#endif
+
+  for (int i=0; i < n_rows; i++)
+    (*matrix)[i] = (Type *) block + (size_t) i * stride;
   return 0;
 }
 
@@ -535,11 +660,10 @@ int parse_sbox_file(const char * fname, uint16_t ** sbox)
     return -1;
   }
 
-  *sbox = (uint16_t *) malloc(data.size()*sizeof(uint16_t));
+  *sbox = (uint16_t *) mem_alloc(data.size()*sizeof(uint16_t), MEM_GUESSES);
 
   if (*sbox == NULL){
     cerr << "[ERROR]: Allocating memory for lookup table" << endl;
-    free(*sbox);
     return -1;
   }
   int j = 0;
@@ -598,6 +722,24 @@ int parse_args(int argc, char * argv[], char ** config_file)
   return 0;
 }
 
+/* Returns the bytes of a memory size with a G (Giga) or M (Mega) suffix, -1
+ * for any other suffix.
+ */
+static long int memory_size(const string & tmp)
+{
+  long int suffix;
+
+  if (tmp.empty())
+    return -1;
+  if (tmp[tmp.size()-1] == 'G')
+    suffix = GIGA;
+  else if (tmp[tmp.size()-1] == 'M')
+    suffix = MEGA;
+  else
+    return -1;
+  return (long int)(atof(tmp.substr(0, tmp.size() - 1).c_str())*suffix);
+}
+
 int load_config(Config & config, const char * conf_file)
 {
 
@@ -637,6 +779,9 @@ int load_config(Config & config, const char * conf_file)
   config.transpose_traces = true;
   config.transpose_guesses = true;
   config.memory = 4*GIGA;
+  config.memory_auto = false;
+  config.memory_cap = 0;
+  config.memory_report = false;
   config.key_size = 0;
   config.top = 50;
   config.des_switch = DES_8_64;
@@ -645,13 +790,209 @@ int load_config(Config & config, const char * conf_file)
   config.bitnum = -2;
   config.complete_correct_key = NULL;
   config.original_correct_key = NULL;
+  config.dedup_samples = false;
+  config.dedup_traces = false;
+  config.dedup_done = false;
+  config.sample_score = NULL;
+  config.poi_subset = 0;
+  config.poi_count = 10;
+  config.poi_margin = 50;
+  config.pool = 0;
+  config.pool_window = 1;
+  config.pool_stride = 0;
+  config.quality_filter = false;
+  config.quality_done = false;
+  config.quality_z = 5;
+  config.quality_clip = 0;
+  config.quality_clip_ratio = 0.01;
+  config.align_first = 0;
+  config.align_length = 0;
+  config.align_shift = 50;
+  config.align_threshold = -1;
+  config.align_output = "";
+  config.dtw_band = 0;
+  config.dtw_penalty = 12;
+  config.dtw_output = "";
+  config.dtw_cache = "";
+  config.pca_components = 0;
+  config.pca_train = 1000;
+  config.projected = NULL;
+  config.snr = 0;
+  config.snr_file = "";
+  config.ttest = 0;
+  config.ttest_labels = "";
+  config.ttest_threshold = 4.5;
+  config.ttest_file = "";
+  config.quant_bits = 0;
+  config.quant_per_sample = true;
+  config.quant_train = 1000;
+  config.stats_cache = "";
+  config.affinity = AFFINITY_NONE;
+  config.numa_policy = NUMA_NONE;
+  config.joint_bytes = false;
+  config.huge_pages = false;
+  config.onthefly_guesses = false;
+  config.stats = NULL;
 
   while (getline(fin, line)) {
     if (line[0] == '#'){
       // The line is a comment so we just skip it.
       continue;
     }
-    if (line.find("[Traces]") != string::npos) {
+    /* Options whose name contains the name of another option (e.g. trace)
+     * must be checked first.
+     */
+    if (line.find("dedup_traces") != string::npos) {
+      string tmp = line.substr(line.find("=") + 1);
+      config.dedup_traces = (tmp[0] == 't' ? true : false);
+    }else if (line.find("memory_report") != string::npos) {
+      string tmp = line.substr(line.find("=") + 1);
+      config.memory_report = (tmp[0] == 't' ? true : false);
+    }else if (line.find("memory_cap") != string::npos) {
+      long int cap = memory_size(line.substr(line.find("=") + 1));
+      if (cap < 0) {
+        fprintf(stderr, "Error: Unsupported memory cap, ignoring it.\n");
+        continue;
+      }
+      config.memory_cap = cap;
+    }else if (line.find("onthefly_guesses") != string::npos) {
+      string tmp = line.substr(line.find("=") + 1);
+      config.onthefly_guesses = (tmp[0] == 't' ? true : false);
+    }else if (line.find("huge_pages") != string::npos) {
+      string tmp = line.substr(line.find("=") + 1);
+      config.huge_pages = (tmp[0] == 't' ? true : false);
+    }else if (line.find("joint_bytes") != string::npos) {
+      string tmp = line.substr(line.find("=") + 1);
+      config.joint_bytes = (tmp[0] == 't' ? true : false);
+    }else if (line.find("affinity") != string::npos) {
+      string tmp = line.substr(line.find("=") + 1);
+      if (tmp == "compact")
+        config.affinity = AFFINITY_COMPACT;
+      else if (tmp == "scatter")
+        config.affinity = AFFINITY_SCATTER;
+      else if (tmp != "none") {
+        fprintf(stderr, "Error: unknown thread affinity %s.\n", tmp.c_str());
+        return -1;
+      }
+    }else if (line.find("numa") != string::npos) {
+      string tmp = line.substr(line.find("=") + 1);
+      if (tmp == "interleave")
+        config.numa_policy = NUMA_INTERLEAVE;
+      else if (tmp == "local")
+        config.numa_policy = NUMA_LOCAL;
+      else if (tmp != "none") {
+        fprintf(stderr, "Error: unknown NUMA policy %s.\n", tmp.c_str());
+        return -1;
+      }
+    }else if (line.find("stats_cache") != string::npos) {
+      config.stats_cache = line.substr(line.find("=") + 1);
+    }else if (line.find("quantize_scale") != string::npos) {
+      string tmp = line.substr(line.find("=") + 1);
+      config.quant_per_sample = (tmp[0] == 's' ? true : false);
+    }else if (line.find("quantize_train") != string::npos) {
+      config.quant_train = atoi(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("quantize") != string::npos) {
+      string tmp = line.substr(line.find("=") + 1);
+      if (tmp == "int8")
+        config.quant_bits = 8;
+      else if (tmp == "int16")
+        config.quant_bits = 16;
+      else if (tmp != "none") {
+        fprintf(stderr, "Error: unknown quantization %s.\n", tmp.c_str());
+        return -1;
+      }
+    }else if (line.find("dedup_samples") != string::npos) {
+      string tmp = line.substr(line.find("=") + 1);
+      config.dedup_samples = (tmp[0] == 't' ? true : false);
+    }else if (line.find("poi_subset") != string::npos) {
+      config.poi_subset = atoi(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("poi_count") != string::npos) {
+      config.poi_count = atoi(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("poi_margin") != string::npos) {
+      config.poi_margin = atoi(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("quality_filter") != string::npos) {
+      string tmp = line.substr(line.find("=") + 1);
+      config.quality_filter = (tmp[0] == 't' ? true : false);
+    }else if (line.find("quality_z") != string::npos) {
+      config.quality_z = atof(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("quality_clip_ratio") != string::npos) {
+      config.quality_clip_ratio = atof(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("quality_clip") != string::npos) {
+      config.quality_clip = atof(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("dtw_band") != string::npos) {
+      config.dtw_band = atoi(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("dtw_penalty") != string::npos) {
+      config.dtw_penalty = atof(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("dtw_output") != string::npos) {
+      config.dtw_output = line.substr(line.find("=") + 1);
+    }else if (line.find("dtw_cache") != string::npos) {
+      config.dtw_cache = line.substr(line.find("=") + 1);
+    }else if (line.find("align_window") != string::npos) {
+      sscanf(line.substr(line.find("=") + 1).c_str(), "%i %i", &config.align_first, &config.align_length);
+    }else if (line.find("align_shift") != string::npos) {
+      config.align_shift = atoi(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("align_threshold") != string::npos) {
+      config.align_threshold = atof(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("align_output") != string::npos) {
+      config.align_output = line.substr(line.find("=") + 1);
+    }else if (line.find("ttest_labels") != string::npos) {
+      config.ttest_labels = line.substr(line.find("=") + 1);
+    }else if (line.find("ttest_fixed") != string::npos) {
+      string tmp = line.substr(line.find("=") + 1);
+      if (tmp.substr(0, 2) == "0x")
+        tmp = tmp.substr(2);
+      config.ttest_fixed.clear();
+      for (size_t i = 0; i + 1 < tmp.size(); i += 2)
+        config.ttest_fixed.push_back((uint8_t) strtoul(tmp.substr(i, 2).c_str(), NULL, 16));
+    }else if (line.find("ttest_threshold") != string::npos) {
+      config.ttest_threshold = atof(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("ttest_file") != string::npos) {
+      config.ttest_file = line.substr(line.find("=") + 1);
+    }else if (line.find("ttest") != string::npos) {
+      string tmp = line.substr(line.find("=") + 1);
+      if (tmp == "labels")
+        config.ttest = 'l';
+      else if (tmp == "fixed")
+        config.ttest = 'f';
+      else if (tmp != "none") {
+        fprintf(stderr, "Error: unknown ttest populations %s.\n", tmp.c_str());
+        return -1;
+      }
+    }else if (line.find("snr_file") != string::npos) {
+      config.snr_file = line.substr(line.find("=") + 1);
+    }else if (line.find("snr") != string::npos) {
+      string tmp = line.substr(line.find("=") + 1);
+      if (tmp == "plaintext")
+        config.snr = 'p';
+      else if (tmp == "model")
+        config.snr = 'm';
+      else if (tmp != "none") {
+        fprintf(stderr, "Error: unknown snr classes %s.\n", tmp.c_str());
+        return -1;
+      }
+    }else if (line.find("pca_components") != string::npos) {
+      config.pca_components = atoi(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("pca_train") != string::npos) {
+      config.pca_train = atoi(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("pool_window") != string::npos) {
+      config.pool_window = atoi(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("pool_stride") != string::npos) {
+      config.pool_stride = atoi(line.substr(line.find("=") + 1).c_str());
+    }else if (line.find("pooling") != string::npos) {
+      string tmp = line.substr(line.find("=") + 1);
+      if (tmp == "sum")
+        config.pool = 's';
+      else if (tmp == "mean")
+        config.pool = 'm';
+      else if (tmp == "maxabs")
+        config.pool = 'a';
+      else if (tmp == "sumsq")
+        config.pool = 'q';
+      else if (tmp != "none") {
+        fprintf(stderr, "Error: unknown pooling %s.\n", tmp.c_str());
+        return -1;
+      }
+    }else if (line.find("[Traces]") != string::npos) {
       traces = true;
       i_traces = 0;
     }else if (line.find("ntraces") != string::npos) {
@@ -805,17 +1146,16 @@ int load_config(Config & config, const char * conf_file)
       config.top = atoi(line.substr(line.find("=") + 1).c_str());
     }else if (line.find("memory") != string::npos) {
       string tmp = line.substr(line.find("=") + 1);
-      long int suffix;
-      if (tmp[tmp.size()-1] == 'G')
-        suffix = GIGA;
-      else if (tmp[tmp.size()-1] == 'M')
-        suffix = MEGA;
-      else{
+      if (tmp == "auto") {
+        config.memory_auto = true;
+        continue;
+      }
+      long int memory = memory_size(tmp);
+      if (memory < 0) {
         fprintf(stderr, "Error: Unsupported memory size, using default instead.\n");
         continue;
       }
-      //printf("%s %li %f\n", tmp.c_str(), tmp.size(), atof(tmp.substr(0, tmp.size() - 1).c_str()));
-      config.memory = (long int)(atof(tmp.substr(0, tmp.size() - 1).c_str())*suffix);
+      config.memory = memory;
     }
 
   }
@@ -892,7 +1232,7 @@ int load_config(Config & config, const char * conf_file)
   /* If we don't specify a smaller subset fot the target number of traces,
    * we automatically treat the whole set.
    */
-  if (config.n_traces == 0)
+  if (config.n_traces == 0 || config.n_traces > config.total_n_traces)
     config.n_traces = config.total_n_traces;
 
   /* For the number of samples, if we don't specify the number of samples, but
@@ -905,12 +1245,116 @@ int load_config(Config & config, const char * conf_file)
     else
       config.n_samples = config.total_n_samples;
   }
+  /* With pooling, n_samples becomes the number of pooled points. The stride
+   * defaults to the pooling window, i.e. non overlapping windows.
+   */
+  if (config.pool == 0) {
+    config.pool_window = 1;
+    config.pool_stride = 1;
+  } else {
+    if (config.pool_stride <= 0)
+      config.pool_stride = config.pool_window;
+    if (config.pool_window <= 0 || config.pool_window > config.n_samples) {
+      fprintf(stderr, "Error: invalid pooling window %i.\n", config.pool_window);
+      return -1;
+    }
+    if (config.type_trace == 'i' && config.pool != 'm') {
+      fprintf(stderr, "Error: only mean pooling is supported for int8 traces.\n");
+      return -1;
+    }
+    config.n_samples = (config.n_samples - config.pool_window) / config.pool_stride + 1;
+  }
+
+  if (config.dtw_band > 0) {
+    if (config.dtw_output == "") {
+      fprintf(stderr, "Error: dtw_band needs dtw_output.\n");
+      return -1;
+    }
+    if (config.align_length > 0) {
+      fprintf(stderr, "Error: static and elastic alignments cannot be combined.\n");
+      return -1;
+    }
+    if (config.dtw_penalty < 0) {
+      fprintf(stderr, "Error: dtw_penalty cannot be negative.\n");
+      return -1;
+    }
+  }
+
+  if (config.ttest == 'l' && config.ttest_labels == "") {
+    fprintf(stderr, "Error: ttest=labels needs ttest_labels.\n");
+    return -1;
+  }
+  if (config.ttest == 'f' && config.ttest_fixed.empty()) {
+    fprintf(stderr, "Error: ttest=fixed needs ttest_fixed.\n");
+    return -1;
+  }
+
+  if (config.pca_components > 0) {
+    if (config.type_trace == 'i') {
+      fprintf(stderr, "Error: PCA is not supported for int8 traces.\n");
+      return -1;
+    }
+    if (config.poi_subset > 0) {
+      fprintf(stderr, "Error: PCA and localization cannot be combined.\n");
+      return -1;
+    }
+  }
+
+  if (config.quant_bits > 0) {
+    if (config.type_trace == 'i') {
+      fprintf(stderr, "Error: int8 traces cannot be quantized.\n");
+      return -1;
+    }
+    if (config.attack_order != 1) {
+      fprintf(stderr, "Error: quantization is only supported by the first order attack.\n");
+      return -1;
+    }
+    if (config.poi_subset > 0) {
+      fprintf(stderr, "Error: quantization and localization cannot be combined.\n");
+      return -1;
+    }
+    if (config.quant_train < 2) {
+      fprintf(stderr, "Error: invalid number of quantization traces %i.\n", config.quant_train);
+      return -1;
+    }
+  }
+
+  if (config.type_trace == 'b') {
+    if (config.pool || config.align_length > 0 || config.dtw_band > 0 || config.pca_components > 0
+        || config.quant_bits > 0 || config.quality_filter || config.ttest || config.snr) {
+      fprintf(stderr, "Error: bit-packed traces cannot be pooled, aligned, projected, quantized, filtered nor used by snr and ttest.\n");
+      return -1;
+    }
+    if (config.type_return != 'd') {
+      fprintf(stderr, "Error: bit-packed traces need return_type=double.\n");
+      return -1;
+    }
+  }
+
+  if (config.numa_policy == NUMA_LOCAL && config.affinity == AFFINITY_NONE) {
+    fprintf(stderr, "Error: numa=local requires the threads to be pinned (affinity).\n");
+    return -1;
+  }
+
   /* If the specified window is larger than the number of samples, we
    * set its value to n_samples.
    */
   if (config.window > config.n_samples)
     config.window = config.n_samples;
 
+  if (config.memory_auto) {
+    long int available = available_memory();
+    if (available > 0)
+      config.memory = available;
+    else
+      fprintf(stderr, "[WARNING] Cannot find the available memory, planning with %.2fGB.\n", config.memory / GIGA);
+  }
+
+  /* The attacks are planned within the cap.
+   */
+  if (config.memory_cap > 0 && config.memory > config.memory_cap)
+    config.memory = config.memory_cap;
+
   return 0;
 }
 
@@ -921,6 +1365,10 @@ void print_config(Config &conf)
   printf("\n  [GENERAL]\n");
 
   printf("\tNumber of threads:\t %i\n", conf.n_threads);
+  if (conf.affinity != AFFINITY_NONE)
+    printf("\tThread affinity:\t %s\n", conf.affinity == AFFINITY_COMPACT ? "compact" : "scatter");
+  if (conf.numa_policy != NUMA_NONE)
+    printf("\tNUMA policy:\t\t %s\n", conf.numa_policy == NUMA_INTERLEAVE ? "interleave" : "local");
   printf("\tIndex first sample:\t %i\n", conf.index_sample);
   if (conf.n_samples)
     printf("\tNumber of samples:\t %i\n", conf.n_samples);
@@ -975,11 +1423,49 @@ void print_config(Config &conf)
     else if (conf.des_switch == DES_6_BITS) printf("\tLookup table layout:\t [6]\n");
   }
 
-  if(conf.memory > GIGA)
+  if (conf.memory_auto)
+    printf("\tMemory:\t\t\t auto, %.2fGB available\n", conf.memory/GIGA);
+  else if(conf.memory > GIGA)
     printf("\tMemory:\t\t\t %.2fGB\n", conf.memory/GIGA);
   else if(conf.memory > MEGA)
     printf("\tMemory:\t\t\t %.2fMB\n", conf.memory/MEGA);
+  if (conf.memory_cap > GIGA)
+    printf("\tMemory cap:\t\t %.2fGB\n", conf.memory_cap/GIGA);
+  else if (conf.memory_cap > 0)
+    printf("\tMemory cap:\t\t %.2fMB\n", conf.memory_cap/MEGA);
   printf("\tKeep track of:\t\t %i\n", conf.top);
+  if (conf.dedup_samples)
+    printf("\tDeduplicate samples:\t True\n");
+  if (conf.dedup_traces)
+    printf("\tDeduplicate traces:\t True\n");
+  if (conf.poi_subset > 0)
+    printf("\tLocalization:\t\t %i traces, %i points, +-%i samples\n", conf.poi_subset, conf.poi_count, conf.poi_margin);
+  if (conf.ttest)
+    printf("\tT-test:\t\t\t %s, threshold %g\n", conf.ttest == 'l' ? conf.ttest_labels.c_str() : "fixed plaintext", conf.ttest_threshold);
+  if (conf.snr)
+    printf("\tSNR classes:\t\t %s\n", conf.snr == 'p' ? "plaintext" : "model");
+  if (conf.quality_filter)
+    printf("\tTrace filter:\t\t z-score %g, clipped ratio %g\n", conf.quality_z, conf.quality_clip_ratio);
+  if (conf.align_length > 0)
+    printf("\tAlignment:\t\t samples [%i, %i), shifts +-%i\n", conf.align_first, conf.align_first + conf.align_length, conf.align_shift);
+  if (conf.dtw_band > 0)
+    printf("\tElastic alignment:\t band +-%i, penalty %g, to %s\n", conf.dtw_band, conf.dtw_penalty, conf.dtw_output.c_str());
+  if (conf.pca_components > 0)
+    printf("\tPCA:\t\t\t %i components, %i training traces\n", conf.pca_components, conf.pca_train);
+  if (conf.pool)
+    printf("\tPooling:\t\t %s of %i samples, stride %i\n",
+        conf.pool == 's' ? "sum" : conf.pool == 'm' ? "mean" : conf.pool == 'a' ? "maxabs" : "sumsq",
+        conf.pool_window, conf.pool_stride);
+  if (conf.quant_bits > 0)
+    printf("\tQuantization:\t\t int%i, %s scale over %i traces\n", conf.quant_bits, conf.quant_per_sample ? "per sample" : "global", conf.quant_train);
+  if (conf.huge_pages)
+    printf("\tHuge pages:\t\t true\n");
+  if (conf.joint_bytes)
+    printf("\tJoint key bytes:\t true\n");
+  if (conf.onthefly_guesses)
+    printf("\tOn-the-fly guesses:\t true\n");
+  if (conf.stats_cache != "")
+    printf("\tStatistics cache:\t %s\n", conf.stats_cache.c_str());
 
 
   if (conf.sep == "") printf("\tSeparator :\t\t STANDARD\n");
@@ -1034,12 +1520,13 @@ void print_top_r(Type corrs[], int n_keys, int correct_key, string csv)
 
 /* Template instantiations
  */
-template int import_matrices(float *** mem, Matrix * matrices, unsigned int n_matrices, bool transpose, int first_sample = 0, int n_samples = 0);
-template int import_matrices(double *** mem, Matrix * matrices, unsigned int n_matrices, bool transpose, int first_sample = 0, int n_samples = 0);
-template int import_matrices(int8_t *** mem, Matrix * matrices, unsigned int n_matrices, bool transpose, int first_sample = 0, int n_samples = 0);
-template int import_matrices(uint8_t *** mem, Matrix * matrices, unsigned int n_matrices, bool transpose, int first_sample = 0, int n_samples = 0);
+template int import_matrices(float *** mem, Matrix * matrices, unsigned int n_matrices, bool transpose, int first_sample = 0, int n_samples = 0, MemTag tag = MEM_TMP);
+template int import_matrices(double *** mem, Matrix * matrices, unsigned int n_matrices, bool transpose, int first_sample = 0, int n_samples = 0, MemTag tag = MEM_TMP);
+template int import_matrices(int8_t *** mem, Matrix * matrices, unsigned int n_matrices, bool transpose, int first_sample = 0, int n_samples = 0, MemTag tag = MEM_TMP);
+template int import_matrices(uint8_t *** mem, Matrix * matrices, unsigned int n_matrices, bool transpose, int first_sample = 0, int n_samples = 0, MemTag tag = MEM_TMP);
 
 template size_t fload(const char str[], float *** mem, int chunk_size, long int chunk_offset, int n_columns, long int col_offset, int tot_n_cols);
+template size_t fload(const char str[], double *** mem, int chunk_size, long int chunk_offset, int n_columns, long int col_offset, int tot_n_cols);
 template size_t fload(const char str[], int8_t *** mem, int chunk_size, long int chunk_offset, int n_columns, long int col_offset, int tot_n_cols);
 
 template int load_file_v_1(const char str[], float *** mem, int n_rows, int n_columns, long int offset, int total_n_columns);
@@ -1047,6 +1534,7 @@ template int load_file_v_1(const char str[], double *** mem, int n_rows, int n_c
 template int load_file_v_1(const char str[], int8_t *** mem, int n_rows, int n_columns, long int offset, int total_n_columns);
 template int load_file_v_1(const char str[], uint8_t *** mem, int n_rows, int n_columns, long int offset, int total_n_columns);
 template int load_file_v_1(const char str[], int *** mem, int n_rows, int n_columns, long int offset, int total_n_columns);
+template int load_file_v_1(const char str[], BitWord *** mem, int n_rows, int n_columns, long int offset, int total_n_columns);
 
 template int load_file(const char str[], float *** mem, int n_rows, int n_columns, long int offset, int total_n_columns);
 template int load_file(const char str[], double *** mem, int n_rows, int n_columns, long int offset, int total_n_columns);
@@ -1054,23 +1542,32 @@ template int load_file(const char str[], int8_t *** mem, int n_rows, int n_colum
 template int load_file(const char str[], uint8_t *** mem, int n_rows, int n_columns, long int offset, int total_n_columns);
 
 template int get_ncol<int8_t>(long int memsize, int ntraces);
+template int get_ncol<int16_t>(long int memsize, int ntraces);
 template int get_ncol<float>(long int memsize, int ntraces);
 template int get_ncol<double>(long int memsize, int ntraces);
+template int get_ncol<BitWord>(long int memsize, int ntraces);
+
+template void plan_attack<float>(const Config & conf, MemoryPlan & plan);
+template void plan_attack<double>(const Config & conf, MemoryPlan & plan);
 
 template void free_matrix(float *** matrix, int n_rows);
 template void free_matrix(double *** matrix, int n_rows);
 template void free_matrix(uint8_t *** matrix, int n_rows);
 template void free_matrix(int8_t *** matrix, int n_rows);
+template void free_matrix(int16_t *** matrix, int n_rows);
 template void free_matrix(int *** matrix, int n_rows);
+template void free_matrix(BitWord *** matrix, int n_rows);
 
 template void print_top_r(CorrSecondOrder <double> corrs[], int n_keys, int correct_key, string csv);
 template void print_top_r(CorrSecondOrder <float> corrs[], int n_keys, int correct_key, string csv);
 template void print_top_r(CorrFirstOrder <double> corrs[], int n_keys, int correct_key, string csv);
 template void print_top_r(CorrFirstOrder <float> corrs[], int n_keys, int correct_key, string csv);
 
-template int allocate_matrix(float *** matrix, int n_rows, int n_columns);
-template int allocate_matrix(double *** matrix, int n_rows, int n_columns);
-template int allocate_matrix(uint8_t *** matrix, int n_rows, int n_columns);
-template int allocate_matrix(int8_t *** matrix, int n_rows, int n_columns);
-template int allocate_matrix(int *** matrix, int n_rows, int n_columns);
+template int allocate_matrix(float *** matrix, int n_rows, int n_columns, MemTag tag);
+template int allocate_matrix(double *** matrix, int n_rows, int n_columns, MemTag tag);
+template int allocate_matrix(uint8_t *** matrix, int n_rows, int n_columns, MemTag tag);
+template int allocate_matrix(int8_t *** matrix, int n_rows, int n_columns, MemTag tag);
+template int allocate_matrix(int16_t *** matrix, int n_rows, int n_columns, MemTag tag);
+template int allocate_matrix(int *** matrix, int n_rows, int n_columns, MemTag tag);
+template int allocate_matrix(BitWord *** matrix, int n_rows, int n_columns, MemTag tag);
 
@@ -30,6 +30,7 @@
 #include <iostream>
 #include <algorithm>
 #include <iomanip>
+#include "alloc.h"
 
 #ifndef RESOURCES
 #define RESOURCES "/usr/share/daredevil"
@@ -66,8 +67,28 @@ struct MatArgs {
   TypeGuess ** guess;
   TypeReturn ** results;
 
+  /* When not NULL, the guesses are generated from the inputs of the traces
+   * and the guesses of every input instead of read from guess (see
+   * GuessModel).
+   */
+  const uint16_t * inputs;
+  const TypeGuess * table;
+
+  /* The multiplicity of every trace, NULL if they all count once, and the
+   * number of traces they stand for.
+   */
+  const int * weight;
+  int n_weight;
+
+  /* When not NULL, the guesses of every key are all 0 or 1 and packed like
+   * the traces of trace_type=b (see BitWord), their products with the
+   * traces being counted by AND and popcount. Only set when the traces are
+   * packed too.
+   */
+  uint64_t ** guess_bits;
+
   MatArgs(TypeTrace ** tr, TypeGuess ** gues, TypeReturn ** res):
-    trace(tr), guess(gues), results(res) {
+    trace(tr), guess(gues), results(res), inputs(NULL), table(NULL), weight(NULL), n_weight(0), guess_bits(NULL) {
     }
 };
 
@@ -199,7 +220,7 @@ class PriorityQueue
   void init(int s)
   {
     max_size = s;
-    array = (Type *) malloc(max_size * sizeof(Type));
+    array = (Type *) mem_alloc(max_size * sizeof(Type), MEM_QUEUES);
     size = 0;
     index_min = 0;
     total = 0;
@@ -221,6 +242,21 @@ class PriorityQueue
     total++;
   }
 
+  /* Inserts the elements of other, counting all its correlations.
+   */
+  void merge(const PriorityQueue & other)
+  {
+    for (int i = 0; i < other.size; i++)
+      insert(other.array[i]);
+    total += other.total - other.size;
+  }
+
+  void release()
+  {
+    mem_free(array);
+    array = NULL;
+  }
+
   void print(int length = -1, int key = -1)
   {
     int i;
@@ -274,6 +310,70 @@ class PriorityQueue
 };
 
 
+/* Best correlations found by one thread over its slice: its own top, best
+ * correlation by key and scores of the samples first, first + 1, ... They
+ * are merged into the shared ones once the slice is done, so that the
+ * threads do not take the lock for every sample.
+ */
+template <typename Corr>
+struct LocalTop {
+
+  PriorityQueue<Corr> pqueue;
+  vector<Corr> top_corr;
+  vector<double> score;
+  int first;
+  bool use_queue;
+
+  LocalTop(int top, int n_keys, bool uq, int fi, int n_scores):
+    top_corr(n_keys), score(n_scores, 0.0), first(fi), use_queue(uq) {
+    pqueue.init(uq ? top : 1);
+  }
+
+  ~LocalTop()
+  {
+    pqueue.release();
+  }
+
+  void insert(const Corr q[], int n_keys)
+  {
+    for (int key = 0; key < n_keys; key++) {
+      if (use_queue)
+        pqueue.insert(q[key]);
+      if (top_corr[key] < q[key])
+        top_corr[key] = q[key];
+    }
+  }
+
+  /* Keeps track of the highest absolute correlation of the sample s.
+   */
+  void update_score(int s, const Corr q[], int n_keys)
+  {
+    for (int k = 0; k < n_keys; k++) {
+      if (fabs(q[k].corr) > score[s - first])
+        score[s - first] = fabs(q[k].corr);
+    }
+  }
+
+  /* Merges into the shared queue, best correlations and scores (NULL if not
+   * kept), the caller holding the lock.
+   */
+  void merge(PriorityQueue<Corr> * shared_queue, Corr * shared_top, double * shared_score)
+  {
+    if (use_queue)
+      shared_queue->merge(pqueue);
+    for (size_t key = 0; key < top_corr.size(); key++) {
+      if (shared_top[key] < top_corr[key])
+        shared_top[key] = top_corr[key];
+    }
+    if (shared_score == NULL)
+      return;
+    for (size_t s = 0; s < score.size(); s++) {
+      if (score[s] > shared_score[first + s])
+        shared_score[first + s] = score[s];
+    }
+  }
+};
+
 /* Used to store the filename and dimensions of the matrix for loading them
  * in files later on.
  */
@@ -287,6 +387,8 @@ struct Matrix {
     }
 };
 
+struct SampleStats;
+
 /* Structure used to store all the configuration information, used by the
  * config file at the moment.
  */
@@ -344,6 +446,7 @@ struct Config {
    * f: float
    * d: double
    * i: int8_t
+   * b: bit-packed traces, held as BitWord
    */
   char type_trace;
   char type_guess;
@@ -404,9 +507,19 @@ struct Config {
    */
   int key_size;
 
-  /* The memory dedicated to the attack.
+  /* The memory dedicated to the attack. With memory_auto, it is the memory
+   * found available when the configuration was loaded, and the attacks keep
+   * as many samples in memory as their exact needs allow.
    */
   long int memory;
+  bool memory_auto;
+
+  /* The cap on the tracked memory (0 for none), past which the attack stops
+   * with the memory in use by every subsystem, and whether this memory is
+   * reported after every stage.
+   */
+  long int memory_cap;
+  bool memory_report;
 
   /* The number of top element we keep track of globally.
    */
@@ -437,6 +550,162 @@ struct Config {
    */
   int8_t bitnum;
 
+  /* Do we want to group the identical or complemented time samples, and only
+   * correlate one sample per group?
+   */
+  bool dedup_samples;
+
+  /* The traces selected for the attack, in increasing order. If empty, the
+   * first n_traces traces are used.
+   */
+  vector<int> trace_index;
+
+  /* Merging of the traces identical to another one, for the same message,
+   * into one weighted trace: whether it is done, and the multiplicity of
+   * every trace of the files (empty if every trace counts once).
+   */
+  bool dedup_traces;
+  bool dedup_done;
+  vector<int> trace_weight;
+
+  /* The ranges of time samples (first sample, number of points) attacked,
+   * the points of a range being pool_stride samples apart. If empty, the
+   * n_samples points starting at index_sample are attacked.
+   */
+  vector<pair<int, int> > sample_ranges;
+
+  /* If not NULL, the highest absolute correlation found for every time
+   * sample, over all the keys.
+   */
+  double * sample_score;
+
+  /* Coarse-to-fine localization: the number of random traces used to find
+   * the points of interest, the number of points kept, and the number of
+   * samples kept around each point.
+   */
+  int poi_subset;
+  int poi_count;
+  int poi_margin;
+
+  /* Pooling of the time samples while loading: 0 (none), 's' (sum), 'm'
+   * (mean), 'a' (max of the absolute values) or 'q' (sum of the squares).
+   * The attacked point s is computed over the pool_window samples starting
+   * at the sample index_sample + s * pool_stride. Both are 1 without pooling.
+   */
+  char pool;
+  int pool_window;
+  int pool_stride;
+
+  /* Rejection of the corrupted traces: whether it is done, the highest
+   * robust z-score of the energy, the absolute level from which a sample is
+   * clipped (0 for the int8 rails only), and the highest ratio of clipped
+   * samples of a trace.
+   */
+  bool quality_filter;
+  bool quality_done;
+  double quality_z;
+  double quality_clip;
+  double quality_clip_ratio;
+
+  /* Static alignment: the reference pattern (first sample and number of
+   * samples, 0 for no alignment), the largest shift searched, and the lowest
+   * normalized correlation of the traces kept. The aligned traces are
+   * written to align_output if not empty.
+   */
+  int align_first;
+  int align_length;
+  int align_shift;
+  double align_threshold;
+  string align_output;
+
+  /* Elastic alignment: the half width of the band of the warping (0 for no
+   * warping), the cost of the steps leaving a constant shift (in mean
+   * distances of the samples at the best shift), the file the warped traces
+   * are written to, and the file the warping paths are cached in (not cached
+   * if empty).
+   */
+  int dtw_band;
+  double dtw_penalty;
+  string dtw_output;
+  string dtw_cache;
+
+  /* The shift of every trace of the files found by the alignment, such that
+   * the sample s of an aligned trace is the sample s + shift of the file.
+   * Empty if the traces are not aligned.
+   */
+  vector<int> trace_shift;
+
+  /* Number of principal components the traces are projected on (0 for no
+   * projection), and number of traces used to compute the covariance.
+   */
+  int pca_components;
+  int pca_train;
+
+  /* The selected traces projected on the components, pca_components x
+   * n_traces, NULL until computed.
+   */
+  double ** projected;
+
+  /* Computes the signal-to-noise ratio of the samples instead of attacking:
+   * 0 (attack), 'p' (classes of plaintext bytes) or 'm' (classes of model
+   * values under the correct key). The whole profile is written to snr_file
+   * if not empty.
+   */
+  char snr;
+  string snr_file;
+
+  /* Runs a Welch t-test instead of attacking: 0 (attack), 'l' (populations
+   * read from the labels file, one byte per trace) or 'f' (population 0 is
+   * the traces whose plaintext starts with ttest_fixed). The samples of
+   * which |t| exceeds the threshold are reported, and the t-statistics are
+   * written to ttest_file if not empty.
+   */
+  char ttest;
+  string ttest_labels;
+  vector<uint8_t> ttest_fixed;
+  double ttest_threshold;
+  string ttest_file;
+
+  /* Quantization of float traces for the first order attack: the number of
+   * bits of the integer samples (0 for none, 8 or 16), whether every sample
+   * has its own scale (otherwise a global one), and the number of traces the
+   * scales are computed over. The sample s is attacked as
+   * round((x - quant_offset[s]) * quant_gain[s]), both empty until computed.
+   */
+  int quant_bits;
+  bool quant_per_sample;
+  int quant_train;
+  vector<double> quant_offset;
+  vector<double> quant_gain;
+
+  /* The file the per sample statistics of the traces are cached in (not
+   * persisted if empty), and the statistics of the samples currently
+   * attacked, NULL until an engine runs.
+   */
+  string stats_cache;
+  SampleStats * stats;
+
+  /* Placement of the threads on the cores and of the traces and guesses on
+   * the NUMA nodes, AFFINITY_* and NUMA_* of affinity.h.
+   */
+  int affinity;
+  int numa_policy;
+
+  /* Whether the first order attack correlates every chunk of the traces with
+   * all the targeted key bytes at once, instead of a pass per key byte.
+   */
+  bool joint_bytes;
+
+  /* Whether the large matrices are backed by transparent huge pages.
+   */
+  bool huge_pages;
+
+  /* Whether the correlation kernels generate the guesses from the inputs of
+   * the traces and the table of the leakage model, instead of reading them
+   * from a matrix of n_keys rows.
+   */
+  bool onthefly_guesses;
+
 };
 
 /* Structure used to store ALL the general and common information
@@ -447,9 +716,12 @@ struct FinalConfig {
   MatArgs<TypeTrace, TypeReturn, TypeGuess> * mat_args;
   Config * conf;
   void * queues;
+  /* The groups of identical samples of the current chunk, NULL if unused.
+   */
+  void * groups;
 
-  FinalConfig(MatArgs<TypeTrace, TypeReturn, TypeGuess> * m_a, Config * c, void * q):
-    mat_args(m_a), conf(c), queues(q){
+  FinalConfig(MatArgs<TypeTrace, TypeReturn, TypeGuess> * m_a, Config * c, void * q, void * g = NULL):
+    mat_args(m_a), conf(c), queues(q), groups(g){
     }
 };
 
@@ -492,15 +764,79 @@ int load_config(Config & conf, const char * conf_file);
 void print_config(Config &conf);
 
 
+/* The rows of the matrices start on a cache line, which is also the
+ * alignment of the vector loads.
+ */
+#define MATRIX_ALIGN    64
+#define HUGE_PAGE_SIZE  (2 << 20)
+
+/* Number of elements between the starts of two rows of n_columns elements in
+ * a matrix, the rows being padded to MATRIX_ALIGN bytes.
+ */
+template <class Type>
+inline size_t matrix_stride(int n_columns)
+{
+  size_t bytes = (size_t) n_columns * sizeof(Type);
+  return ((bytes + MATRIX_ALIGN - 1) / MATRIX_ALIGN * MATRIX_ALIGN) / sizeof(Type);
+}
+
+/* Bit-packed traces (trace_type=b) are held in memory as words of 64 traces:
+ * a row of the traces holds one sample of all the traces, the trace j being
+ * the bit j % 64 of the word j / 64, and the bits past the last trace are 0.
+ */
+typedef uint64_t BitWord;
+#define WORD_BITS 64
+
+/* Whether the rows of traces of type Type hold packed bits.
+ */
+template <class Type>
+inline bool packed_traces()
+{
+  return false;
+}
+
+template <>
+inline bool packed_traces<BitWord>()
+{
+  return true;
+}
+
+/* Number of elements of a row of the traces holding one sample of n traces.
+ */
+template <class Type>
+inline int row_length(int n)
+{
+  return packed_traces<Type>() ? (n + WORD_BITS - 1) / WORD_BITS : n;
+}
+
+/* Value of the trace j in the row x of the traces.
+ */
+template <class Type>
+inline Type sample_value(const Type * x, int j)
+{
+  return x[j];
+}
+
+inline BitWord sample_value(const BitWord * x, int j)
+{
+  return (x[j / WORD_BITS] >> (j % WORD_BITS)) & 1;
+}
+
 /* Frees a matrix
  */
 template <class Type>
 void free_matrix(Type *** matrix, int n_rows);
 
-/* Allocates memory for a matrix
+/* Allocates memory for a matrix, in a single aligned block whose rows must
+ * not be freed or reallocated individually, accounted to tag.
  */
 template <class Type>
-int allocate_matrix(Type *** matrix, int n_rows, int n_columns);
+int allocate_matrix(Type *** matrix, int n_rows, int n_columns, MemTag tag = MEM_TMP);
+
+/* Advises the large matrices allocated from now on to be backed by
+ * transparent huge pages.
+ */
+void set_huge_pages(bool enable);
 
   /* Latest version of load file. This function is used to load chunks in the
    * chunk partitioning approach.
@@ -542,15 +878,73 @@ int load_file(const char str[], Type *** mem, int n_rows, int n_columns, long in
  * @param transpose: If set to true, the resulting array "mem"  will be transposed
  * @param first_sample: Index of the first time_sample we want
  * @param n_samples: number of time samples we want
+ * @param tag: subsystem the memory of mem is accounted to
  */
 template <class Type>
 int import_matrices(Type *** mem, Matrix * matrices,
     unsigned int n_matrices, bool transpose,
-    int first_sample = 0, int n_samples = 0);
+    int first_sample = 0, int n_samples = 0, MemTag tag = MEM_TMP);
 
 template <typename Type>
 int get_ncol(long int memsize, int ntraces);
 
+/* Returns the memory the process can use, the smallest of MemAvailable and
+ * of the room left by the limits of its cgroups (v2, or v1 memory
+ * controller), -1 if unknown.
+ */
+long int available_memory();
+
+/* The memory an attack needs: fixed bytes, and bytes for every sample of
+ * the traces kept in memory.
+ */
+struct MemoryPlan {
+
+  long int fixed;
+  long int per_col;
+
+  MemoryPlan(): fixed(0), per_col(0) {
+  }
+};
+
+/* Adds to plan a matrix allocated by allocate_matrix, of n_rows rows of
+ * n_columns elements, or of a row of n_columns elements by sample if by_col.
+ */
+template <class Type>
+inline void plan_matrix(MemoryPlan & plan, long int n_rows, int n_columns, bool by_col)
+{
+  long int row = matrix_stride<Type>(n_columns) * sizeof(Type) + sizeof(Type *);
+
+  if (by_col)
+    plan.per_col += row;
+  else
+    plan.fixed += n_rows * row + MATRIX_ALIGN;
+}
+
+/* Returns the memory of the guesses of a key byte: a matrix of n_keys rows,
+ * or the input of every trace and the guesses of every input (at most 1024)
+ * with onthefly_guesses.
+ */
+template <class TypeGuess>
+inline long int guess_bytes(const Config & conf)
+{
+  if (conf.onthefly_guesses)
+    return conf.total_n_traces * sizeof(uint16_t) + 1024 * conf.total_n_keys * sizeof(TypeGuess);
+  return conf.total_n_traces * conf.total_n_keys * sizeof(TypeGuess);
+}
+
+/* Adds to plan the buffers common to the correlation attacks: the messages
+ * and sbox inputs of the guesses, the statistics of the samples, the scratch
+ * and best correlations of the threads, and the grouping of the samples.
+ */
+template <class TypeReturn>
+void plan_attack(const Config & conf, MemoryPlan & plan);
+
+/* Returns the largest number of samples, up to n_samples, an attack needing
+ * plan can keep in memory with the memory found available (memory=auto), a
+ * small part of it being left to the system. Logs the resulting plan.
+ */
+int plan_ncol(const Config & conf, const MemoryPlan & plan, int n_samples, const char * engine);
+
 /* Prints the top correlations by key, ranked by the correlation value. If the
  * correct key is specified, colors it :).
  */
@@ -0,0 +1,310 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#include <pthread.h>
+#include <stdio.h>
+#include <omp.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "workers.h"
+#include "affinity.h"
+#include "utils.h"
+
+/* The current batch and the state of the workers, protected by lock. The
+ * workers wait on work for a new batch (generation changes) or for stop, and
+ * the submitting thread waits on done for the last task of its batch.
+ */
+struct WorkerPool {
+
+  vector<pthread_t> threads;
+  pthread_mutex_t submit;
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+
+  void * (*fct)(void *);
+  char * args;
+  size_t size;
+  int n_tasks;
+  int n_done;
+
+  /* The tasks are split in as many contiguous ranges as NUMA nodes, next[k]
+   * and end[k] bounding the tasks left in the range of the node k. A thread
+   * takes the tasks of its node first, then the ones left on the others.
+   */
+  vector<int> next;
+  vector<int> end;
+  long int generation;
+  bool stop;
+  int n_started;
+
+  /* Time spent running tasks by every thread, written by the thread itself,
+   * and time spent in the batches.
+   */
+  vector<double> busy;
+  double wall;
+};
+
+/* Scratch memory of a thread: a block used as a stack, and the blocks
+ * allocated when it was too small, merged into it once it is unused. The
+ * overflows take their place on the stack past the block, so that the marks
+ * also cover them.
+ */
+struct Scratch {
+
+  char * base;
+  size_t capacity;
+  size_t used;
+  size_t peak;
+  vector<pair<size_t, void *> > overflow;
+
+  Scratch(): base(NULL), capacity(0), used(0), peak(0) {
+  }
+
+  ~Scratch()
+  {
+    for (size_t i = 0; i < overflow.size(); i++)
+      mem_free(overflow[i].second);
+    mem_free(base);
+  }
+};
+
+static WorkerPool * pool = NULL;
+static thread_local bool in_task = false;
+static thread_local int thread_index = 0;
+static thread_local int thread_node = 0;
+static thread_local Scratch scratch;
+
+void * scratch_alloc(size_t size)
+{
+  void * res = NULL;
+
+  size = (size + MATRIX_ALIGN - 1) / MATRIX_ALIGN * MATRIX_ALIGN;
+  if (scratch.used + size <= scratch.capacity) {
+    res = scratch.base + scratch.used;
+    scratch.used += size;
+    return res;
+  }
+  res = mem_alloc(max(size, (size_t) MATRIX_ALIGN), MEM_SCRATCH, MATRIX_ALIGN);
+  if (res == NULL)
+    return NULL;
+  scratch.overflow.push_back(make_pair(scratch.used, res));
+  scratch.used += size;
+  scratch.peak = max(scratch.peak, scratch.used);
+  return res;
+}
+
+size_t scratch_mark()
+{
+  return scratch.used;
+}
+
+void scratch_release(size_t mark)
+{
+  while (!scratch.overflow.empty() && scratch.overflow.back().first >= mark) {
+    mem_free(scratch.overflow.back().second);
+    scratch.overflow.pop_back();
+  }
+  scratch.used = mark;
+  if (mark != 0 || scratch.peak <= scratch.capacity)
+    return;
+
+  /* The block grows to what the overflows needed, so that the next tasks fit
+   * in it. The old one is freed first, not to count both against the cap.
+   */
+  mem_free(scratch.base);
+  scratch.base = (char *) mem_alloc(scratch.peak, MEM_SCRATCH, MATRIX_ALIGN);
+  scratch.capacity = (scratch.base != NULL) ? scratch.peak : 0;
+  scratch.peak = 0;
+}
+
+/* Runs a task, its scratch memory being released at its end.
+ */
+static inline void run_task(void * (*fct)(void *), void * args)
+{
+  size_t mark = scratch_mark();
+  fct(args);
+  scratch_release(mark);
+}
+
+/* Returns the next task for the calling thread, -1 if none is left.
+ */
+static int take_task(WorkerPool * p)
+{
+  int n_nodes = p->next.size();
+
+  for (int i = 0; i < n_nodes; i++) {
+    int k = (thread_node + i) % n_nodes;
+    if (p->next[k] < p->end[k])
+      return p->next[k]++;
+  }
+  return -1;
+}
+
+/* Runs the tasks of the current batch until none is left, called and
+ * returning with the lock held.
+ */
+static void run_tasks(WorkerPool * p)
+{
+  int t;
+
+  while ((t = take_task(p)) >= 0) {
+    pthread_mutex_unlock(&p->lock);
+    double start = omp_get_wtime();
+    run_task(p->fct, (void *) (p->args + t * p->size));
+    p->busy[thread_index] += omp_get_wtime() - start;
+    pthread_mutex_lock(&p->lock);
+    if (++p->n_done == p->n_tasks)
+      pthread_cond_signal(&p->done);
+  }
+}
+
+static void * worker(void * args_in)
+{
+  WorkerPool * p = (WorkerPool *) args_in;
+  long int seen = 0;
+
+  in_task = true;
+  pthread_mutex_lock(&p->lock);
+  thread_index = ++p->n_started;
+  pthread_mutex_unlock(&p->lock);
+  thread_node = affinity_pin(thread_index);
+  pthread_mutex_lock(&p->lock);
+  while (true) {
+    while (!p->stop && p->generation == seen)
+      pthread_cond_wait(&p->work, &p->lock);
+    if (p->stop)
+      break;
+    seen = p->generation;
+    run_tasks(p);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+int workers_start(int n_threads)
+{
+  int rc;
+
+  if (pool != NULL)
+    workers_stop();
+  pool = new WorkerPool;
+  pthread_mutex_init(&pool->submit, NULL);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->n_tasks = pool->n_done = 0;
+  pool->next.assign(affinity_n_nodes(), 0);
+  pool->end.assign(affinity_n_nodes(), 0);
+  pool->generation = 0;
+  pool->stop = false;
+  pool->n_started = 0;
+  pool->busy.assign(max(n_threads, 1), 0.0);
+  pool->wall = 0;
+  thread_node = affinity_pin(0);
+
+  for (int n = 0; n < n_threads - 1; n++) {
+    pthread_t t;
+    rc = pthread_create(&t, NULL, worker, (void *) pool);
+    if (rc != 0) {
+      fprintf(stderr, "[ERROR] Creating thread.\n");
+      workers_stop();
+      return -1;
+    }
+    pool->threads.push_back(t);
+  }
+  return 0;
+}
+
+void workers_stop()
+{
+  if (pool == NULL)
+    return;
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  for (size_t n = 0; n < pool->threads.size(); n++)
+    pthread_join(pool->threads[n], NULL);
+  pthread_mutex_destroy(&pool->submit);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->work);
+  pthread_cond_destroy(&pool->done);
+  delete pool;
+  pool = NULL;
+}
+
+int workers_run(void * (*fct)(void *), void * args, size_t size, int n_tasks)
+{
+  if (pool == NULL || pool->threads.empty() || in_task || n_tasks <= 1) {
+    for (int t = 0; t < n_tasks; t++)
+      run_task(fct, (void *) ((char *) args + t * size));
+    return 0;
+  }
+
+  /* One batch at a time, the workers being shared.
+   */
+  pthread_mutex_lock(&pool->submit);
+  double start = omp_get_wtime();
+  pthread_mutex_lock(&pool->lock);
+  pool->fct = fct;
+  pool->args = (char *) args;
+  pool->size = size;
+  pool->n_tasks = n_tasks;
+  for (size_t k = 0; k < pool->next.size(); k++) {
+    pool->next[k] = (k * n_tasks + pool->next.size() - 1) / pool->next.size();
+    pool->end[k] = ((k + 1) * n_tasks + pool->next.size() - 1) / pool->next.size();
+  }
+  pool->n_done = 0;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->work);
+
+  in_task = true;
+  run_tasks(pool);
+  in_task = false;
+  while (pool->n_done < pool->n_tasks)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pool->wall += omp_get_wtime() - start;
+  pthread_mutex_unlock(&pool->lock);
+  pthread_mutex_unlock(&pool->submit);
+  return 0;
+}
+
+void workers_reset_usage()
+{
+  if (pool == NULL)
+    return;
+  pthread_mutex_lock(&pool->lock);
+  pool->busy.assign(pool->busy.size(), 0.0);
+  pool->wall = 0;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void workers_print_usage()
+{
+  if (pool == NULL || pool->threads.empty() || pool->wall <= 0)
+    return;
+  pthread_mutex_lock(&pool->lock);
+  printf("[INFO] Thread utilization over %.3lf seconds of parallel work:", pool->wall);
+  for (size_t n = 0; n < pool->busy.size(); n++)
+    printf(" %.1f%%", 100 * pool->busy[n] / pool->wall);
+  printf("\n");
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,82 @@
+/* ===================================================================== */
+/* This file is part of Daredevil                                        */
+/* Daredevil is a side-channel analysis tool                             */
+/* Copyright (C) 2016                                                    */
+/* Original author:   Paul Bottinelli <paulbottinelli@hotmail.com>       */
+/* Contributors:      Joppe Bos <joppe_bos@hotmail.com>                  */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* any later version.                                                    */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* ===================================================================== */
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stddef.h>
+#include <vector>
+
+using namespace std;
+
+/* Persistent pool of worker threads, started once and shared by all the
+ * stages of the attacks instead of creating and joining threads for every
+ * chunk. A batch of tasks is a function and an array of arguments, as given
+ * to pthread_create before, so that the thread functions are unchanged.
+ */
+
+/* Starts n_threads - 1 workers, the thread submitting a batch being the
+ * last one, pinned as set by affinity_init. Returns -1 on failure.
+ */
+int workers_start(int n_threads);
+
+/* Stops and joins the workers.
+ */
+void workers_stop();
+
+/* Runs fct on each of the n_tasks arguments args, args + size, ... and
+ * returns once they are all done. The tasks are taken in order by the first
+ * available thread, the calling one included. When the threads are pinned
+ * over several NUMA nodes, the threads of the k-th node start with the k-th
+ * range of the tasks. Without workers, or when called from a task, the tasks
+ * are run in the calling thread.
+ */
+int workers_run(void * (*fct)(void *), void * args, size_t size, int n_tasks);
+
+/* Resets, then prints the share of the time spent in the batches during
+ * which every thread was running tasks, the calling thread first.
+ */
+void workers_reset_usage();
+void workers_print_usage();
+
+/* Scratch memory of the calling thread, instead of allocating buffers in
+ * every task: scratch_alloc returns size bytes aligned on MATRIX_ALIGN, valid
+ * until the end of the task or until scratch_release is given the mark taken
+ * before, the allocations being released in reverse order. The memory of a
+ * thread grows to what its largest task needs, then is reused by the next
+ * ones. Returns NULL on failure.
+ */
+void * scratch_alloc(size_t size);
+size_t scratch_mark();
+void scratch_release(size_t mark);
+
+  template <class Type>
+inline Type * scratch_array(size_t n)
+{
+  return (Type *) scratch_alloc(n * sizeof(Type));
+}
+
+  template <class Args>
+inline int workers_run(void * (*fct)(void *), vector<Args> & args)
+{
+  return workers_run(fct, (void *) &args[0], sizeof(Args), args.size());
+}
+
+#endif